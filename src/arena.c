@@ -0,0 +1,103 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t arena_min_block = 4096;
+static const size_t arena_max_block = 1024*1024;
+
+struct arena_block {
+	struct arena_block* prev;
+	size_t size;                               /* bytes available in data */
+	size_t used;                               /* bytes allocated from data */
+	char data[] __attribute__((aligned));      /* largest alignment for any type */
+};
+
+void arena_init(struct arena* arena){
+	arena->head = NULL;
+	arena->allocated = 0;
+	memset(arena->released, 0, sizeof(arena->released));
+}
+
+/**
+ * Size class of n bytes (already rounded to the granule).
+ */
+static size_t arena_class(size_t n){
+	return n / ARENA_GRANULE - 1;
+}
+
+void arena_free(struct arena* arena){
+	struct arena_block* block = arena->head;
+	while ( block ){
+		struct arena_block* prev = block->prev;
+		free(block);
+		block = prev;
+	}
+	arena_init(arena);
+}
+
+void* arena_alloc(struct arena* arena, size_t n, size_t align){
+	n = n > 0 ? (n + ARENA_GRANULE - 1) & ~(size_t)(ARENA_GRANULE - 1) : ARENA_GRANULE;
+	if ( align < ARENA_GRANULE ){
+		align = ARENA_GRANULE;
+	}
+
+	/* released allocations are only aligned to the granule */
+	const size_t class = arena_class(n);
+	if ( class < ARENA_CLASSES && align == ARENA_GRANULE && arena->released[class] ){
+		void* ptr = arena->released[class];
+		memcpy(&arena->released[class], ptr, sizeof(void*));
+		return ptr;
+	}
+
+	struct arena_block* block = arena->head;
+	size_t offset = block ? (block->used + align - 1) & ~(align - 1) : 0;
+
+	if ( !block || offset > block->size || block->size - offset < n ){
+		/* blocks double in size (up to a limit) so the number of blocks is
+		 * logarithmic, larger requests get a block of their own */
+		size_t size = block ? block->size * 2 : arena_min_block;
+		if ( size > arena_max_block ) size = arena_max_block;
+		if ( size < n ) size = n;
+
+		block = malloc(sizeof(struct arena_block) + size);
+		if ( !block ){
+			return NULL;
+		}
+		block->prev = arena->head;
+		block->size = size;
+		block->used = 0;
+		arena->head = block;
+		arena->allocated += size;
+		offset = 0;
+	}
+
+	block->used = offset + n;
+	return block->data + offset;
+}
+
+char* arena_strdup(struct arena* arena, const char* str){
+	const size_t len = strlen(str) + 1;
+	char* copy = arena_alloc(arena, len, 1);
+	if ( copy ){
+		memcpy(copy, str, len);
+	}
+	return copy;
+}
+
+void arena_release(struct arena* arena, void* ptr, size_t n){
+	if ( !ptr ){
+		return;
+	}
+
+	/* the released allocation holds the next pointer of the list */
+	n = n > 0 ? (n + ARENA_GRANULE - 1) & ~(size_t)(ARENA_GRANULE - 1) : ARENA_GRANULE;
+	const size_t class = arena_class(n);
+	if ( class < ARENA_CLASSES ){
+		memcpy(ptr, &arena->released[class], sizeof(void*));
+		arena->released[class] = ptr;
+	}
+}
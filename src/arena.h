@@ -0,0 +1,65 @@
+#ifndef TWEAKLIB_ARENA_H
+#define TWEAKLIB_ARENA_H
+
+/**
+ * Bump allocator for small allocations (e.g. variable names). Memory is
+ * allocated in geometrically growing blocks and only returned to the system
+ * all at once by arena_free(), existing allocations never move. Small
+ * allocations can be released individually with arena_release() and are then
+ * reused by later allocations of the same size.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* sizes are rounded up to the granule, released allocations up to
+ * ARENA_GRANULE * ARENA_CLASSES bytes are kept for reuse */
+#define ARENA_GRANULE 8
+#define ARENA_CLASSES 64
+
+struct arena_block;
+
+struct arena {
+	struct arena_block* head;             /* current block, linked to the previous */
+	size_t allocated;                     /* total bytes allocated by blocks */
+	void* released[ARENA_CLASSES];        /* released allocations by size class */
+};
+
+#define ARENA_INITIALIZER {NULL, 0, {NULL,}}
+
+void arena_init(struct arena* arena);
+
+/**
+ * Release all blocks, invalidating every allocation.
+ */
+void arena_free(struct arena* arena);
+
+/**
+ * Allocate n bytes with the given alignment (a power of two no larger than
+ * required by any type).
+ *
+ * @return pointer or NULL if malloc() failed.
+ */
+void* arena_alloc(struct arena* arena, size_t n, size_t align);
+
+/**
+ * Copy a null-terminated string into the arena.
+ *
+ * @return copy or NULL if malloc() failed.
+ */
+char* arena_strdup(struct arena* arena, const char* str);
+
+/**
+ * Release an allocation of n bytes (same size as allocated) for reuse. Large
+ * allocations are kept until arena_free().
+ */
+void arena_release(struct arena* arena, void* ptr, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_ARENA_H */
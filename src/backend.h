@@ -0,0 +1,70 @@
+#ifndef TWEAKLIB_BACKEND_H
+#define TWEAKLIB_BACKEND_H
+
+/**
+ * Network I/O backends. A backend waits for socket events on the server thread
+ * and calls back into the server (see below) which implements the protocols.
+ */
+
+#include "client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct backend {
+	const char* name;
+
+	/**
+	 * Prepare backend for serving the (non-blocking) listening socket. Returns
+	 * non-zero if the backend is unavailable.
+	 */
+	int (*init)(int listen_sd);
+	void (*cleanup)();
+
+	/**
+	 * Call callback on the server thread while fd is readable. The callback
+	 * must consume the readiness (e.g. read the pipe or eventfd).
+	 */
+	int (*watch)(int fd, void (*callback)());
+
+	/**
+	 * Wait for and dispatch one batch of events.
+	 */
+	void (*poll)();
+
+	/**
+	 * Start serving a newly accepted client. Returns non-zero on errors.
+	 */
+	int (*attach)(struct client* client);
+
+	/**
+	 * Send queued client output without blocking. Returns zero if the
+	 * connection failed. When previously queued output has been sent the
+	 * backend calls server_handle_output().
+	 */
+	int (*flush)(struct client* client);
+
+	/**
+	 * Called for closed clients before they are freed. Returns zero if the
+	 * backend still has pending operations on the client and it must be kept
+	 * around a while longer.
+	 */
+	int (*release)(struct client* client);
+};
+
+extern const struct backend backend_epoll;
+#ifdef HAVE_LIBURING
+extern const struct backend backend_uring;
+#endif
+
+/* implemented by server */
+void server_accept_client(int sd);
+void server_handle_input(struct client* client, int open);
+void server_handle_output(struct client* client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_BACKEND_H */
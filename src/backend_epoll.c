@@ -0,0 +1,212 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "backend.h"
+#include "client.h"
+#include "log.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#define MAX_EVENTS 64
+#define MAX_WATCHES 4
+#define ACCEPT_RETRY_MS 100
+#define CLIENT_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+
+struct watch {
+	int fd;
+	void (*callback)();
+};
+
+static int epoll_fd = -1;
+static int listen_sd = -1;
+static int accept_paused = 0;             /* listening socket disarmed until resources are released */
+static int accept_stalled = 0;            /* accept failed for lack of resources, logged once */
+static struct watch watches[MAX_WATCHES];
+static int num_watches = 0;
+
+/* epoll tag for the listening socket, watches are tagged with the watch and
+ * client events with the client pointer itself */
+static int tag_listen;
+
+static int epoll_add(int fd, uint32_t events, void* ptr){
+	struct epoll_event ev = {0,};
+	ev.events = events;
+	ev.data.ptr = ptr;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * Enable or disable accepting connections. The listening socket is
+ * level-triggered so pending connections are reported again once enabled.
+ */
+static void listen_enable(int enable){
+	struct epoll_event ev = {0,};
+	ev.events = enable ? EPOLLIN : 0;
+	ev.data.ptr = &tag_listen;
+	if ( epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_sd, &ev) != 0 ){
+		logmsg("epoll_ctl() failed: %s\n", strerror(errno));
+	}
+	accept_paused = !enable;
+}
+
+static int backend_epoll_init(int sd){
+	if ( (epoll_fd=epoll_create1(EPOLL_CLOEXEC)) == -1 ){
+		logmsg("epoll_create1() failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	/* level-triggered so connections left in the backlog (e.g. when out of
+	 * descriptors) are not forgotten until the next client connects */
+	if ( epoll_add(sd, EPOLLIN, &tag_listen) != 0 ){
+		logmsg("epoll_ctl() failed: %s\n", strerror(errno));
+		close(epoll_fd);
+		epoll_fd = -1;
+		return 1;
+	}
+
+	listen_sd = sd;
+	return 0;
+}
+
+static void backend_epoll_cleanup(){
+	close(epoll_fd);
+	epoll_fd = -1;
+	listen_sd = -1;
+	accept_paused = 0;
+	accept_stalled = 0;
+	num_watches = 0;
+}
+
+static int backend_epoll_watch(int fd, void (*callback)()){
+	if ( num_watches == MAX_WATCHES ){
+		logmsg("too many watched descriptors\n");
+		return 1;
+	}
+
+	/* level-triggered so the callback may leave data for the next wakeup */
+	struct watch* watch = &watches[num_watches];
+	watch->fd = fd;
+	watch->callback = callback;
+	if ( epoll_add(fd, EPOLLIN, watch) != 0 ){
+		logmsg("epoll_ctl() failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	num_watches++;
+	return 0;
+}
+
+static void handle_accept(){
+	for (;;){
+		int cd = accept4(listen_sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if ( cd == -1 ){
+			if ( errno == EINTR ) continue;
+			if ( errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM ){
+				/* the backlog would be reported again right away, stop accepting
+				 * until a client is released or the retry timeout expires */
+				if ( !accept_stalled ){
+					logmsg("accept() failed: %s, retrying every %d ms\n", strerror(errno), ACCEPT_RETRY_MS);
+				}
+				accept_stalled = 1;
+				listen_enable(0);
+			} else if ( errno != EAGAIN && errno != EWOULDBLOCK ){
+				logmsg("accept() failed: %s\n", strerror(errno));
+			}
+			return;
+		}
+
+		accept_stalled = 0;
+		server_accept_client(cd);
+	}
+}
+
+static void handle_client(struct client* client, uint32_t events){
+	if ( client->state == CLIENT_CLOSED ){
+		return;
+	}
+
+	if ( events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) ){
+		const enum client_read_status status = client_read(client);
+		server_handle_input(client, status != CLIENT_READ_CLOSED);
+
+		/* read budget exhausted, modifying the edge-triggered registration
+		 * reports the socket again on the next poll after the other clients
+		 * had their turn */
+		if ( status == CLIENT_READ_MORE && client->state != CLIENT_CLOSED ){
+			struct epoll_event ev = {0,};
+			ev.events = CLIENT_EVENTS;
+			ev.data.ptr = client;
+			if ( epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->sd, &ev) != 0 ){
+				logmsg("epoll_ctl() failed: %s\n", strerror(errno));
+				client->state = CLIENT_CLOSED;
+			}
+		}
+	}
+
+	/* socket is writable again, also when reported together with input so
+	 * refreshes skipped while the output was backed up are scheduled */
+	if ( (events & EPOLLOUT) && client->state != CLIENT_CLOSED ){
+		server_handle_output(client);
+	}
+}
+
+static void backend_epoll_poll(){
+	struct epoll_event events[MAX_EVENTS];
+
+	int n = epoll_wait(epoll_fd, events, MAX_EVENTS, accept_paused ? ACCEPT_RETRY_MS : -1);
+	if ( n == 0 && accept_paused ){
+		listen_enable(1);
+	}
+	if ( n == -1 ){
+		if ( errno != EINTR ){
+			logmsg("epoll_wait() failed: %s\n", strerror(errno));
+		}
+		return;
+	}
+
+	for ( int i = 0; i < n; i++ ){
+		void* ptr = events[i].data.ptr;
+		if ( ptr == &tag_listen ){
+			handle_accept();
+		} else if ( ptr >= (void*)watches && ptr < (void*)(watches + MAX_WATCHES) ){
+			((struct watch*)ptr)->callback();
+		} else {
+			handle_client((struct client*)ptr, events[i].events);
+		}
+	}
+}
+
+static int backend_epoll_attach(struct client* client){
+	if ( epoll_add(client->sd, CLIENT_EVENTS, client) != 0 ){
+		logmsg("epoll_ctl() failed: %s\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+static int backend_epoll_release(struct client* client){
+	/* the descriptor is closed next so a stalled backlog can be retried */
+	if ( accept_paused ){
+		listen_enable(1);
+	}
+
+	/* closing the socket removes it from the epoll set */
+	return 1;
+}
+
+const struct backend backend_epoll = {
+	.name = "epoll",
+	.init = backend_epoll_init,
+	.cleanup = backend_epoll_cleanup,
+	.watch = backend_epoll_watch,
+	.poll = backend_epoll_poll,
+	.attach = backend_epoll_attach,
+	.flush = client_flush,
+	.release = backend_epoll_release,
+};
@@ -0,0 +1,372 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_LIBURING
+
+#include "backend.h"
+#include "client.h"
+#include "log.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <liburing.h>
+
+#define QUEUE_DEPTH 256
+#define BUFFER_GROUP 1
+#define BUFFER_COUNT 64                        /* must be a power of two */
+#define BUFFER_SIZE 16384
+#define MAX_WATCHES 4
+
+/* operation is stored in the low bits of the user data, the rest is the client
+ * or watch pointer (if any) */
+enum {
+	OP_ACCEPT = 1,
+	OP_WATCH,
+	OP_RECV,
+	OP_SEND,
+	OP_CANCEL,
+	OP_MASK = 7,
+};
+
+struct watch {
+	int fd;
+	void (*callback)();
+	int armed;
+} __attribute__((aligned(8))); /* low bits are used for tagging */
+
+static struct io_uring ring;
+static struct io_uring_buf_ring* buf_ring = NULL;
+static char* buf_storage = NULL;
+static int listen_sd = -1;
+static struct watch watches[MAX_WATCHES];
+static int num_watches = 0;
+static int accept_armed = 0;
+static int starved = 0;                        /* no sqe was available, poll must not block */
+
+static uint64_t tag(void* ptr, int op){
+	return (uint64_t)(uintptr_t)ptr | op;
+}
+
+/**
+ * Get a submission entry. If the submission queue is full it is submitted
+ * first, which may still fail (or leave it full).
+ *
+ * @return entry or NULL if none is available.
+ */
+static struct io_uring_sqe* get_sqe(){
+	struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+	if ( !sqe ){
+		/* submission queue is full, submit what we have and retry */
+		io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+	}
+	if ( !sqe ){
+		starved = 1;
+	}
+	return sqe;
+}
+
+/* accept and watches which could not be armed are retried by the next poll */
+static void arm_accept(){
+	struct io_uring_sqe* sqe = get_sqe();
+	accept_armed = sqe != NULL;
+	if ( !sqe ) return;
+
+	io_uring_prep_multishot_accept(sqe, listen_sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	io_uring_sqe_set_data64(sqe, tag(NULL, OP_ACCEPT));
+}
+
+static void arm_watch(struct watch* watch){
+	/* single-shot poll behaves level-triggered, it completes directly if the
+	 * descriptor is still readable when rearmed */
+	struct io_uring_sqe* sqe = get_sqe();
+	watch->armed = sqe != NULL;
+	if ( !sqe ) return;
+
+	io_uring_prep_poll_add(sqe, watch->fd, POLLIN);
+	io_uring_sqe_set_data64(sqe, tag(watch, OP_WATCH));
+}
+
+/**
+ * @return zero if successful.
+ */
+static int arm_recv(struct client* client){
+	struct io_uring_sqe* sqe = get_sqe();
+	if ( !sqe ){
+		return 1;
+	}
+
+	io_uring_prep_recv_multishot(sqe, client->sd, NULL, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BUFFER_GROUP;
+	io_uring_sqe_set_data64(sqe, tag(client, OP_RECV));
+	client->inflight++;
+	return 0;
+}
+
+/**
+ * @return zero if successful.
+ */
+static int submit_send(struct client* client){
+	/* the message is kept in the client as it must stay valid until the send is
+	 * completed, the queued frames are kept until they are consumed */
+	memset(&client->msg, 0, sizeof(struct msghdr));
+	client->msg.msg_iov = client->iov;
+	client->msg.msg_iovlen = client_iov(client, client->iov, CLIENT_IOV_MAX);
+
+	struct io_uring_sqe* sqe = get_sqe();
+	if ( !sqe ){
+		return 1;
+	}
+
+	io_uring_prep_sendmsg(sqe, client->sd, &client->msg, MSG_NOSIGNAL);
+	io_uring_sqe_set_data64(sqe, tag(client, OP_SEND));
+	client->sending = 1;
+	client->inflight++;
+	return 0;
+}
+
+static void recycle_buffer(int bid){
+	io_uring_buf_ring_add(buf_ring, buf_storage + bid * BUFFER_SIZE, BUFFER_SIZE, bid, io_uring_buf_ring_mask(BUFFER_COUNT), 0);
+	io_uring_buf_ring_advance(buf_ring, 1);
+}
+
+static void backend_uring_cleanup();
+
+static int backend_uring_init(int sd){
+	int ret;
+
+	if ( (ret=io_uring_queue_init(QUEUE_DEPTH, &ring, 0)) < 0 ){
+		logmsg("io_uring_queue_init() failed: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	/* multishot recv was added in the same kernel release (6.0) as zerocopy
+	 * send, which unlike the former can be probed for */
+	struct io_uring_probe* probe = io_uring_get_probe_ring(&ring);
+	const int supported = probe && io_uring_opcode_supported(probe, IORING_OP_SEND_ZC);
+	io_uring_free_probe(probe);
+	if ( !supported ){
+		logmsg("io_uring: kernel lacks multishot recv support\n");
+		io_uring_queue_exit(&ring);
+		return 1;
+	}
+
+	/* provided buffers for recv */
+	buf_storage = malloc(BUFFER_COUNT * BUFFER_SIZE);
+	buf_ring = io_uring_setup_buf_ring(&ring, BUFFER_COUNT, BUFFER_GROUP, 0, &ret);
+	if ( !buf_storage || !buf_ring ){
+		logmsg("io_uring_setup_buf_ring() failed: %s\n", strerror(-ret));
+		free(buf_storage);
+		buf_storage = NULL;
+		io_uring_queue_exit(&ring);
+		return 1;
+	}
+	for ( int bid = 0; bid < BUFFER_COUNT; bid++ ){
+		io_uring_buf_ring_add(buf_ring, buf_storage + bid * BUFFER_SIZE, BUFFER_SIZE, bid, io_uring_buf_ring_mask(BUFFER_COUNT), bid);
+	}
+	io_uring_buf_ring_advance(buf_ring, BUFFER_COUNT);
+
+	listen_sd = sd;
+	arm_accept();
+	if ( !accept_armed ){
+		logmsg("io_uring: failed to arm accept\n");
+		backend_uring_cleanup();
+		return 1;
+	}
+
+	return 0;
+}
+
+static void backend_uring_cleanup(){
+	/* tearing down the ring cancels all remaining operations */
+	io_uring_free_buf_ring(&ring, buf_ring, BUFFER_COUNT, BUFFER_GROUP);
+	io_uring_queue_exit(&ring);
+	free(buf_storage);
+	buf_ring = NULL;
+	buf_storage = NULL;
+	listen_sd = -1;
+	num_watches = 0;
+	accept_armed = 0;
+	starved = 0;
+}
+
+static int backend_uring_watch(int fd, void (*callback)()){
+	if ( num_watches == MAX_WATCHES ){
+		logmsg("too many watched descriptors\n");
+		return 1;
+	}
+
+	struct watch* watch = &watches[num_watches++];
+	watch->fd = fd;
+	watch->callback = callback;
+	arm_watch(watch);
+	return 0;
+}
+
+static int backend_uring_flush(struct client* client){
+	/* only a single send is in flight per client, new output is queued until
+	 * it completes */
+	if ( client->sending || client->queued == 0 ){
+		return 1;
+	}
+
+	/* the connection is closed if the send cannot be submitted */
+	return submit_send(client) == 0;
+}
+
+static void handle_accept(const struct io_uring_cqe* cqe){
+	if ( cqe->res >= 0 ){
+		server_accept_client(cqe->res);
+	} else if ( cqe->res != -ECANCELED ){
+		logmsg("accept() failed: %s\n", strerror(-cqe->res));
+	}
+
+	if ( !(cqe->flags & IORING_CQE_F_MORE) ){
+		arm_accept();
+	}
+}
+
+static void handle_recv(struct client* client, const struct io_uring_cqe* cqe){
+	const int more = cqe->flags & IORING_CQE_F_MORE;
+	if ( !more ){
+		client->inflight--;
+	}
+
+	if ( cqe->res > 0 ){
+		const int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		const int failed = buffer_append(&client->in, buf_storage + bid * BUFFER_SIZE, cqe->res);
+		recycle_buffer(bid);
+		if ( failed ){
+			logmsg("%s [%d] - malloc() failed, closing connection\n", client->peeraddr, client->id);
+			client->state = CLIENT_CLOSED;
+			return;
+		}
+		server_handle_input(client, 1);
+	} else if ( cqe->res == 0 ){
+		logmsg("%s [%d] - connection closed\n", client->peeraddr, client->id);
+		server_handle_input(client, 0);
+		return;
+	} else if ( cqe->res != -ENOBUFS ){
+		if ( cqe->res != -ECANCELED ){
+			logmsg("%s [%d] - recv() failed: %s\n", client->peeraddr, client->id, strerror(-cqe->res));
+		}
+		client->state = CLIENT_CLOSED;
+		return;
+	}
+
+	/* multishot recv terminates when it runs out of provided buffers */
+	if ( !more && client->state != CLIENT_CLOSED && arm_recv(client) != 0 ){
+		logmsg("%s [%d] - failed to rearm recv\n", client->peeraddr, client->id);
+		client->state = CLIENT_CLOSED;
+	}
+}
+
+static void handle_send(struct client* client, const struct io_uring_cqe* cqe){
+	client->inflight--;
+	client->sending = 0;
+
+	if ( cqe->res < 0 ){
+		if ( cqe->res != -ECANCELED ){
+			logmsg("%s [%d] - send() failed: %s\n", client->peeraddr, client->id, strerror(-cqe->res));
+		}
+		client->state = CLIENT_CLOSED;
+		return;
+	}
+
+	/* continue with partial send or the output queued in the meantime */
+	client_consume(client, cqe->res);
+	if ( client->state != CLIENT_CLOSED ){
+		server_handle_output(client);
+	}
+}
+
+static void backend_uring_poll(){
+	if ( !accept_armed ){
+		arm_accept();
+	}
+	for ( int i = 0; i < num_watches; i++ ){
+		if ( !watches[i].armed ){
+			arm_watch(&watches[i]);
+		}
+	}
+
+	/* something failed to get an entry (possibly a release), don't block so
+	 * it is retried soon */
+	const unsigned int wait = starved ? 0 : 1;
+	starved = 0;
+	int ret = io_uring_submit_and_wait(&ring, wait);
+	if ( ret < 0 && ret != -EINTR ){
+		logmsg("io_uring_submit_and_wait() failed: %s\n", strerror(-ret));
+		return;
+	}
+
+	struct io_uring_cqe* cqe;
+	unsigned int head;
+	unsigned int n = 0;
+	io_uring_for_each_cqe(&ring, head, cqe){
+		const uint64_t data = io_uring_cqe_get_data64(cqe);
+		void* ptr = (void*)(uintptr_t)(data & ~(uint64_t)OP_MASK);
+
+		switch ( data & OP_MASK ){
+		case OP_ACCEPT:
+			handle_accept(cqe);
+			break;
+		case OP_WATCH:
+			((struct watch*)ptr)->armed = 0;
+			((struct watch*)ptr)->callback();
+			arm_watch((struct watch*)ptr);
+			break;
+		case OP_RECV:
+			handle_recv((struct client*)ptr, cqe);
+			break;
+		case OP_SEND:
+			handle_send((struct client*)ptr, cqe);
+			break;
+		case OP_CANCEL:
+			break;
+		}
+
+		n++;
+	}
+	io_uring_cq_advance(&ring, n);
+}
+
+static int backend_uring_attach(struct client* client){
+	return arm_recv(client);
+}
+
+static int backend_uring_release(struct client* client){
+	/* the client must be kept until all its operations has completed */
+	if ( client->inflight > 0 && !client->cancelled ){
+		/* without an entry the cancel is retried when released again after
+		 * the next poll (which does not block) */
+		struct io_uring_sqe* sqe = get_sqe();
+		if ( !sqe ){
+			return 0;
+		}
+		io_uring_prep_cancel_fd(sqe, client->sd, IORING_ASYNC_CANCEL_ALL);
+		io_uring_sqe_set_data64(sqe, tag(NULL, OP_CANCEL));
+		client->cancelled = 1;
+	}
+	return client->inflight == 0;
+}
+
+const struct backend backend_uring = {
+	.name = "io_uring",
+	.init = backend_uring_init,
+	.cleanup = backend_uring_cleanup,
+	.watch = backend_uring_watch,
+	.poll = backend_uring_poll,
+	.attach = backend_uring_attach,
+	.flush = backend_uring_flush,
+	.release = backend_uring_release,
+};
+
+#endif /* HAVE_LIBURING */
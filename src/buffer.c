@@ -0,0 +1,63 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t buffer_min_alloc = 1024;
+
+void buffer_init(struct buffer* buf){
+	buf->data = NULL;
+	buf->size = 0;
+	buf->alloc = 0;
+}
+
+void buffer_free(struct buffer* buf){
+	free(buf->data);
+	buffer_init(buf);
+}
+
+char* buffer_reserve(struct buffer* buf, size_t n){
+	const size_t required = buf->size + n + 1; /* +1 so null terminator will fit */
+	if ( required > buf->alloc ){
+		size_t alloc = buf->alloc > 0 ? buf->alloc : buffer_min_alloc;
+		while ( alloc < required ){
+			alloc *= 2;
+		}
+		char* data = realloc(buf->data, alloc);
+		if ( !data ){
+			return NULL;
+		}
+		buf->data = data;
+		buf->alloc = alloc;
+	}
+	return buf->data + buf->size;
+}
+
+int buffer_append(struct buffer* buf, const void* data, size_t n){
+	if ( n == 0 ) return 0;
+
+	char* dst = buffer_reserve(buf, n);
+	if ( !dst ){
+		return 1;
+	}
+	memcpy(dst, data, n);
+	buf->size += n;
+	return 0;
+}
+
+void buffer_consume(struct buffer* buf, size_t n){
+	if ( n >= buf->size ){
+		buf->size = 0;
+		return;
+	}
+
+	memmove(buf->data, buf->data + n, buf->size - n);
+	buf->size -= n;
+}
+
+void buffer_clear(struct buffer* buf){
+	buf->size = 0;
+}
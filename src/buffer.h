@@ -0,0 +1,57 @@
+#ifndef TWEAKLIB_BUFFER_H
+#define TWEAKLIB_BUFFER_H
+
+/**
+ * Growable byte buffer. Data is appended at the end and consumed from the
+ * front.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct buffer {
+	char* data;                                /* raw storage */
+	size_t size;                               /* number of bytes used */
+	size_t alloc;                              /* number of bytes allocated */
+};
+
+#define BUFFER_INITIALIZER {NULL, 0, 0}
+
+void buffer_init(struct buffer* buf);
+void buffer_free(struct buffer* buf);
+
+/**
+ * Ensure at least n bytes can be appended without reallocation. There is
+ * always room for one extra byte past the requested size so the content can be
+ * temporarily null-terminated.
+ *
+ * @return pointer to the first unused byte or NULL if the allocation failed
+ *         (the content is left intact).
+ */
+char* buffer_reserve(struct buffer* buf, size_t n);
+
+/**
+ * Append n bytes to the end of the buffer.
+ *
+ * @return zero if successful, non-zero if the allocation failed.
+ */
+int buffer_append(struct buffer* buf, const void* data, size_t n);
+
+/**
+ * Remove n bytes from the front of the buffer.
+ */
+void buffer_consume(struct buffer* buf, size_t n);
+
+/**
+ * Remove all data (but keep allocation).
+ */
+void buffer_clear(struct buffer* buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_BUFFER_H */
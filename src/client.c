@@ -0,0 +1,263 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "client.h"
+#include "log.h"
+#include "server.h"
+#include "wsdeflate.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+static const size_t read_size = 16384;
+static const size_t write_size = 4096;     /* min allocation for written data */
+
+struct client* client_new(int sd, unsigned int id){
+	struct client* client = malloc(sizeof(struct client));
+	if ( !client ){
+		return NULL;
+	}
+
+	char buf[PEER_ADDR_LEN];
+	client->id = id;
+	client->sd = sd;
+	client->slot = -1;
+	client->state = CLIENT_HTTP;
+	client->peeraddr = strdup(peer_addr(sd, buf));
+	buffer_init(&client->in);
+	client->protocol = 0;
+	client->deflate = NULL;
+	memset(&client->reader, 0, sizeof(struct websocket_reader));
+	buffer_init(&client->reader.message);
+	client->refresh_seq = 0;
+	client->resync = 0;
+	client->refresh_interval = 0;
+	client->refresh_next = 0;
+	subscription_init(&client->subscription, 1);
+	client->queue = NULL;
+	client->queue_head = 0;
+	client->queue_size = 0;
+	client->queue_alloc = 0;
+	client->queue_offset = 0;
+	client->queued = 0;
+	client->queued_peak = 0;
+	client->dropped = 0;
+	client->overflow = 0;
+	client->sending = 0;
+	client->inflight = 0;
+	client->cancelled = 0;
+
+	return client;
+}
+
+void client_free(struct client* client){
+	if ( client->sd >= 0 ) close(client->sd);
+	buffer_free(&client->in);
+	buffer_free(&client->reader.message);
+	client_consume(client, client->queued);
+	free(client->queue);
+	free(client->peeraddr);
+	wsdeflate_free(client->deflate);
+	subscription_free(&client->subscription);
+	free(client);
+}
+
+enum client_read_status client_read(struct client* client){
+	size_t total = 0;
+	while ( total < CLIENT_READ_BUDGET && client->in.size < CLIENT_MAX_INPUT ){
+		char* dst = buffer_reserve(&client->in, read_size);
+		if ( !dst ){
+			logmsg("%s [%d] - malloc() failed, closing connection\n", client->peeraddr, client->id);
+			return CLIENT_READ_CLOSED;
+		}
+
+		ssize_t bytes = recv(client->sd, dst, read_size, 0);
+		if ( bytes == -1 ){
+			if ( errno == EINTR ) continue;
+			if ( errno == EAGAIN || errno == EWOULDBLOCK ) return CLIENT_READ_DRAINED;
+			logmsg("%s [%d] - recv() failed: %s\n", client->peeraddr, client->id, strerror(errno));
+			return CLIENT_READ_CLOSED;
+		} else if ( bytes == 0 ){
+			logmsg("%s [%d] - connection closed\n", client->peeraddr, client->id);
+			return CLIENT_READ_CLOSED;
+		}
+
+		client->in.size += bytes;
+		total += bytes;
+	}
+
+	/* the rest is read once the buffered input has been parsed */
+	return CLIENT_READ_MORE;
+}
+
+void client_set_refresh_rate(struct client* client, unsigned int hz){
+	if ( hz > CLIENT_MAX_REFRESH_RATE ){
+		hz = CLIENT_MAX_REFRESH_RATE;
+	}
+	client->refresh_interval = hz > 0 ? 1000000000 / hz : 0;
+}
+
+static struct client_output* client_output(const struct client* client, size_t i){
+	return &client->queue[(client->queue_head + i) & (client->queue_alloc - 1)];
+}
+
+static struct frame* client_frame(const struct client* client, size_t i){
+	return client_output(client, i)->frame;
+}
+
+static int client_push(struct client* client, struct frame* frame, int droppable){
+	if ( client->queued + frame->size > CLIENT_MAX_QUEUED ){
+		logmsg("%s [%d] - output queue full (%zu bytes), closing connection\n", client->peeraddr, client->id, client->queued);
+		client->overflow = 1;
+		return 1;
+	}
+
+	if ( client->queue_size == client->queue_alloc ){
+		/* grow and unwrap the circular array */
+		const size_t alloc = client->queue_alloc > 0 ? client->queue_alloc * 2 : 16;
+		struct client_output* queue = malloc(sizeof(struct client_output) * alloc);
+		if ( !queue ){
+			return 1;
+		}
+		for ( size_t i = 0; i < client->queue_size; i++ ){
+			queue[i] = *client_output(client, i);
+		}
+		free(client->queue);
+		client->queue = queue;
+		client->queue_head = 0;
+		client->queue_alloc = alloc;
+	}
+
+	struct client_output* out = client_output(client, client->queue_size++);
+	out->frame = frame;
+	out->droppable = droppable;
+	client->queued += frame->size;
+	if ( client->queued > client->queued_peak ){
+		client->queued_peak = client->queued;
+	}
+	return 0;
+}
+
+void client_write(struct client* client, const void* data, size_t bytes){
+	if ( bytes == 0 ) return;
+
+	/* append to the last frame if no one else is using it */
+	if ( client->queue_size > 0 ){
+		const struct client_output* last = client_output(client, client->queue_size - 1);
+		if ( !last->droppable && last->frame->refs == 1 && last->frame->alloc - last->frame->size >= bytes ){
+			frame_append(last->frame, data, bytes);
+			client->queued += bytes;
+			return;
+		}
+	}
+
+	struct frame* frame = frame_alloc(bytes > write_size ? bytes : write_size);
+	if ( !frame ){
+		logmsg("%s [%d] - malloc() failed: %s\n", client->peeraddr, client->id, strerror(errno));
+		client->state = CLIENT_CLOSED;
+		return;
+	}
+	frame_append(frame, data, bytes);
+	if ( client_push(client, frame, 0) != 0 ){
+		frame_unref(frame);
+		client->state = CLIENT_CLOSED;
+	}
+}
+
+void client_send(struct client* client, struct frame* frame){
+	if ( client_push(client, frame_ref(frame), 0) != 0 ){
+		frame_unref(frame);
+		client->state = CLIENT_CLOSED;
+	}
+}
+
+void client_send_droppable(struct client* client, struct frame* frame){
+	if ( client_push(client, frame_ref(frame), 1) != 0 ){
+		frame_unref(frame);
+		client->state = CLIENT_CLOSED;
+	}
+}
+
+size_t client_drop(struct client* client){
+	/* frames in an ongoing send and a partially sent frame must be kept */
+	size_t keep = client->queue_offset > 0 ? 1 : 0;
+	if ( client->sending && (size_t)client->msg.msg_iovlen > keep ){
+		keep = client->msg.msg_iovlen;
+	}
+
+	/* compact the remaining frames in place */
+	size_t dropped = 0;
+	size_t dst = keep;
+	for ( size_t i = keep; i < client->queue_size; i++ ){
+		struct client_output* out = client_output(client, i);
+		if ( out->droppable ){
+			client->queued -= out->frame->size;
+			frame_unref(out->frame);
+			dropped++;
+			continue;
+		}
+		*client_output(client, dst++) = *out;
+	}
+
+	client->queue_size = dst;
+	client->dropped += dropped;
+	return dropped;
+}
+
+int client_iov(const struct client* client, struct iovec* iov, int max){
+	int n = 0;
+	size_t offset = client->queue_offset;
+	for ( size_t i = 0; i < client->queue_size && n < max; i++ ){
+		struct frame* frame = client_frame(client, i);
+		iov[n].iov_base = frame->data + offset;
+		iov[n].iov_len = frame->size - offset;
+		offset = 0;
+		n++;
+	}
+	return n;
+}
+
+void client_consume(struct client* client, size_t bytes){
+	client->queued -= bytes;
+	while ( bytes > 0 ){
+		struct frame* frame = client_frame(client, 0);
+		const size_t left = frame->size - client->queue_offset;
+		if ( bytes < left ){
+			client->queue_offset += bytes;
+			return;
+		}
+
+		bytes -= left;
+		client->queue_offset = 0;
+		client->queue_head = (client->queue_head + 1) & (client->queue_alloc - 1);
+		client->queue_size--;
+		frame_unref(frame);
+	}
+}
+
+int client_flush(struct client* client){
+	struct iovec iov[CLIENT_IOV_MAX];
+
+	while ( client->queued > 0 ){
+		struct msghdr msg = {0,};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = client_iov(client, iov, CLIENT_IOV_MAX);
+		ssize_t bytes = sendmsg(client->sd, &msg, MSG_NOSIGNAL);
+
+		if ( bytes == -1 ){
+			if ( errno == EINTR ) continue;
+			if ( errno == EAGAIN || errno == EWOULDBLOCK ) break;
+			logmsg("%s [%d] - send() failed: %s\n", client->peeraddr, client->id, strerror(errno));
+			return 0;
+		}
+
+		client_consume(client, bytes);
+	}
+
+	return 1;
+}
@@ -0,0 +1,172 @@
+#ifndef TWEAKLIB_CLIENT_H
+#define TWEAKLIB_CLIENT_H
+
+#include "buffer.h"
+#include "frame.h"
+#include "group.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct wsdeflate;
+
+#define CLIENT_IOV_MAX 64                 /* max number of frames sent at once */
+#define CLIENT_MAX_QUEUED (64*1024*1024)  /* connection is closed if more output is queued */
+#define CLIENT_MAX_REFRESH_RATE 1000      /* highest refresh rate (per second) a client may ask for */
+#define CLIENT_MAX_INPUT (2*1024*1024)    /* connection is closed if more unparsed input is pending */
+#define CLIENT_READ_BUDGET (64*1024)      /* max bytes read from a client per wakeup */
+
+enum client_read_status {
+	CLIENT_READ_CLOSED = 0,               /* connection was closed or failed */
+	CLIENT_READ_DRAINED,                  /* all available data was read */
+	CLIENT_READ_MORE,                     /* budget exhausted, more data might be pending */
+};
+
+enum client_state {
+	CLIENT_HTTP = 0,                      /* connection handles plain HTTP requests */
+	CLIENT_WEBSOCKET,                     /* connection has been upgraded to a websocket */
+	CLIENT_CLOSED,                        /* connection will be closed by the server loop */
+};
+
+/**
+ * Queued output, droppable frames may be removed before they are sent if
+ * superseded by later output.
+ */
+struct client_output {
+	struct frame* frame;
+	int droppable;
+};
+
+/**
+ * Websocket frame reader, frames are parsed from the input buffer as data
+ * arrives and fragmented messages are reassembled.
+ */
+struct websocket_reader {
+	int state;                            /* waiting for frame header or payload */
+	int fin;                              /* header of current frame */
+	int res;
+	int opcode;
+	int masked;
+	uint8_t mask[4];
+	uint64_t payload_size;
+	struct buffer message;                /* fragments of current message received so far */
+	int message_opcode;                   /* opcode of fragmented message in progress or zero */
+	int message_compressed;
+};
+
+/**
+ * State for a single connection. All connections are served by the server
+ * thread so no locking is needed.
+ */
+struct client {
+	unsigned int id;
+	int sd;
+	int slot;                             /* index in server client list */
+	enum client_state state;
+	char* peeraddr;
+	struct buffer in;                     /* received data not yet handled */
+	int protocol;                         /* websocket sub-protocol */
+	struct wsdeflate* deflate;            /* permessage-deflate state or NULL if not negotiated */
+	struct websocket_reader reader;
+	uint64_t refresh_seq;                 /* next refresh event to send */
+	int resync;                           /* stale refreshes dropped, full refresh pending */
+	uint64_t refresh_interval;            /* minimum time between refreshes (ns), zero for no limit */
+	uint64_t refresh_next;                /* earliest time for the next refresh (CLOCK_MONOTONIC ns) */
+	struct subscription subscription;     /* groups sent to the client, all by default */
+
+	/* send queue, circular array of frames not yet (fully) sent */
+	struct client_output* queue;
+	size_t queue_head;                    /* index of oldest frame */
+	size_t queue_size;                    /* number of queued frames */
+	size_t queue_alloc;                   /* capacity (power of two) */
+	size_t queue_offset;                  /* bytes of the oldest frame already sent */
+	size_t queued;                        /* total number of bytes not yet sent */
+	size_t queued_peak;                   /* largest number of bytes queued at once */
+	size_t dropped;                       /* number of droppable frames dropped */
+	int overflow;                         /* connection closed because the queue was full */
+
+	/* backend bookkeeping for completion based I/O */
+	struct msghdr msg;                    /* output handed to the backend */
+	struct iovec iov[CLIENT_IOV_MAX];
+	int sending;                          /* send in progress */
+	int inflight;                         /* number of backend operations in progress */
+	int cancelled;                        /* in progress operations has been cancelled */
+};
+
+/**
+ * Allocate state for a connected (non-blocking) socket.
+ */
+struct client* client_new(int sd, unsigned int id);
+
+/**
+ * Close connection and release all resources.
+ */
+void client_free(struct client* client);
+
+/**
+ * Read available data into the input buffer, at most CLIENT_READ_BUDGET bytes
+ * per call so a client which keeps sending cannot starve the others. Reading
+ * also stops once CLIENT_MAX_INPUT bytes are buffered.
+ */
+enum client_read_status client_read(struct client* client);
+
+/**
+ * Set the maximum number of refreshes per second sent to the client, zero for
+ * no limit.
+ */
+void client_set_refresh_rate(struct client* client, unsigned int hz);
+
+/**
+ * Queue data for sending, nothing is sent until client_flush() is called.
+ */
+void client_write(struct client* client, const void* data, size_t bytes);
+
+/**
+ * Queue a (shared) frame for sending, the client takes a reference.
+ */
+void client_send(struct client* client, struct frame* frame);
+
+/**
+ * Queue a (shared) frame which may be dropped by client_drop() if it has not
+ * been sent yet.
+ */
+void client_send_droppable(struct client* client, struct frame* frame);
+
+/**
+ * Drop queued droppable frames which has not started sending. Frames handed
+ * to the backend are kept.
+ *
+ * @return number of frames dropped.
+ */
+size_t client_drop(struct client* client);
+
+/**
+ * Fill iov with queued output, oldest first.
+ *
+ * @return number of iov elements used.
+ */
+int client_iov(const struct client* client, struct iovec* iov, int max);
+
+/**
+ * Remove bytes which has been sent from the front of the queue.
+ */
+void client_consume(struct client* client, size_t bytes);
+
+/**
+ * Send as much queued data as the socket accepts without blocking. Remaining
+ * data is sent the next time the socket becomes writable.
+ *
+ * @return zero if the connection failed.
+ */
+int client_flush(struct client* client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_CLIENT_H */
@@ -0,0 +1,126 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "dirty.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WORD_BITS 64
+
+void dirty_init(struct dirty* dirty){
+	dirty->bits = NULL;
+	dirty->words = 0;
+	dirty->vars = NULL;
+	dirty->n = 0;
+	dirty->alloc = 0;
+	dirty->all = 0;
+}
+
+void dirty_free(struct dirty* dirty){
+	free(dirty->bits);
+	free(dirty->vars);
+	dirty_init(dirty);
+}
+
+/**
+ * Ensure there is room for marking another variable with the given index.
+ *
+ * @return zero if successful.
+ */
+static int dirty_reserve(struct dirty* dirty, size_t index){
+	const size_t word = index / WORD_BITS;
+	if ( word >= dirty->words ){
+		const size_t words = (word + 1) * 2;
+		uint64_t* bits = realloc(dirty->bits, sizeof(uint64_t) * words);
+		if ( !bits ){
+			return 1;
+		}
+		memset(bits + dirty->words, 0, sizeof(uint64_t) * (words - dirty->words));
+		dirty->bits = bits;
+		dirty->words = words;
+	}
+
+	if ( dirty->n == dirty->alloc ){
+		const size_t alloc = dirty->alloc > 0 ? dirty->alloc * 2 : 64;
+		struct var** vars = realloc(dirty->vars, sizeof(struct var*) * alloc);
+		if ( !vars ){
+			return 1;
+		}
+		dirty->vars = vars;
+		dirty->alloc = alloc;
+	}
+
+	return 0;
+}
+
+void dirty_mark(struct dirty* dirty, struct var* var){
+	if ( dirty->all || !var_live(var) ){
+		return;
+	}
+
+	const size_t index = var_index(var);
+	const uint64_t bit = UINT64_C(1) << (index % WORD_BITS);
+	if ( index / WORD_BITS < dirty->words && (dirty->bits[index / WORD_BITS] & bit) ){
+		return;
+	}
+
+	/* marking everything is always correct, only slower */
+	if ( dirty_reserve(dirty, index) != 0 ){
+		dirty->all = 1;
+		return;
+	}
+
+	dirty->bits[index / WORD_BITS] |= bit;
+	dirty->vars[dirty->n++] = var;
+}
+
+void dirty_mark_set(struct dirty* dirty, const struct refresh* set){
+	if ( !set ){
+		dirty->all = 1;
+		return;
+	}
+
+	for ( size_t i = 0; i < set->n; i++ ){
+		dirty_mark(dirty, set->vars[i]);
+	}
+}
+
+int dirty_empty(const struct dirty* dirty){
+	return !dirty->all && dirty->n == 0;
+}
+
+void dirty_clear(struct dirty* dirty){
+	if ( dirty->all && dirty->bits ){
+		memset(dirty->bits, 0, sizeof(uint64_t) * dirty->words);
+	} else if ( !dirty->all ){
+		/* each set bit belongs to a marked variable so whole words are cleared */
+		for ( size_t i = 0; i < dirty->n; i++ ){
+			const size_t index = var_index(dirty->vars[i]);
+			dirty->bits[index / WORD_BITS] = 0;
+		}
+	}
+
+	dirty->n = 0;
+	dirty->all = 0;
+}
+
+struct refresh* dirty_take(struct dirty* dirty){
+	const size_t n = dirty->all ? var_count() : dirty->n;
+	struct refresh* set = refresh_alloc(n);
+
+	if ( set && dirty->all ){
+		set->n = 0;
+		for ( size_t i = 0; i < n; i++ ){
+			struct var* var = var_get(i);
+			if ( var_live(var) ){
+				set->vars[set->n++] = var;
+			}
+		}
+	} else if ( set ){
+		memcpy(set->vars, dirty->vars, sizeof(struct var*) * n);
+	}
+
+	dirty_clear(dirty);
+	return set;
+}
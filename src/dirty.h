@@ -0,0 +1,64 @@
+#ifndef TWEAKLIB_DIRTY_H
+#define TWEAKLIB_DIRTY_H
+
+/**
+ * Set of changed variables. Membership is tracked by handle using the same
+ * indexing as var_from_handle() so marking a variable already in the set is
+ * cheap and repeated refreshes of the same variable are coalesced. Only the
+ * latest value is read when the set is eventually serialized, by then the
+ * variable might have been removed (serializing skips it).
+ */
+
+#include "refresh.h"
+#include "vars.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct dirty {
+	uint64_t* bits;                       /* membership by VAR_INDEX(handle) */
+	size_t words;
+	struct var** vars;                    /* marked variables in order */
+	size_t n;
+	size_t alloc;
+	int all;                              /* all variables are marked */
+};
+
+#define DIRTY_INITIALIZER {NULL, 0, NULL, 0, 0, 0}
+
+void dirty_init(struct dirty* dirty);
+void dirty_free(struct dirty* dirty);
+
+/**
+ * Mark a single variable, removed variables are ignored. If memory cannot be
+ * allocated all variables are marked instead.
+ */
+void dirty_mark(struct dirty* dirty, struct var* var);
+
+/**
+ * Mark all variables in set, NULL marks all variables.
+ */
+void dirty_mark_set(struct dirty* dirty, const struct refresh* set);
+
+int dirty_empty(const struct dirty* dirty);
+
+/**
+ * Unmark all variables.
+ */
+void dirty_clear(struct dirty* dirty);
+
+/**
+ * Move the marked variables into a new refresh set and clear the set.
+ *
+ * @return the refresh set or NULL if malloc() failed.
+ */
+struct refresh* dirty_take(struct dirty* dirty);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_DIRTY_H */
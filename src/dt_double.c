@@ -4,12 +4,15 @@
 
 #include "tweak/tweak.h"
 #include "log.h"
+#include "utils/json_writer.h"
 #include "vars.h"
+#include <stdint.h>
 #include <string.h>
+#include <endian.h>
 #include <json.h>
 
-static struct json_object* store_double(const struct var* var){
-	return json_object_new_double(*(double*)var->ptr);
+static void store_double(const struct var* var, struct json_writer* w){
+	json_write_double(w, *(double*)var->ptr);
 }
 
 static void load_double(struct var* var, struct json_object* obj){
@@ -20,9 +23,35 @@ static void load_double(struct var* var, struct json_object* obj){
 	*(double*)var->ptr = json_object_get_double(obj);
 }
 
-tweak_handle tweak_double(const char* name, double* ptr){
-	struct var* var = var_create(name, sizeof(double), ptr, DATATYPE_DOUBLE);
+static size_t pack_double(const struct var* var, char dst[VAR_PACKED_MAX]){
+	uint64_t raw;
+	memcpy(&raw, var->ptr, sizeof(double));
+	raw = htole64(raw);
+	memcpy(dst, &raw, sizeof(double));
+	return sizeof(double);
+}
+
+static size_t unpack_double(struct var* var, const char* src, size_t size){
+	uint64_t raw;
+	if ( size < sizeof(double) ) return 0;
+	memcpy(&raw, src, sizeof(double));
+	raw = le64toh(raw);
+	memcpy(var->ptr, &raw, sizeof(double));
+	return sizeof(double);
+}
+
+void var_setup_double(struct var* var){
 	var->store = store_double;
 	var->load = load_double;
+	var->pack = pack_double;
+	var->unpack = unpack_double;
+}
+
+tweak_handle tweak_double(const char* name, double* ptr){
+	struct var* var = var_create(name, sizeof(double), ptr, DATATYPE_DOUBLE);
+	if ( !var ){
+		return 0;
+	}
+	var_setup_double(var);
 	return var_add(var);
 }
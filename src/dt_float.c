@@ -4,12 +4,15 @@
 
 #include "tweak/tweak.h"
 #include "log.h"
+#include "utils/json_writer.h"
 #include "vars.h"
+#include <stdint.h>
 #include <string.h>
+#include <endian.h>
 #include <json.h>
 
-static struct json_object* store_float(const struct var* var){
-	return json_object_new_double(*(float*)var->ptr);
+static void store_float(const struct var* var, struct json_writer* w){
+	json_write_float(w, *(float*)var->ptr);
 }
 
 static void load_float(struct var* var, struct json_object* obj){
@@ -20,9 +23,35 @@ static void load_float(struct var* var, struct json_object* obj){
 	*(float*)var->ptr = (float)json_object_get_double(obj);
 }
 
-tweak_handle tweak_float(const char* name, float* ptr){
-	struct var* var = var_create(name, sizeof(float), ptr, DATATYPE_FLOAT);
+static size_t pack_float(const struct var* var, char dst[VAR_PACKED_MAX]){
+	uint32_t raw;
+	memcpy(&raw, var->ptr, sizeof(float));
+	raw = htole32(raw);
+	memcpy(dst, &raw, sizeof(float));
+	return sizeof(float);
+}
+
+static size_t unpack_float(struct var* var, const char* src, size_t size){
+	uint32_t raw;
+	if ( size < sizeof(float) ) return 0;
+	memcpy(&raw, src, sizeof(float));
+	raw = le32toh(raw);
+	memcpy(var->ptr, &raw, sizeof(float));
+	return sizeof(float);
+}
+
+void var_setup_float(struct var* var){
 	var->store = store_float;
 	var->load = load_float;
+	var->pack = pack_float;
+	var->unpack = unpack_float;
+}
+
+tweak_handle tweak_float(const char* name, float* ptr){
+	struct var* var = var_create(name, sizeof(float), ptr, DATATYPE_FLOAT);
+	if ( !var ){
+		return 0;
+	}
+	var_setup_float(var);
 	return var_add(var);
 }
@@ -4,12 +4,15 @@
 
 #include "tweak/tweak.h"
 #include "log.h"
+#include "utils/json_writer.h"
 #include "vars.h"
+#include <stdint.h>
 #include <string.h>
+#include <endian.h>
 #include <json.h>
 
-static struct json_object* store_int(const struct var* var){
-	return json_object_new_int(*(int*)var->ptr);
+static void store_int(const struct var* var, struct json_writer* w){
+	json_write_int(w, *(int*)var->ptr);
 }
 
 static void load_int(struct var* var, struct json_object* obj){
@@ -19,9 +22,35 @@ static void load_int(struct var* var, struct json_object* obj){
 	*(int*)var->ptr = json_object_get_int(obj);
 }
 
-tweak_handle tweak_int(const char* name, int* ptr){
-	struct var* var = var_create(name, sizeof(int), ptr, DATATYPE_INTEGER);
+static size_t pack_int(const struct var* var, char dst[VAR_PACKED_MAX]){
+	uint32_t raw;
+	memcpy(&raw, var->ptr, sizeof(int));
+	raw = htole32(raw);
+	memcpy(dst, &raw, sizeof(int));
+	return sizeof(int);
+}
+
+static size_t unpack_int(struct var* var, const char* src, size_t size){
+	uint32_t raw;
+	if ( size < sizeof(int) ) return 0;
+	memcpy(&raw, src, sizeof(int));
+	raw = le32toh(raw);
+	memcpy(var->ptr, &raw, sizeof(int));
+	return sizeof(int);
+}
+
+void var_setup_int(struct var* var){
 	var->store = store_int;
 	var->load = load_int;
+	var->pack = pack_int;
+	var->unpack = unpack_int;
+}
+
+tweak_handle tweak_int(const char* name, int* ptr){
+	struct var* var = var_create(name, sizeof(int), ptr, DATATYPE_INTEGER);
+	if ( !var ){
+		return 0;
+	}
+	var_setup_int(var);
 	return var_add(var);
 }
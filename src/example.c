@@ -14,6 +14,9 @@ static int foo = 7;
 static float bar = 12;
 static int running = 1;
 
+/* registered by tweak_init() */
+static TWEAK_VAR(double, exposure, 1.0, 0.0, 4.0);
+
 void sighandler(int signum){
 	if ( running ){
 		running = 0;
@@ -45,19 +48,22 @@ int main(int argc, const char* argv[]){
 	tweak_trigger(tl_bar, update);
 	tweak_options(tl_bar, "{\"min\": 5, \"max\": 35, \"step\": 0.1}"); /* json */
 
+	/* updates are applied by tweak_sync() so no lock is needed */
+	tweak_defer_updates(1);
+
 	signal(SIGINT, sighandler);
 
 	while (running) {
-		tweak_lock();
-		{
-			printf("foo: %d bar: %.1f\n", foo, bar);
+		tweak_sync();
+
+		printf("foo: %d bar: %.1f exposure: %.2f\n", foo, bar, exposure);
 
-			foo++;
+		foo++;
 
-			tweak_handle update[] = {tl_foo};
-			tweak_refresh_vars(update, sizeof(update));
-		}
-		tweak_unlock();
+		/* clients are sent the value as of the publish */
+		tweak_handle update[] = {tl_foo};
+		tweak_publish_vars(update, sizeof(update));
+		tweak_refresh_vars(update, sizeof(update));
 
 		sleep(1);
 	}
@@ -0,0 +1,35 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "frame.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct frame* frame_alloc(size_t alloc){
+	struct frame* frame = malloc(sizeof(struct frame) + alloc);
+	if ( frame ){
+		frame->refs = 1;
+		frame->size = 0;
+		frame->alloc = alloc;
+	}
+	return frame;
+}
+
+void frame_append(struct frame* frame, const void* data, size_t n){
+	assert(frame->size + n <= frame->alloc);
+	memcpy(frame->data + frame->size, data, n);
+	frame->size += n;
+}
+
+struct frame* frame_ref(struct frame* frame){
+	frame->refs++;
+	return frame;
+}
+
+void frame_unref(struct frame* frame){
+	if ( frame && --frame->refs == 0 ){
+		free(frame);
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef TWEAKLIB_FRAME_H
+#define TWEAKLIB_FRAME_H
+
+/**
+ * Reference counted block of output data.
+ *
+ * A frame is encoded once and can then be queued on any number of connections
+ * without copying. Frames are only used by the server thread so the reference
+ * count is not atomic. A frame must not be modified while anyone else holds a
+ * reference to it.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct frame {
+	unsigned int refs;                    /* number of references */
+	size_t size;                          /* number of bytes used */
+	size_t alloc;                         /* number of bytes allocated */
+	char data[];
+};
+
+/**
+ * Allocate an empty frame with room for alloc bytes, the caller holds the
+ * only reference.
+ */
+struct frame* frame_alloc(size_t alloc);
+
+/**
+ * Append n bytes to the end of the frame. It is up to the caller to ensure the
+ * frame has room.
+ */
+void frame_append(struct frame* frame, const void* data, size_t n);
+
+/**
+ * Take another reference to the frame.
+ */
+struct frame* frame_ref(struct frame* frame);
+
+/**
+ * Release a reference, the frame is freed when the last reference is gone.
+ */
+void frame_unref(struct frame* frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_FRAME_H */
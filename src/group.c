@@ -0,0 +1,177 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "arena.h"
+#include "group.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WORD_BITS 64
+
+static struct arena storage = ARENA_INITIALIZER;
+static const struct group* groups = NULL;      /* most recently created */
+static unsigned int num_groups = 0;
+static const struct group* last = NULL;        /* variables are usually grouped in sequence */
+
+/**
+ * Copy path into dst without empty levels.
+ *
+ * @return length of normalized path.
+ */
+static size_t group_normalize(char* dst, const char* path){
+	size_t len = 0;
+	while ( *path ){
+		const size_t n = strcspn(path, "/");
+		if ( n > 0 ){
+			if ( len > 0 ) dst[len++] = '/';
+			memcpy(dst + len, path, n);
+			len += n;
+		}
+		path += n;
+		path += strspn(path, "/");
+	}
+	dst[len] = 0;
+	return len;
+}
+
+static const struct group* group_lookup(const char* name){
+	for ( const struct group* it = __atomic_load_n(&groups, __ATOMIC_ACQUIRE); it; it = it->next ){
+		if ( strcmp(it->name, name) == 0 ){
+			return it;
+		}
+	}
+	return NULL;
+}
+
+int group_create(const char* path, const struct group** group){
+	if ( last && strcmp(last->name, path) == 0 ){
+		*group = last;
+		return 0;
+	}
+
+	char* name = malloc(strlen(path) + 1);
+	if ( !name ){
+		return 1;
+	}
+
+	const size_t len = group_normalize(name, path);
+	const struct group* parent = NULL;
+
+	/* create each level in turn, name is temporarily cut after the level */
+	for ( size_t end = 0; end < len; end++ ){
+		end += strcspn(name + end, "/");
+		const char saved = name[end];
+		name[end] = 0;
+
+		const struct group* found = group_lookup(name);
+		if ( !found ){
+			struct group* created = arena_alloc(&storage, sizeof(struct group), sizeof(void*));
+			char* copy = arena_strdup(&storage, name);
+			if ( !created || !copy ){
+				free(name);
+				return 1;
+			}
+
+			created->id = num_groups++;
+			created->name = copy;
+			created->parent = parent;
+			created->next = groups;
+			__atomic_store_n(&groups, created, __ATOMIC_RELEASE);
+			found = created;
+		}
+
+		name[end] = saved;
+		parent = found;
+	}
+
+	free(name);
+	last = parent;
+	*group = parent;
+	return 0;
+}
+
+int group_find(const char* path, const struct group** group){
+	char* name = malloc(strlen(path) + 1);
+	if ( !name ){
+		return 1;
+	}
+
+	const size_t len = group_normalize(name, path);
+	*group = len > 0 ? group_lookup(name) : NULL;
+	const int found = len == 0 || *group;
+
+	free(name);
+	return !found;
+}
+
+const struct group* group_first(){
+	return __atomic_load_n(&groups, __ATOMIC_ACQUIRE);
+}
+
+void group_cleanup(){
+	arena_free(&storage);
+	groups = NULL;
+	num_groups = 0;
+	last = NULL;
+}
+
+void subscription_init(struct subscription* sub, int all){
+	sub->bits = NULL;
+	sub->words = 0;
+	sub->all = all;
+}
+
+void subscription_free(struct subscription* sub){
+	free(sub->bits);
+	subscription_init(sub, 0);
+}
+
+int subscription_add(struct subscription* sub, const struct group* group){
+	if ( !group ){
+		sub->all = 1;
+		return 0;
+	}
+
+	const size_t word = group->id / WORD_BITS;
+	if ( word >= sub->words ){
+		const size_t words = (word + 1) * 2;
+		uint64_t* bits = realloc(sub->bits, sizeof(uint64_t) * words);
+		if ( !bits ){
+			return 1;
+		}
+		memset(bits + sub->words, 0, sizeof(uint64_t) * (words - sub->words));
+		sub->bits = bits;
+		sub->words = words;
+	}
+
+	sub->bits[word] |= UINT64_C(1) << (group->id % WORD_BITS);
+	return 0;
+}
+
+void subscription_remove(struct subscription* sub, const struct group* group){
+	if ( !group ){
+		sub->all = 0;
+		return;
+	}
+
+	const size_t word = group->id / WORD_BITS;
+	if ( word < sub->words ){
+		sub->bits[word] &= ~(UINT64_C(1) << (group->id % WORD_BITS));
+	}
+}
+
+int subscription_visible(const struct subscription* sub, const struct group* group){
+	if ( sub->all ){
+		return 1;
+	}
+
+	for ( ; group; group = group->parent ){
+		const size_t word = group->id / WORD_BITS;
+		if ( word < sub->words && (sub->bits[word] & (UINT64_C(1) << (group->id % WORD_BITS))) ){
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,91 @@
+#ifndef TWEAKLIB_GROUP_H
+#define TWEAKLIB_GROUP_H
+
+/**
+ * Hierarchical variable groups and per-client subscriptions.
+ *
+ * Groups are named by paths where "/" separates levels, e.g.
+ * "render/lighting" is a child of "render". Groups are created on demand and
+ * never released until group_cleanup() so pointers to them stay valid.
+ * Variables without a group belong to the root.
+ *
+ * Clients subscribe to groups and are only sent variables in subscribed
+ * groups (or descendants of them). Subscribing to the root group (NULL or the
+ * empty name) means all variables.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct group {
+	unsigned int id;                      /* sequential, starting from zero */
+	const char* name;                     /* full path */
+	const struct group* parent;           /* NULL for top-level groups */
+	const struct group* next;             /* previously created group */
+};
+
+struct subscription {
+	uint64_t* bits;                       /* subscribed groups by id */
+	size_t words;
+	int all;                              /* subscribed to the root group */
+};
+
+/**
+ * Find group by path, creating it and all parents if needed. Empty levels are
+ * ignored so "/render//lighting/" is the same as "render/lighting" and the
+ * empty path is the root group (NULL). Must only be called from one thread at
+ * a time.
+ *
+ * @return zero if successful.
+ */
+int group_create(const char* path, const struct group** group);
+
+/**
+ * Find an existing group by path. Safe to call from any thread.
+ *
+ * @return zero if found.
+ */
+int group_find(const char* path, const struct group** group);
+
+/**
+ * Most recently created group, follow next for the rest. Safe to call from any
+ * thread.
+ */
+const struct group* group_first();
+
+/**
+ * Release all groups.
+ */
+void group_cleanup();
+
+void subscription_init(struct subscription* sub, int all);
+void subscription_free(struct subscription* sub);
+
+/**
+ * Subscribe to group (NULL for the root group).
+ *
+ * @return zero if successful.
+ */
+int subscription_add(struct subscription* sub, const struct group* group);
+
+/**
+ * Unsubscribe from group (NULL for the root group). Descendants subscribed
+ * separately stays subscribed.
+ */
+void subscription_remove(struct subscription* sub, const struct group* group);
+
+/**
+ * Tell if variables in group (NULL for the root group) are visible to the
+ * subscriber, i.e. the group or any of its ancestors are subscribed.
+ */
+int subscription_visible(const struct subscription* sub, const struct group* group);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_GROUP_H */
@@ -9,9 +9,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
 
 static const int HTTP_OK = 1;
 
@@ -127,8 +124,8 @@ static int http_parse_header(http_request_t req, char* line){
 	char* c = NULL;
 	char* key = strtok_r(line, ": ", &c);
 	char* value = strtok_r(NULL, "\r\n", &c);
-	while ( value[0] == 32 ) value++; /* trim leading spaces */
 	if ( key && value ){
+		while ( value[0] == 32 ) value++; /* trim leading spaces */
 		header_add(&req->header, key, value);
 	}
 
@@ -212,34 +209,34 @@ void http_response_status(http_response_t resp, int code, const char* msg){
 	}
 }
 
-void http_response_write_header(struct worker* client, http_request_t req, http_response_t resp, int only_header){
+void http_response_write_header(struct client* client, http_request_t req, http_response_t resp){
 	logmsg("%s [%d] - %s %s -> %d\n", client->peeraddr, client->id, method_str(req->method), req->url, resp->statuscode);
 	req->status = resp->statuscode;
 
-	send(client->sd, resp->statusline, strlen(resp->statusline), MSG_MORE);
-	send(client->sd, "\r\n", 2, MSG_MORE);
+	client_write(client, resp->statusline, strlen(resp->statusline));
+	client_write(client, "\r\n", 2);
 
 	for ( unsigned int i = 0; i < resp->header.num_elem; i++ ){
-		send(client->sd, resp->header.kv[i].key, strlen(resp->header.kv[i].key), MSG_MORE);
-		send(client->sd, ": ", 2, MSG_MORE);
-		send(client->sd, resp->header.kv[i].value, strlen(resp->header.kv[i].value), MSG_MORE);
-		send(client->sd, "\r\n", 2, MSG_MORE);
+		client_write(client, resp->header.kv[i].key, strlen(resp->header.kv[i].key));
+		client_write(client, ": ", 2);
+		client_write(client, resp->header.kv[i].value, strlen(resp->header.kv[i].value));
+		client_write(client, "\r\n", 2);
 	}
 
-	send(client->sd, "\r\n", 2, only_header ? 0 : MSG_MORE);
+	client_write(client, "\r\n", 2);
 }
 
-void http_response_write_chunk(int sd, const char* data, size_t bytes){
+void http_response_write_chunk(struct client* client, const char* data, size_t bytes){
 	char len[32];
 	snprintf(len, sizeof(len), "%zx\r\n", bytes);
-	send(sd, len, strlen(len), MSG_MORE);
+	client_write(client, len, strlen(len));
 
-	/* if this is the last chunk: flush buffer */
+	/* last chunk */
 	if ( bytes == 0 ){
-		send(sd, "\r\n", 2, 0);
+		client_write(client, "\r\n", 2);
 		return;
 	}
 
-	send(sd, data, bytes, MSG_MORE);
-	send(sd, "\r\n", 2, MSG_MORE);
+	client_write(client, data, bytes);
+	client_write(client, "\r\n", 2);
 }
@@ -1,7 +1,7 @@
 #ifndef TWEAKLIB_HTTP_H
 #define TWEAKLIB_HTTP_H
 
-#include "worker.h"
+#include "client.h"
 #include <stddef.h>
 
 #ifdef __cplusplus
@@ -56,8 +56,11 @@ void http_response_init(http_response_t resp);
 void http_response_free(http_response_t resp);
 
 void http_response_status(http_response_t resp, int code, const char* msg);
-void http_response_write_header(struct worker* worker, http_request_t req, http_response_t resp, int only_header);
-void http_response_write_chunk(int sd, const char* data, size_t bytes);
+/**
+ * Write response status and headers to client output buffer.
+ */
+void http_response_write_header(struct client* client, http_request_t req, http_response_t resp);
+void http_response_write_chunk(struct client* client, const char* data, size_t bytes);
 
 /**
  * Returns textual description of a HTTP status code, e.g. 404 -> "Not Found"
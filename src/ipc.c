@@ -4,134 +4,142 @@
 
 #include "ipc.h"
 #include "log.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 
-static const size_t max_payload_size = 256;
-
-/**
- * Wrapper for read which handles some error conditions. If the error cannot be
- * handled by this it should be considered fatal.
- *
- * @return dst + bytes or NULL on unhandled errors
- */
-static void* read_wrapper(int fd, void* dst, size_t bytes){
-	void* out = dst;
-	while ( bytes > 0 ){
-		ssize_t result = read(fd, out, bytes);
-		if ( result == -1 ){
-			switch ( errno ){
-			case EAGAIN:
-			case EINTR:
-				continue;
-			default:
-				return NULL;
-			}
-		}
-
-		if ( result == 0 ){
-			errno = EBADFD;
-			return NULL;
-		}
-
-		bytes -= result;
-		out += result;
+struct ipc_command {
+	struct ipc_command* next;
+	enum IPC command;
+	size_t payload_size;
+	char payload[];
+};
+
+int ipc_init(struct worker* worker){
+	worker->queue = NULL;
+	worker->batch = NULL;
+	if ( (worker->efd=eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ){
+		logmsg("eventfd() failed: %s\n", strerror(errno));
+		return 1;
 	}
+	return 0;
+}
 
-	return out;
+static void ipc_free_list(struct ipc_command* it){
+	while ( it ){
+		struct ipc_command* next = it->next;
+		free(it);
+		it = next;
+	}
 }
 
-static void ipc_fetch_payload(struct worker* client, void* dst, size_t payload_size){
-	char buf[max_payload_size];
+void ipc_cleanup(struct worker* worker){
+	ipc_free_list(worker->batch);
+	ipc_free_list(__atomic_exchange_n(&worker->queue, NULL, __ATOMIC_ACQUIRE));
+	worker->batch = NULL;
+}
 
-	if ( read_wrapper(client->pipe[READ_FD], dst ? dst : buf, payload_size) == NULL ){
-		logmsg("ipc_fetch_payload - read() failed: %s\n", strerror(errno));
-		logmsg("things will probably explode now, bye bye!\n");
+/**
+ * Take all pushed commands. The queue is a LIFO stack so it is reversed to
+ * process commands in the order they were pushed.
+ */
+static struct ipc_command* ipc_take(struct worker* worker){
+	struct ipc_command* it = __atomic_exchange_n(&worker->queue, NULL, __ATOMIC_ACQUIRE);
+	struct ipc_command* batch = NULL;
+	while ( it ){
+		struct ipc_command* next = it->next;
+		it->next = batch;
+		batch = it;
+		it = next;
 	}
+	return batch;
 }
 
 enum IPC ipc_fetch(struct worker* client, void** payload, size_t* payload_size_ptr){
-	/* reset pointers */
-	if ( payload_size_ptr ) *payload_size_ptr = 0;
-	if ( payload ) *payload = NULL;
+	for (;;){
+		/* reset pointers */
+		if ( payload_size_ptr ) *payload_size_ptr = 0;
+		if ( payload ) *payload = NULL;
+
+		if ( !client->batch && !(client->batch=ipc_take(client)) ){
+			/* queue is drained, reset the doorbell and check again for commands
+			 * pushed before it was reset (they would not signal it again) */
+			uint64_t value;
+			if ( read(client->efd, &value, sizeof(value)) == -1 ){
+				/* not signaled */
+			}
+			if ( !(client->batch=ipc_take(client)) ){
+				return IPC_NONE;
+			}
+		}
 
-	/* read command */
-	enum IPC command;
-	if ( read_wrapper(client->pipe[READ_FD], &command, sizeof(command)) == NULL ){
-		logmsg("ipc_fetch[command] - read() failed: %s\n", strerror(errno));
-		return IPC_NONE;
-	}
+		struct ipc_command* cmd = client->batch;
+		const enum IPC command = cmd->command;
+		client->batch = cmd->next;
 
-	/* read payload size */
-	size_t payload_size;
-	if ( read_wrapper(client->pipe[READ_FD], &payload_size, sizeof(size_t)) == NULL ){
-		logmsg("ipc_fetch[payload_size] - read() failed: %s\n", strerror(errno));
-		return IPC_NONE;
-	}
+		switch ( command ){
+		case IPC_SHUTDOWN:
+			client->running = 0;
+			free(cmd);
+			continue;
 
-	if ( payload_size_ptr ){
-		*payload_size_ptr = payload_size;
-	}
+		case IPC_TESTING:
+			/* pass to caller */
+			break;
 
-	/* allocate payload buffer */
-	if ( payload && payload_size > 0 ){
-		*payload = malloc(payload_size);
-	}
+		default:
+			logmsg("Unknown IPC command %d ignored.\n", command);
+			free(cmd);
+			continue;
+		}
 
-	ipc_fetch_payload(client, payload ? *payload : NULL, payload_size);
+		if ( payload_size_ptr ){
+			*payload_size_ptr = cmd->payload_size;
+		}
 
-	switch ( command ){
-	case IPC_SHUTDOWN:
-		client->running = 0;
-		return IPC_HANDLED;
-		break;
-
-	case IPC_TESTING:
-	case IPC_REFRESH:
-		/* pass to caller */
-		break;
-
-	default:
-		logmsg("Unknown IPC command %d ignored.\n", command);
-		return IPC_NONE;
-	}
+		/* hand payload to caller */
+		if ( payload && cmd->payload_size > 0 ){
+			if ( (*payload=malloc(cmd->payload_size)) != NULL ){
+				memcpy(*payload, cmd->payload, cmd->payload_size);
+			}
+		}
 
-	return command;
+		free(cmd);
+		return command;
+	}
 }
 
 void ipc_push(struct worker* thread, enum IPC command, const void* payload, size_t payload_size){
 	if ( !thread ) return;
 
-	if ( payload_size > max_payload_size ){
-		logmsg("too large ipc payload, ignored\n");
+	struct ipc_command* cmd = malloc(sizeof(struct ipc_command) + payload_size);
+	if ( !cmd ){
+		logmsg("ipc_push - malloc() failed: %s\n", strerror(errno));
 		return;
 	}
-
-	/* write command */
-	if ( write(thread->pipe[WRITE_FD], &command, sizeof(command)) == -1 ){
-		logmsg("ipc_push - write() failed: %s\n", strerror(errno));
-	}
-
-	/* write payload size */
-	if ( write(thread->pipe[WRITE_FD], &payload_size, sizeof(size_t)) == -1 ){
-		logmsg("ipc_push - write() failed: %s\n", strerror(errno));
+	cmd->command = command;
+	cmd->payload_size = payload_size;
+	if ( payload_size > 0 ){
+		memcpy(cmd->payload, payload, payload_size);
 	}
 
-	/* write payload data */
-	const char* ptr = (const char*)payload;
-	while ( payload_size > 0 ){
-		ssize_t bytes = write(thread->pipe[WRITE_FD], ptr, payload_size);
-		if ( bytes == -1 ){
+	/* push onto queue, the command must not be touched afterwards as the
+	 * worker might already have taken it */
+	struct ipc_command* head = __atomic_load_n(&thread->queue, __ATOMIC_RELAXED);
+	do {
+		cmd->next = head;
+	} while ( !__atomic_compare_exchange_n(&thread->queue, &head, cmd, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+
+	/* only the first command since the worker last took the queue needs to
+	 * wake it, the rest is picked up in the same batch */
+	if ( head == NULL ){
+		const uint64_t one = 1;
+		if ( write(thread->efd, &one, sizeof(one)) == -1 ){
 			logmsg("ipc_push - write() failed: %s\n", strerror(errno));
-			logmsg("things will probably explode now, bye bye!\n");
-			return;
 		}
-
-		/* advance in src buffer */
-		payload_size -= bytes;
-		ptr += bytes;
 	}
 }
 
@@ -139,7 +147,6 @@ const char* ipc_name(enum IPC command){
 	switch ( command ){
 	case IPC_NONE: return "<none>";
 	case IPC_TESTING: return "<testing>";
-	case IPC_REFRESH: return "<REFRESH>";
 	case IPC_SHUTDOWN: return "<SHUTDOWN>";
 	}
 	return "<invalid>";
@@ -1,18 +1,26 @@
 #ifndef TWEAKLIB_INT_IPC_H
 #define TWEAKLIB_INT_IPC_H
 
+/**
+ * Commands to a worker thread.
+ *
+ * Commands are pushed onto a lock-free multi-producer queue in memory so any
+ * number of threads may push concurrently. The worker eventfd is only signaled
+ * when the queue goes from empty to non-empty, thus a burst of commands results
+ * in a single wakeup and the worker should drain all pending commands using
+ * ipc_fetch() until it returns IPC_NONE.
+ */
+
 #include "worker.h"
+#include <stddef.h>
 
 enum IPC {
-	IPC_NONE = 0,                 /* no command (e.g. read error) */
+	IPC_NONE = 0,                 /* no command (queue is empty) */
 	IPC_HANDLED = IPC_NONE,       /* command already handled internally */
 
 	/* common */
 	IPC_SHUTDOWN = 1,             /* request for shutdown */
 	IPC_TESTING,                  /* for testing only */
-
-	/* websocket */
-	IPC_REFRESH = 128,            /* send updated variables to client */
 };
 
 #ifdef __cplusplus
@@ -20,15 +28,30 @@ extern "C" {
 #endif
 
 /**
- * Fetch IPC command and try to handle it. If return value is non-zero caller should handle it.
+ * Setup IPC for worker.
+ *
+ * @return non-zero on failure.
+ */
+int ipc_init(struct worker* worker);
+
+/**
+ * Discard all pending commands (including payload).
+ */
+void ipc_cleanup(struct worker* worker);
+
+/**
+ * Fetch next IPC command. Commands which can be handled internally (e.g.
+ * shutdown) are handled and skipped, the rest is returned for the caller to
+ * handle. Returns IPC_NONE when there are no more pending commands. Only the
+ * worker itself may fetch commands.
  *
  * If payload is non-null and the command has payload attached payload and
- * payload_size will contain the additional data.
+ * payload_size will contain the additional data which the caller must free.
  */
 enum IPC ipc_fetch(struct worker* client, void** payload, size_t* payload_size);
 
 /**
- * Send IPC command to worker.
+ * Send IPC command to worker. Safe to call from any thread.
  */
 void ipc_push(struct worker* thread, enum IPC command, const void* payload, size_t payload_size);
 
@@ -16,7 +16,8 @@ struct list {
 };
 
 static void list_realloc(list_t list, size_t n){
-	list->storage = realloc(list->storage, list->element_size * n);
+	/* storage holds pointers to the elements, not the elements themselves */
+	list->storage = realloc(list->storage, sizeof(void*) * n);
 	list->num_allocated = n;
 }
 
@@ -47,8 +48,7 @@ void list_free(list_t list){
 
 int list_push(list_t list, void* elem){
 	if ( list->num_elements >= list->num_allocated ){
-		list->num_allocated += list_grow;
-		list_realloc(list, sizeof(void*) * list->num_allocated);
+		list_realloc(list, list->num_allocated > 0 ? list->num_allocated * 2 : list_grow);
 	}
 
 	const int index = list->num_elements;
@@ -0,0 +1,92 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "refresh.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define REFRESH_SLOTS 256
+
+static ring_t ring = NULL;
+
+/* frames referenced by the ring indexed by sequence number, the oldest not yet
+ * released and the oldest read by any client */
+static struct refresh_event published[REFRESH_SLOTS];
+static uint64_t published_tail = 0;
+static uint64_t consumed = 0;
+
+struct refresh* refresh_alloc(size_t n){
+	struct refresh* set = malloc(sizeof(struct refresh) + sizeof(struct var*) * n);
+	if ( set ){
+		set->next = NULL;
+		set->n = n;
+	}
+	return set;
+}
+
+int refresh_init(){
+	if ( (ring=ring_alloc(REFRESH_SLOTS, sizeof(struct refresh_event))) == NULL ){
+		return 1;
+	}
+
+	published_tail = 0;
+	consumed = 0;
+	memset(published, 0, sizeof(published));
+
+	return 0;
+}
+
+static void event_release(struct refresh_event* event){
+	free(event->set);
+	event->set = NULL;
+	for ( int i = 0; i < WEBSOCKET_NUM_PROTOCOLS; i++ ){
+		frame_unref(event->frame[i]);
+		frame_unref(event->deflated[i]);
+		event->frame[i] = NULL;
+		event->deflated[i] = NULL;
+	}
+}
+
+void refresh_cleanup(){
+	if ( !ring ) return;
+
+	for ( int i = 0; i < REFRESH_SLOTS; i++ ){
+		event_release(&published[i]);
+	}
+	ring_free(ring);
+	ring = NULL;
+}
+
+void refresh_publish(const struct refresh_event* event){
+	if ( !ring ){
+		struct refresh_event tmp = *event;
+		event_release(&tmp);
+		return;
+	}
+
+	const uint64_t seq = ring_head(ring);
+
+	/* release frames which all clients has passed and the one about to be
+	 * overwritten in the ring */
+	while ( published_tail < seq && (published_tail < consumed || seq - published_tail >= REFRESH_SLOTS) ){
+		event_release(&published[published_tail % REFRESH_SLOTS]);
+		published_tail++;
+	}
+
+	published[seq % REFRESH_SLOTS] = *event;
+	ring_publish(ring, event, sizeof(struct refresh_event));
+}
+
+enum ring_status refresh_fetch(uint64_t* cursor, struct refresh_event* event){
+	size_t size;
+	return ring_fetch(ring, cursor, event, &size);
+}
+
+uint64_t refresh_head(){
+	return ring_head(ring);
+}
+
+void refresh_consumed(uint64_t cursor){
+	consumed = cursor;
+}
@@ -0,0 +1,81 @@
+#ifndef TWEAKLIB_REFRESH_H
+#define TWEAKLIB_REFRESH_H
+
+/**
+ * Refresh broadcast on the server thread.
+ *
+ * A refresh set is a snapshot of the variables to send, built by the
+ * application and handed to the server thread (see server_refresh()). The
+ * server coalesces the sets and at most once per tick encodes the variables
+ * changed since the last tick, once per websocket protocol in use, into frames
+ * which are published here and shared by all clients. Only the pointers are
+ * stored in the broadcast ring.
+ *
+ * The ring holds a reference to each published frame until no client will read
+ * it anymore or its slot in the ring is reused. All functions must be called
+ * from the server thread.
+ */
+
+#include "frame.h"
+#include "ring.h"
+#include "vars.h"
+#include "websocket.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct refresh {
+	struct refresh* next;                 /* queued by server_refresh() */
+	size_t n;                             /* number of variables */
+	struct var* vars[];
+};
+
+/**
+ * Encoded refresh, one frame per protocol and compression (NULL if no client
+ * uses it). The set is kept so clients receiving refreshes at a lower rate can
+ * merge several events into one.
+ */
+struct refresh_event {
+	struct refresh* set;
+	struct frame* frame[WEBSOCKET_NUM_PROTOCOLS];
+	struct frame* deflated[WEBSOCKET_NUM_PROTOCOLS];
+};
+
+/**
+ * Allocate a snapshot for n variables.
+ */
+struct refresh* refresh_alloc(size_t n);
+
+int refresh_init();
+void refresh_cleanup();
+
+/**
+ * Publish an encoded refresh, the ring takes over the set and the frame
+ * references.
+ */
+void refresh_publish(const struct refresh_event* event);
+
+/**
+ * Fetch the refresh at cursor. The set and frames are valid until the next call
+ * to refresh_publish(), take a reference to keep the frames.
+ */
+enum ring_status refresh_fetch(uint64_t* cursor, struct refresh_event* event);
+
+/**
+ * Cursor for the next refresh to be published.
+ */
+uint64_t refresh_head();
+
+/**
+ * Tell the ring that no client will read refreshes older than cursor.
+ */
+void refresh_consumed(uint64_t cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_REFRESH_H */
@@ -0,0 +1,126 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* marks a slot which is being written */
+static const uint64_t slot_busy = UINT64_MAX;
+
+struct slot {
+	uint64_t seq;                              /* sequence number of the stored event */
+	size_t size;                               /* payload size */
+	char payload[];
+};
+
+struct ring {
+	uint64_t head;                             /* sequence number of next event */
+	size_t num_slots;                          /* number of slots (power of two) */
+	size_t payload_size;                       /* max payload size */
+	size_t stride;                             /* bytes per slot */
+	char* storage;
+};
+
+static struct slot* ring_slot(ring_t ring, uint64_t seq){
+	return (struct slot*)(ring->storage + (seq & (ring->num_slots - 1)) * ring->stride);
+}
+
+ring_t ring_alloc(size_t num_slots, size_t payload_size){
+	if ( num_slots == 0 || (num_slots & (num_slots - 1)) != 0 ){
+		return NULL;
+	}
+
+	ring_t ring = malloc(sizeof(struct ring));
+	if ( !ring ) return NULL;
+
+	/* keep slots aligned for the sequence number */
+	const size_t align = sizeof(uint64_t);
+	ring->head = 0;
+	ring->num_slots = num_slots;
+	ring->payload_size = payload_size;
+	ring->stride = (sizeof(struct slot) + payload_size + align - 1) & ~(align - 1);
+	ring->storage = malloc(ring->stride * num_slots);
+
+	if ( !ring->storage ){
+		ring_free(ring);
+		return NULL;
+	}
+
+	for ( size_t i = 0; i < num_slots; i++ ){
+		ring_slot(ring, i)->seq = slot_busy;
+	}
+
+	return ring;
+}
+
+void ring_free(ring_t ring){
+	if ( !ring ) return;
+	free(ring->storage);
+	free(ring);
+}
+
+int ring_publish(ring_t ring, const void* payload, size_t size){
+	if ( size > ring->payload_size ){
+		return 1;
+	}
+
+	/* only the producer modifies head so no need to synchronize this read */
+	const uint64_t seq = ring->head;
+	struct slot* slot = ring_slot(ring, seq);
+
+	/* seqlock style write: mark slot busy, write and publish the new sequence
+	 * number. Consumers verify the sequence number before and after reading. */
+	__atomic_store_n(&slot->seq, slot_busy, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->size = size;
+	memcpy(slot->payload, payload, size);
+	__atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, seq + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+uint64_t ring_head(ring_t ring){
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+enum ring_status ring_fetch(ring_t ring, uint64_t* cursor, void* dst, size_t* size){
+	const uint64_t seq = *cursor;
+	const uint64_t head = ring_head(ring);
+
+	if ( seq == head ){
+		return RING_EMPTY;
+	}
+
+	/* the slot has already been reused */
+	if ( head - seq > ring->num_slots ){
+		goto lapped;
+	}
+
+	const struct slot* slot = ring_slot(ring, seq);
+	if ( __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq ){
+		goto lapped;
+	}
+
+	const size_t bytes = slot->size;
+	if ( bytes > ring->payload_size ){
+		goto lapped;
+	}
+	memcpy(dst, slot->payload, bytes);
+
+	/* if the producer wrote to the slot while it was copied the data is torn */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if ( __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq ){
+		goto lapped;
+	}
+
+	*size = bytes;
+	*cursor = seq + 1;
+	return RING_EVENT;
+
+  lapped:
+	*cursor = ring_head(ring);
+	return RING_LAPPED;
+}
@@ -0,0 +1,64 @@
+#ifndef TWEAKLIB_RING_H
+#define TWEAKLIB_RING_H
+
+/**
+ * Single-producer/multi-consumer broadcast ring.
+ *
+ * Events are stored in a fixed number of slots and identified by a sequence
+ * number. Each consumer keeps its own cursor and reads at its own pace, the
+ * producer never waits for consumers. A consumer which falls behind more than
+ * the capacity of the ring is told so (RING_LAPPED) and has to resynchronize by
+ * other means.
+ *
+ * The ring itself has no wakeup mechanism, the producer is responsible for
+ * notifying consumers.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ring* ring_t;
+
+enum ring_status {
+	RING_EMPTY = 0,                     /* no new events */
+	RING_EVENT,                         /* event was read */
+	RING_LAPPED,                        /* events was lost, cursor is moved to head */
+};
+
+/**
+ * Create a new ring.
+ *
+ * @param num_slots number of events the ring can hold, must be a power of two.
+ * @param payload_size max size of a single event.
+ */
+ring_t ring_alloc(size_t num_slots, size_t payload_size);
+void ring_free(ring_t ring);
+
+/**
+ * Publish a new event. Only a single thread may publish at a time.
+ *
+ * @return non-zero if payload is too large.
+ */
+int ring_publish(ring_t ring, const void* payload, size_t size);
+
+/**
+ * Sequence number of the next event to be published. Use as initial cursor to
+ * only receive new events.
+ */
+uint64_t ring_head(ring_t ring);
+
+/**
+ * Read the event at cursor (dst must be able to hold payload_size bytes) and
+ * advance the cursor. Safe to call concurrently with ring_publish.
+ */
+enum ring_status ring_fetch(ring_t ring, uint64_t* cursor, void* dst, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_RING_H */
@@ -3,37 +3,123 @@
 #endif
 
 #include "server.h"
+#include "backend.h"
+#include "client.h"
+#include "dirty.h"
 #include "ipc.h"
+#include "list.h"
 #include "log.h"
 #include "http.h"
+#include "refresh.h"
 #include "static.h"
+#include "watch.h"
 #include "websocket.h"
 #include "worker.h"
+#include "wsdeflate.h"
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 
-#define MAX_CLIENT_SLOTS 24
-
 static struct worker server = WORKER_INITIALIZER;
-static const size_t buffer_size = 16384;
+static const size_t max_request_size = 16384;
+static const size_t max_refresh_backlog = 262144; /* stop queuing refreshes to clients with more output queued */
 static unsigned int client_id = 0;
-static struct worker* clients[MAX_CLIENT_SLOTS] = {0,};
+static list_t clients = NULL;
+static const struct backend* backend = NULL;
+static int timer_fd = -1;                 /* wakes the server when a client is due for a refresh */
+static unsigned int refresh_rate = 30;    /* default max refreshes per second for each client */
+static int scan_fd = -1;                  /* periodic timer for automatic change detection */
+static unsigned int scan_rate = 0;        /* scans per second, zero if disabled */
+
+/* variables changed since the last tick and scratch for merging refreshes for
+ * a single client, server thread only */
+static struct dirty pending = DIRTY_INITIALIZER;
+static struct dirty merged = DIRTY_INITIALIZER;
+
+/* removal handshake, lives on the stack of the thread removing the variable
+ * which waits until the server thread posts done. Removals are queued
+ * intrusively (not with ipc_push() which may fail to allocate) so the waiting
+ * thread cannot miss its wakeup. */
+struct removal {
+	struct removal* next;
+	struct var* var;
+	sem_t done;
+};
+
+static struct removal* removals = NULL;   /* LIFO, pushed by any thread */
+
+/* refresh sets are queued the same way so a failed allocation cannot leak a
+ * set, a full refresh has no set and is only flagged */
+static struct refresh* refreshes = NULL;  /* LIFO, pushed by any thread */
+static int refresh_all = 0;               /* full refresh requested by any thread */
+
+/* counters are written by the server thread and read by anyone */
+static struct tweak_queue_stats stats = {0,};
+
+/* available backends in order of preference */
+static const struct backend* backends[] = {
+#ifdef HAVE_LIBURING
+	&backend_uring,
+#endif
+	&backend_epoll,
+	NULL,
+};
 
 static void* server_loop(void*);
-static void* client_loop(void*);
-static void write_error(struct worker* client, http_request_t req, http_response_t resp, int code, const char* details);
+static void write_error(struct client* client, http_request_t req, http_response_t resp, int code, const char* details);
+static void server_handle_ipc();
+static void server_handle_timer();
+static void server_handle_scan();
+static void server_arm_scan(unsigned int hz);
+static void server_wakeup(const char* caller);
+
+/**
+ * Initialize the first usable backend. The TWEAK_BACKEND environment variable
+ * can be used to select a specific backend, if it fails to initialize the
+ * remaining backends are used as fallback.
+ */
+static const struct backend* backend_init(int sd){
+	const char* name = getenv("TWEAK_BACKEND");
+	const struct backend* preferred = NULL;
+
+	if ( name ){
+		for ( const struct backend** it = backends; *it; it++ ){
+			if ( strcmp((*it)->name, name) == 0 ){
+				preferred = *it;
+			}
+		}
+
+		if ( !preferred ){
+			logmsg("backend \"%s\" not available\n", name);
+		} else if ( preferred->init(sd) == 0 ){
+			return preferred;
+		}
+	}
+
+	for ( const struct backend** it = backends; *it; it++ ){
+		if ( *it == preferred ) continue;
+		if ( (*it)->init(sd) == 0 ){
+			return *it;
+		}
+		logmsg("%s backend unavailable, trying next\n", (*it)->name);
+	}
+
+	return NULL;
+}
 
 void server_init(int port, const char* listen_addr){
 	/* make sure server isn't initailzed twice */
@@ -42,14 +128,13 @@ void server_init(int port, const char* listen_addr){
 		return;
 	}
 
-	/* IPC pipe */
-	if ( pipe2(server.pipe, O_NONBLOCK) != 0 ){
-		logmsg("pipe2() failed: %s\n", strerror(errno));
+	/* IPC queue */
+	if ( ipc_init(&server) != 0 ){
 		return;
 	}
 
 	/* open socket */
-	if ( (server.sd=socket(AF_INET, SOCK_STREAM, 0)) == -1 ){
+	if ( (server.sd=socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1 ){
 		logmsg("Failed to open socket: %s\n", strerror(errno));
 		return;
 	}
@@ -75,159 +160,617 @@ void server_init(int port, const char* listen_addr){
 	}
 
 	/* allow incoming connections */
-	if ( listen(server.sd, 5) != 0 ){
+	if ( listen(server.sd, SOMAXCONN) != 0 ){
 		logmsg("listen() failed: %s\n", strerror(errno));
 		goto error;
 	}
 
-	/* create listening thread */
+	/* refreshes are broadcast to all clients through a ring */
+	if ( refresh_init() != 0 ){
+		logmsg("Failed to allocate refresh ring\n");
+		goto error;
+	}
+
+	/* all connections are served by a single backend on the server thread */
+	if ( (backend=backend_init(server.sd)) == NULL ){
+		logmsg("no usable network backend\n");
+		goto error;
+	}
+	if ( backend->watch(server.efd, server_handle_ipc) != 0 ){
+		goto error;
+	}
+
+	/* refreshes are sent when clients are due, see server_schedule() */
+	if ( (timer_fd=timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1 ){
+		logmsg("timerfd_create() failed: %s\n", strerror(errno));
+		goto error;
+	}
+	if ( backend->watch(timer_fd, server_handle_timer) != 0 ){
+		goto error;
+	}
+
+	/* automatic change detection, see tweak_auto_refresh() */
+	if ( (scan_fd=timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1 ){
+		logmsg("timerfd_create() failed: %s\n", strerror(errno));
+		goto error;
+	}
+	if ( backend->watch(scan_fd, server_handle_scan) != 0 ){
+		goto error;
+	}
+	server_arm_scan(__atomic_load_n(&scan_rate, __ATOMIC_RELAXED));
+
+	clients = list_alloc(sizeof(struct client), 25);
+	list_destructor(clients, (list_destructor_callback)client_free);
+
+	/* create server thread */
 	int error;
+	server.running = 1;
 	if ( (error=pthread_create(&server.thread, NULL, server_loop, NULL)) != 0 ){
 		logmsg("pthread_create() failed: %s\n", strerror(error));
 		goto error;
 	}
 
-	logmsg("Tweaklib server listening on %s:%d\n", listen_addr, port);
+	logmsg("Tweaklib server listening on %s:%d (%s)\n", listen_addr, port, backend->name);
 	return;
 
   error:
+	if ( clients ){
+		list_free(clients);
+		clients = NULL;
+	}
+	if ( backend ){
+		backend->cleanup();
+		backend = NULL;
+	}
+	if ( timer_fd != -1 ){
+		close(timer_fd);
+		timer_fd = -1;
+	}
+	if ( scan_fd != -1 ){
+		close(scan_fd);
+		scan_fd = -1;
+	}
+	refresh_cleanup();
 	close(server.sd);
 	server.sd = -1;
 }
 
 void server_cleanup(){
-	/* tell server thread to stop */
+	if ( server.sd == -1 ) return;
+
+	/* tell server thread to stop and wait for it */
 	ipc_push(&server, IPC_SHUTDOWN, NULL, 0);
+	pthread_join(server.thread, NULL);
 
-	/* tell all clients threads to stop */
-	for ( int i = 0; i < MAX_CLIENT_SLOTS; i++ ){
-		ipc_push(clients[i], IPC_SHUTDOWN, NULL, 0);
+	/* refreshes pushed after shutdown are never published */
+	while ( ipc_fetch(&server, NULL, NULL) != IPC_NONE ){
+		/* discard */
+	}
+	struct refresh* set = __atomic_exchange_n(&refreshes, NULL, __ATOMIC_ACQUIRE);
+	while ( set ){
+		struct refresh* next = set->next;
+		free(set);
+		set = next;
+	}
+	refresh_all = 0;
+
+	/* no clients are left to tell */
+	struct removal* removal = __atomic_exchange_n(&removals, NULL, __ATOMIC_ACQUIRE);
+	while ( removal ){
+		struct removal* next = removal->next;
+		var_retire(removal->var);
+		sem_post(&removal->done);
+		removal = next;
 	}
 
-	/* wait for server shutdown */
-	pthread_join(server.thread, NULL);
+	/* backend is stopped first so no operations are in progress when the
+	 * remaining connections are closed */
+	backend->cleanup();
+	backend = NULL;
+	close(timer_fd);
+	timer_fd = -1;
+	close(scan_fd);
+	scan_fd = -1;
+	list_free(clients);
+	clients = NULL;
+	refresh_cleanup();
+	dirty_free(&pending);
+	dirty_free(&merged);
+	watch_cleanup();
+	websocket_cleanup();
 
-	/* wait for all clients to shutdown */
-	for ( int i = 0; i < MAX_CLIENT_SLOTS; i++ ){
-		if ( clients[i] == NULL ) continue;
-		pthread_join(clients[i]->thread, NULL);
+	worker_free(&server);
+
+	struct tweak_deflate_stats deflate;
+	tweak_get_deflate_stats(&deflate);
+	if ( deflate.messages > 0 ){
+		logmsg("Compressed %llu messages (%llu skipped) from %llu to %llu bytes in %.1f ms\n",
+		       deflate.messages, deflate.skipped, deflate.bytes_in, deflate.bytes_out, deflate.cpu_ns * 1e-6);
+	}
+	if ( stats.dropped > 0 || stats.overflows > 0 ){
+		logmsg("Dropped %llu stale refreshes (%llu resyncs), %llu connections overflowed, peak queue %llu bytes\n",
+		       stats.dropped, stats.resyncs, stats.overflows, stats.max_queued);
 	}
 
-	/* yield so valgrind will stop complaining because of a race condition where
-	 * the clients has been awaken, handled the IPC termination command and
-	 * actually started to shutdown but not finished yet. Since the client slot
-	 * then would be free it would not call pthread_join. */
-	pthread_yield();
+	logmsg("Tweaklib server closed\n");
 }
 
-static int max(int a, int b){
-	return (a>b) ? a : b;
+void server_refresh(struct refresh* set){
+	if ( server.sd == -1 ){
+		free(set);
+		return;
+	}
+
+	/* the server thread publishes it to all clients */
+	if ( set ){
+		struct refresh* head = __atomic_load_n(&refreshes, __ATOMIC_RELAXED);
+		do {
+			set->next = head;
+		} while ( !__atomic_compare_exchange_n(&refreshes, &head, set, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+	} else {
+		__atomic_store_n(&refresh_all, 1, __ATOMIC_RELEASE);
+	}
+	server_wakeup("server_refresh");
 }
 
-void server_refresh(struct var* vars[], size_t bytes){
-	for ( int i = 0; i < MAX_CLIENT_SLOTS; i++ ){
-		ipc_push(clients[i], IPC_REFRESH, vars, bytes);
+void tweak_get_queue_stats(struct tweak_queue_stats* dst){
+	dst->dropped = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+	dst->resyncs = __atomic_load_n(&stats.resyncs, __ATOMIC_RELAXED);
+	dst->overflows = __atomic_load_n(&stats.overflows, __ATOMIC_RELAXED);
+	dst->max_queued = __atomic_load_n(&stats.max_queued, __ATOMIC_RELAXED);
+}
+
+void tweak_refresh_rate(unsigned int hz){
+	__atomic_store_n(&refresh_rate, hz, __ATOMIC_RELAXED);
+}
+
+static void server_arm_scan(unsigned int hz){
+	const uint64_t interval = hz > 0 ? 1000000000 / hz : 0;
+	const struct timespec ts = {interval / 1000000000, interval % 1000000000};
+	const struct itimerspec spec = {ts, ts};
+	if ( timerfd_settime(scan_fd, 0, &spec, NULL) != 0 ){
+		logmsg("timerfd_settime() failed: %s\n", strerror(errno));
 	}
 }
 
-static void* server_loop(void* arg){
-	const int max_fd = max(server.sd, server.pipe[READ_FD])+1;
+void tweak_auto_refresh(unsigned int hz){
+	/* at most once per tick of the highest refresh rate is useful */
+	if ( hz > CLIENT_MAX_REFRESH_RATE ){
+		hz = CLIENT_MAX_REFRESH_RATE;
+	}
 
-	while (server.running) {
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(server.sd, &fds);
-		FD_SET(server.pipe[READ_FD], &fds);
+	__atomic_store_n(&scan_rate, hz, __ATOMIC_RELAXED);
+	if ( server.sd != -1 ){
+		server_arm_scan(hz);
+	}
+}
 
-		if ( select(max_fd, &fds, NULL, NULL, NULL) == -1 ){
-			logmsg("select() failed: %s\n", strerror(errno));
-			continue;
-		}
+const char* server_backend(){
+	return backend ? backend->name : NULL;
+}
+
+void server_refresh_all(){
+	server_refresh(NULL);
+}
+
+void server_accept_client(int cd){
+	/* frames are small and latency matters more than throughput */
+	int on = 1;
+	setsockopt(cd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(int));
+
+	/* allocate state, freed when connection is closed */
+	struct client* client = client_new(cd, client_id++);
+	if ( !client ){
+		logmsg("malloc() failed: %s\n", strerror(errno));
+		close(cd);
+		return;
+	}
+
+	if ( backend->attach(client) != 0 ){
+		client_free(client);
+		return;
+	}
+
+	client->slot = list_push(clients, client);
+	logmsg("%s [%d] - client connected\n", client->peeraddr, client->id);
+}
+
+static void server_flush(struct client* client){
+	if ( client->state != CLIENT_CLOSED && !backend->flush(client) ){
+		client->state = CLIENT_CLOSED;
+	}
+}
+
+static uint64_t monotonic(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void count(unsigned long long* counter, unsigned long long value){
+	__atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
 
-		/* handle IPC */
-		if ( FD_ISSET(server.pipe[READ_FD], &fds) ){
-			enum IPC ipc;
-			switch ( ipc=ipc_fetch(&server, NULL, 0) ){
-			case IPC_NONE:
-				break;
-			default:
-				logmsg("Unexpected IPC command %s (%d) by server worker\n", ipc_name(ipc), ipc);
+static void update_max_queued(const struct client* client){
+	if ( client->queued_peak > __atomic_load_n(&stats.max_queued, __ATOMIC_RELAXED) ){
+		__atomic_store_n(&stats.max_queued, client->queued_peak, __ATOMIC_RELAXED);
+	}
+}
+
+static void server_close_client(struct client* client){
+	const int slot = client->slot;
+
+	update_max_queued(client);
+	count(&stats.overflows, client->overflow);
+	if ( client->dropped > 0 ){
+		logmsg("%s [%d] - dropped %zu stale refreshes, peak queue %zu bytes\n", client->peeraddr, client->id, client->dropped, client->queued_peak);
+	}
+
+	/* erase moves the last client into the freed slot */
+	list_erase(clients, slot);
+	if ( (size_t)slot < list_size(clients) ){
+		struct client* moved = (struct client*)list_get(clients, slot);
+		moved->slot = slot;
+	}
+}
+
+/**
+ * Merge the refresh event with all later pending events into a single refresh
+ * for client, used when the client has a lower rate than the server tick.
+ */
+static void server_refresh_merged(struct client* client, const struct refresh_event* first){
+	struct refresh_event event;
+	enum ring_status status;
+
+	dirty_mark_set(&merged, first->set);
+	while ( (status=refresh_fetch(&client->refresh_seq, &event)) == RING_EVENT ){
+		dirty_mark_set(&merged, event.set);
+	}
+
+	if ( status == RING_LAPPED ){
+		logmsg("%s [%d] - client fell behind, sending full refresh\n", client->peeraddr, client->id);
+		dirty_clear(&merged);
+		client->resync = 1;
+		return;
+	}
+
+	struct refresh* set = dirty_take(&merged);
+	websocket_refresh(client, set ? set->vars : NULL, set ? set->n : 0);
+	free(set);
+}
+
+/**
+ * Send all pending refresh events to client.
+ *
+ * Clients with much output queued are skipped until they have caught up. If
+ * newer refreshes are pending meanwhile, queued refreshes not yet sent are
+ * dropped and replaced by a single full refresh (with the latest values) once
+ * the output has drained. The same happens if the ring is lapped.
+ */
+static void server_refresh_client(struct client* client){
+	struct refresh_event event;
+
+	while ( client->state == CLIENT_WEBSOCKET ){
+		if ( client->queued >= max_refresh_backlog ){
+			if ( refresh_head() != client->refresh_seq ){
+				const size_t dropped = client_drop(client);
+				count(&stats.dropped, dropped);
+				client->resync |= dropped > 0;
 			}
+			update_max_queued(client);
+			return;
+		}
+
+		if ( client->resync ){
+			count(&stats.resyncs, 1);
+			client->resync = 0;
+			client->refresh_seq = refresh_head();
+			websocket_refresh(client, NULL, 0);
 			continue;
 		}
 
-		/* wait for a client to connect */
-		int cd;
-		if ( (cd=accept(server.sd, NULL, NULL)) == -1 ){
-			logmsg("accept() failed: %s\n", strerror(errno));
+		switch ( refresh_fetch(&client->refresh_seq, &event) ){
+		case RING_EMPTY:
+			return;
+
+		case RING_EVENT:
+			/* the same encoded frame is queued on all clients using the protocol,
+			 * clients connected after the refresh was encoded might lack one and
+			 * clients subscribed to some groups get their own */
+			if ( client->refresh_seq != refresh_head() ){
+				server_refresh_merged(client, &event);
+			} else if ( client->subscription.all && client->deflate && event.deflated[client->protocol] ){
+				client_send_droppable(client, event.deflated[client->protocol]);
+				wsdeflate_desync(client->deflate);
+			} else if ( client->subscription.all && !client->deflate && event.frame[client->protocol] ){
+				client_send_droppable(client, event.frame[client->protocol]);
+			} else {
+				websocket_refresh(client, event.set ? event.set->vars : NULL, event.set ? event.set->n : 0);
+			}
+			break;
+
+		case RING_LAPPED:
+			logmsg("%s [%d] - client fell behind, sending full refresh\n", client->peeraddr, client->id);
+			client->resync = 1;
 			break;
 		}
+	}
+}
 
-		/* allocate state, freed by client loop */
-		struct worker* client = (struct worker*)malloc(sizeof(struct worker));
-		if ( !client ){
-			logmsg("malloc() failed: %s\n", strerror(errno));
-			shutdown(cd, SHUT_RDWR);
-			continue;
+/**
+ * Tell the ring which refreshes are no longer needed so the frames can be
+ * released without waiting for the ring to wrap.
+ */
+static void server_refresh_consumed(){
+	uint64_t oldest = refresh_head();
+	for ( void** it = list_begin(clients); it != list_end(clients); it++ ){
+		const struct client* client = *(struct client**)it;
+		if ( client->state == CLIENT_WEBSOCKET && client->refresh_seq < oldest ){
+			oldest = client->refresh_seq;
 		}
+	}
+	refresh_consumed(oldest);
+}
 
-		/* IPC pipe */
-		if ( pipe2(client->pipe, O_NONBLOCK) != 0 ){
-			logmsg("pipe2() failed: %s\n", strerror(errno));
-			shutdown(cd, SHUT_RDWR);
-			continue;
+static int server_client_pending(const struct client* client){
+	return client->resync || refresh_head() != client->refresh_seq;
+}
+
+/**
+ * Arm the timer for the earliest client which is due for a refresh and has
+ * something to send.
+ */
+static void server_schedule(){
+	const int changed = !dirty_empty(&pending);
+	uint64_t next = UINT64_MAX;
+
+	for ( void** it = list_begin(clients); it != list_end(clients); it++ ){
+		const struct client* client = *(struct client**)it;
+		if ( client->state != CLIENT_WEBSOCKET ) continue;
+
+		/* clients with much output queued are rescheduled by server_handle_output() */
+		if ( client->queued >= max_refresh_backlog ) continue;
+
+		if ( (changed || server_client_pending(client)) && client->refresh_next < next ){
+			next = client->refresh_next;
 		}
+	}
+
+	if ( next == UINT64_MAX ){
+		return;
+	}
 
-		client->sd = cd;
-		client->id = client_id++;
-		client->running = 1;
+	/* a time in the past expires directly, zero would disarm the timer */
+	struct itimerspec spec = {{0, 0}, {next / 1000000000, next % 1000000000}};
+	if ( next == 0 ){
+		spec.it_value.tv_nsec = 1;
+	}
+	if ( timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0 ){
+		logmsg("timerfd_settime() failed: %s\n", strerror(errno));
+	}
+}
 
-		char buf[PEER_ADDR_LEN];
-		client->peeraddr = strdup(peer_addr(cd, buf));
+void server_handle_output(struct client* client){
+	server_flush(client);
 
-		/* find a free client slot */
-		int slot = 0;
-		for ( ; slot < MAX_CLIENT_SLOTS; slot++ ){
-			if ( clients[slot] == NULL ) break;
+	/* client might have skipped refreshes while the output was backed up */
+	if ( client->state == CLIENT_WEBSOCKET && (server_client_pending(client) || !dirty_empty(&pending)) ){
+		server_schedule();
+	}
+}
+
+/* which encodings of a protocol is in use */
+enum {
+	ENCODING_PLAIN = 1,
+	ENCODING_DEFLATE = 2,
+};
+
+/**
+ * Find which websocket protocols and compression are used by connected
+ * clients sharing refreshes (subscribed to all groups), returns the number of
+ * websocket clients.
+ */
+static size_t server_num_websockets(int protocols[WEBSOCKET_NUM_PROTOCOLS]){
+	size_t n = 0;
+	memset(protocols, 0, sizeof(int) * WEBSOCKET_NUM_PROTOCOLS);
+	for ( void** it = list_begin(clients); it != list_end(clients); it++ ){
+		const struct client* client = *(struct client**)it;
+		if ( client->state != CLIENT_WEBSOCKET ) continue;
+		if ( client->subscription.all ){
+			protocols[client->protocol] |= client->deflate ? ENCODING_DEFLATE : ENCODING_PLAIN;
 		}
+		n++;
+	}
+	return n;
+}
 
-		/* if no free slots is available return a 503 */
-		if ( slot == MAX_CLIENT_SLOTS ){
-			struct http_request req;
-			struct http_response resp;
-			http_request_init(&req);
-			http_response_init(&resp);
+/**
+ * Encode refresh set once per protocol and compression in use and publish it
+ * for all clients, the ring takes over the set.
+ */
+static void server_publish_refresh(struct refresh* set, const int protocols[WEBSOCKET_NUM_PROTOCOLS]){
+	struct refresh_event event = {set, {NULL,}, {NULL,}};
+
+	for ( int i = 0; i < WEBSOCKET_NUM_PROTOCOLS; i++ ){
+		if ( !protocols[i] ) continue;
+		struct frame** deflated = (protocols[i] & ENCODING_DEFLATE) ? &event.deflated[i] : NULL;
+		event.frame[i] = websocket_encode_refresh(i, set ? set->vars : NULL, set ? set->n : 0, deflated);
+		if ( !event.frame[i] || (deflated && !*deflated) ){
+			logmsg("Failed to encode refresh\n");
+		}
+	}
 
-			write_error(client, &req, &resp, 503, "No free slots available.\n");
+	refresh_publish(&event);
+}
 
-			http_request_free(&req);
-			http_response_free(&resp);
-			shutdown(cd, SHUT_RDWR);
-			free(client->peeraddr);
-			free(client);
-			continue;
+/**
+ * Publish the variables changed since the last tick and send pending
+ * refreshes to all clients which are due. Clients with a lower rate get the
+ * refreshes merged in a later tick.
+ */
+static void server_tick(){
+	const uint64_t now = monotonic();
+	int protocols[WEBSOCKET_NUM_PROTOCOLS];
+
+	if ( !dirty_empty(&pending) ){
+		if ( server_num_websockets(protocols) > 0 ){
+			server_publish_refresh(dirty_take(&pending), protocols);
+		} else {
+			dirty_clear(&pending);
 		}
+	}
+
+	for ( void** it = list_begin(clients); it != list_end(clients); it++ ){
+		struct client* client = *(struct client**)it;
+		if ( client->state != CLIENT_WEBSOCKET ) continue;
+		if ( client->refresh_next > now || !server_client_pending(client) ) continue;
+
+		server_refresh_client(client);
+		server_flush(client);
+		client->refresh_next = now + client->refresh_interval;
+	}
 
-		/* store client */
-		clients[slot] = client;
-		client->slot = slot;
+	server_refresh_consumed();
+	server_schedule();
+}
+
+static void server_handle_timer(){
+	uint64_t expirations;
+	if ( read(timer_fd, &expirations, sizeof(uint64_t)) != sizeof(uint64_t) ){
+		return; /* spurious wakeup */
+	}
+
+	server_tick();
+}
+
+/**
+ * Mark variables which changed since the last scan. The shadow copy is kept up
+ * to date even when no one is listening, otherwise changes made between the
+ * hello message and the next scan would be missed.
+ */
+static void server_handle_scan(){
+	uint64_t expirations;
+	if ( read(scan_fd, &expirations, sizeof(uint64_t)) != sizeof(uint64_t) ){
+		return; /* spurious wakeup */
+	}
 
-		/* create thread for client */
-		int error;
-		if ( (error=pthread_create(&client->thread, NULL, client_loop, client)) != 0 ){
-			logmsg("pthread_create() failed: %s\n", strerror(error));
-			shutdown(cd, SHUT_RDWR);
+	int protocols[WEBSOCKET_NUM_PROTOCOLS];
+	if ( watch_scan(&pending) == 0 ){
+		return;
+	}
+	if ( server_num_websockets(protocols) > 0 ){
+		server_schedule();
+	} else {
+		dirty_clear(&pending);
+	}
+}
+
+/**
+ * Tell all clients the variable is removed and retire it, server thread only
+ * (unless the server is not running).
+ */
+static void server_remove_var(struct var* var){
+	if ( clients ){
+		for ( void** it = list_begin(clients); it != list_end(clients); it++ ){
+			struct client* client = *(struct client**)it;
+			if ( client->state != CLIENT_WEBSOCKET ) continue;
+
+			websocket_remove(client, &var, 1);
+			server_flush(client);
 		}
-	};
+	}
 
-	/* close server worker */
-	worker_free(&server);
-	logmsg("Tweaklib server closed\n");
+	var_retire(var);
+}
 
-	return NULL;
+/**
+ * Signal the server eventfd the same way as ipc_push() for work queued outside
+ * the IPC queue.
+ */
+static void server_wakeup(const char* caller){
+	const uint64_t one = 1;
+	if ( write(server.efd, &one, sizeof(one)) == -1 ){
+		logmsg("%s - write() failed: %s\n", caller, strerror(errno));
+	}
+}
+
+void server_remove(struct var* var){
+	/* callbacks (e.g. triggers) run on the server thread which cannot wait for
+	 * itself */
+	if ( server.sd == -1 || pthread_equal(pthread_self(), server.thread) ){
+		server_remove_var(var);
+		return;
+	}
+
+	struct removal removal = {NULL, var};
+	sem_init(&removal.done, 0, 0);
+	struct removal* head = __atomic_load_n(&removals, __ATOMIC_RELAXED);
+	do {
+		removal.next = head;
+	} while ( !__atomic_compare_exchange_n(&removals, &head, &removal, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+
+	server_wakeup("server_remove");
+	while ( sem_wait(&removal.done) != 0 && errno == EINTR ){
+		/* interrupted by signal, keep waiting */
+	}
+	sem_destroy(&removal.done);
+}
+
+static void server_handle_ipc(){
+	int protocols[WEBSOCKET_NUM_PROTOCOLS];
+	const int listening = server_num_websockets(protocols) > 0;
+	int changed = 0;
+	enum IPC ipc;
+
+	/* drain all pending commands (shutdown is handled by ipc_fetch()) */
+	while ( (ipc=ipc_fetch(&server, NULL, NULL)) != IPC_NONE ){
+		logmsg("Unexpected IPC command %s (%d) by server worker\n", ipc_name(ipc), ipc);
+	}
+
+	/* refreshes and removals are taken after ipc_fetch() has reset the
+	 * doorbell so one pushed meanwhile signals it again. Refreshes are
+	 * coalesced and published on the next tick, no need to track anything
+	 * when no one is listening. */
+	if ( __atomic_exchange_n(&refresh_all, 0, __ATOMIC_ACQUIRE) && listening ){
+		dirty_mark_set(&pending, NULL);
+		changed = 1;
+	}
+	struct refresh* set = __atomic_exchange_n(&refreshes, NULL, __ATOMIC_ACQUIRE);
+	while ( set ){
+		struct refresh* next = set->next;
+		if ( listening ){
+			dirty_mark_set(&pending, set);
+			changed = 1;
+		}
+		free(set);
+		set = next;
+	}
+
+	/* the removal node is gone once done is posted */
+	struct removal* removal = __atomic_exchange_n(&removals, NULL, __ATOMIC_ACQUIRE);
+	while ( removal ){
+		struct removal* next = removal->next;
+		server_remove_var(removal->var);
+		sem_post(&removal->done);
+		removal = next;
+	}
+
+	if ( changed ){
+		server_schedule();
+	}
+}
+
+static void server_loop_cleanup(){
+	/* iterate backwards as erasing moves the last client */
+	for ( size_t i = list_size(clients); i > 0; i-- ){
+		struct client* client = (struct client*)list_get(clients, i-1);
+		if ( client->state == CLIENT_CLOSED && backend->release(client) ){
+			server_close_client(client);
+		}
+	}
 }
 
-static void write_error(struct worker* client, http_request_t req, http_response_t resp, int code, const char* details){
+static void write_error(struct client* client, http_request_t req, http_response_t resp, int code, const char* details){
 	const char* message = http_status_description(code);
 	char* html = NULL;
 	if ( asprintf(&html, "<h1>%d: %s</h1><p>%s</p>", code, message, details ? details : message) == -1 ){
@@ -236,11 +779,11 @@ static void write_error(struct worker* client, http_request_t req, http_response
 
 	header_add(&resp->header, "Content-Type", "text/html");
 	http_response_status(resp, code, message);
-	http_response_write_header(client, req, resp, 0);
+	http_response_write_header(client, req, resp);
 	if ( html ){
-		http_response_write_chunk(client->sd, html, strlen(html));
+		http_response_write_chunk(client, html, strlen(html));
 	}
-	http_response_write_chunk(client->sd, NULL, 0);
+	http_response_write_chunk(client, NULL, 0);
 
 	free(html);
 }
@@ -270,13 +813,13 @@ const char* peer_addr(int sd, char buf[PEER_ADDR_LEN]){
 	return r ? r : "-";
 }
 
-static void handle_websocket(struct worker* client, const http_request_t req, http_response_t resp){
+static void handle_websocket(struct client* client, const http_request_t req, http_response_t resp){
 	const char* upgrade = header_find(&req->header, "Upgrade");
 	const char* key = header_find(&req->header, "Sec-WebSocket-Key");
 	int version = atoi(header_find(&req->header, "Sec-WebSocket-Version") ?: "0");
 
 	/* validate that this request is actually requesting a websocket */
-	if ( !upgrade || strcmp(upgrade, "websocket") != 0 ){
+	if ( !upgrade || strcmp(upgrade, "websocket") != 0 || !key ){
 		write_error(client, req, resp, 400, "Only websockets supported");
 		return;
 	}
@@ -291,18 +834,29 @@ static void handle_websocket(struct worker* client, const http_request_t req, ht
 	header_add(&resp->header, "Upgrade", "websocket");
 	header_add(&resp->header, "Connection", "Upgrade");
 	header_add(&resp->header, "Sec-WebSocket-Accept", websocket_derive_key(key));
-	header_add(&resp->header, "Sec-WebSocket-Protocol", "v1.tweaklib.sidvind.com");
+	client->protocol = websocket_negotiate(header_find(&req->header, "Sec-WebSocket-Protocol"));
+	header_add(&resp->header, "Sec-WebSocket-Protocol", websocket_protocol_name(client->protocol));
+	char extensions[64];
+	client->deflate = wsdeflate_negotiate(header_find(&req->header, "Sec-WebSocket-Extensions"), extensions, sizeof(extensions));
+	if ( client->deflate ){
+		header_add(&resp->header, "Sec-WebSocket-Extensions", extensions);
+	}
 	header_del(&resp->header, "Transfer-Encoding");
 	http_response_status(resp, 101, http_status_description(101));
-	http_response_write_header(client, req, resp, 1);
-
-	/* retain this connection in a new loop */
-	websocket_loop(client);
+	http_response_write_header(client, req, resp);
+
+	/* the rest of this connection is handled as websocket frames, the hello
+	 * message has the current state so only later refreshes are needed */
+	const char* query = strchr(req->url, '?');
+	websocket_subscribe_query(client, query ? query + 1 : NULL);
+	client->refresh_seq = refresh_head();
+	client_set_refresh_rate(client, __atomic_load_n(&refresh_rate, __ATOMIC_RELAXED));
+	websocket_open(client);
 }
 
-static void handle_get(struct worker* client, const http_request_t req, http_response_t resp){
+static void handle_get(struct client* client, const http_request_t req, http_response_t resp){
 	/* handle actual websocket */
-	if ( strcmp(req->url, "/socket") == 0 ){
+	if ( strncmp(req->url, "/socket", 7) == 0 && (req->url[7] == 0 || req->url[7] == '?') ){
 		handle_websocket(client, req, resp);
 		return;
 	}
@@ -325,7 +879,7 @@ static void handle_get(struct worker* client, const http_request_t req, http_res
 		/* static file found, send it */
 		header_add(&resp->header, "Content-Type", entry->mime);
 		http_response_status(resp, 200, "OK");
-		http_response_write_header(client, req, resp, 0);
+		http_response_write_header(client, req, resp);
 
 		/* check if a local (non-builtin) file is present. */
 		FILE* fp = fopen(entry->original, "r");
@@ -334,15 +888,15 @@ static void handle_get(struct worker* client, const http_request_t req, http_res
 			char buf[4096];
 			size_t bytes;
 			while ( (bytes=fread(buf, 1, sizeof(buf), fp)) > 0 ){
-				http_response_write_chunk(client->sd, buf, bytes);
+				http_response_write_chunk(client, buf, bytes);
 			}
 			fclose(fp);
 		} else {
 			/* no local file, use builtin version */
-			http_response_write_chunk(client->sd, entry->data, entry->bytes);
+			http_response_write_chunk(client, entry->data, entry->bytes);
 		}
 
-		http_response_write_chunk(client->sd, NULL, 0);
+		http_response_write_chunk(client, NULL, 0);
 		free(url);
 		return;
 	}
@@ -353,66 +907,50 @@ static void handle_get(struct worker* client, const http_request_t req, http_res
 }
 
 
-static void handle_post(struct worker* client, const http_request_t req, http_response_t resp){
+static void handle_post(struct client* client, const http_request_t req, http_response_t resp){
 
 }
 
-void* client_loop(void* ptr){
-	struct worker* client = (struct worker*)ptr;
-	const int max_fd = max(client->sd, client->pipe[READ_FD])+1;
-	char* buf = malloc(buffer_size);
-
-	logmsg("%s [%d] - client connected\n", client->peeraddr, client->id);
-
-	while (client->running){
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(client->sd, &fds);
-		FD_SET(client->pipe[READ_FD], &fds);
-
-		/* wait for next request */
-		if ( select(max_fd, &fds, NULL, NULL, NULL) == -1 ){
-			logmsg("select() failed: %s\n", strerror(errno));
-			continue;
-		}
-
-		/* handle IPC */
-		if ( FD_ISSET(client->pipe[READ_FD], &fds) ){
-			enum IPC ipc;
-			switch ( ipc=ipc_fetch(client, NULL, NULL) ){
-			case IPC_NONE:
-			case IPC_REFRESH: /* ignored by http */
-				break;
-			default:
-				logmsg("Unexpected IPC command %s (%d) by HTTP worker\n", ipc_name(ipc), ipc);
+/**
+ * Handle all complete requests in the client input buffer.
+ */
+static void handle_http(struct client* client){
+	while ( client->state == CLIENT_HTTP ){
+		/* wait for the full request header */
+		const char* end = client->in.size > 0 ? memmem(client->in.data, client->in.size, "\r\n\r\n", 4) : NULL;
+		if ( !end ){
+			if ( client->in.size >= max_request_size ){
+				logmsg("%s [%d] - request too large, closing connection\n", client->peeraddr, client->id);
+				client->state = CLIENT_CLOSED;
 			}
-			continue;
-		}
-
-		/* read request */
-		ssize_t bytes = recv(client->sd, buf, buffer_size-1, 0); /* -1 so null terminator will fit */
-		if ( bytes == -1 ){
-			logmsg("recv() failed: %s\n", strerror(errno));
-			break;
-		} else if ( bytes == 0 ){
-			logmsg("%s [%d] - connection closed\n", client->peeraddr, client->id);
-			break;
+			return;
 		}
 
-		/** @todo handle when request is larger than buffer_size */
-
-		/* force null-terminator */
-		buf[bytes] = 0;
-
-		/* parse request */
+		/* parse request (parser modifies buffer so a copy is used) */
+		const size_t header_size = end - client->in.data + 4;
+		char* buf = strndup(client->in.data, header_size);
 		struct http_request req;
 		http_request_init(&req);
-		if ( !http_request_read(&req, buf, bytes) ){
+		if ( !http_request_read(&req, buf, header_size) || !req.url ){
 			logmsg("Malformed request ignored.\n");
 			http_request_free(&req);
+			buffer_consume(&client->in, header_size);
+			free(buf);
 			continue;
 		}
 
+		/* wait for request body (if any) */
+		const size_t body_size = strtoul(header_find(&req.header, "Content-Length") ?: "0", NULL, 10);
+		if ( body_size > max_request_size || client->in.size < header_size + body_size ){
+			if ( body_size > max_request_size ){
+				logmsg("%s [%d] - request too large, closing connection\n", client->peeraddr, client->id);
+				client->state = CLIENT_CLOSED;
+			}
+			http_request_free(&req);
+			free(buf);
+			return;
+		}
+
 		/* generate response */
 		struct http_response resp;
 		http_response_init(&resp);
@@ -435,11 +973,49 @@ void* client_loop(void* ptr){
 		/* free resources allocated for this request */
 		http_response_free(&resp);
 		http_request_free(&req);
+		buffer_consume(&client->in, header_size + body_size);
+		free(buf);
+	}
+}
+
+void server_handle_input(struct client* client, int open){
+	if ( client->state == CLIENT_CLOSED ){
+		return;
+	}
+
+	/* handle whatever was received, even if the peer closed afterwards */
+	if ( client->state == CLIENT_HTTP ){
+		handle_http(client);
+	}
+	if ( client->state == CLIENT_WEBSOCKET ){
+		websocket_read(client);
+	}
+
+	/* whatever is left is an incomplete request or frame, both are limited
+	 * well below this */
+	if ( client->in.size >= CLIENT_MAX_INPUT ){
+		logmsg("%s [%d] - too much unparsed input (%zu bytes), closing connection\n", client->peeraddr, client->id, client->in.size);
+		client->state = CLIENT_CLOSED;
+		return;
+	}
+
+	if ( !open ){
+		client->state = CLIENT_CLOSED;
+		return;
+	}
+
+	/* send responses */
+	server_flush(client);
+}
+
+static void* server_loop(void* arg){
+	while (server.running) {
+		backend->poll();
+
+		/* closed clients are released after all events are handled as later
+		 * events in the same batch might still refer to them */
+		server_loop_cleanup();
 	}
 
-	/* close client connection */
-	clients[client->slot] = NULL;
-	worker_free(client);
-	free(buf);
 	return NULL;
 }
@@ -2,23 +2,50 @@
 #define TWEAKLIB_INT_SERVER_H
 
 #include "tweak/tweak.h"
+#include "refresh.h"
 #include "vars.h"
 #include "worker.h"
 #include <stddef.h>
 
 #define PEER_ADDR_LEN 64
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void server_init(int port, const char* addr);
 void server_cleanup();
 
 /**
- * Update variables on all clients.
+ * Update variables on all clients. Changes are coalesced so each client gets
+ * the latest values at most at its refresh rate.
  *
- * @param vars array with all variables to update
- * @param n number of array elements
+ * @param set snapshot with the variables to update, ownership is transferred
+ *            to the server.
+ */
+void server_refresh(struct refresh* set);
+
+/**
+ * Update all variables on all clients.
  */
-void server_refresh(struct var* vars[], size_t n);
+void server_refresh_all();
+
+/**
+ * Tell all clients the variable is removed and retire it (see var_retire()).
+ * Blocks until the server thread is done with it, so the variable can be
+ * released afterwards.
+ */
+void server_remove(struct var* var);
+
+/**
+ * Name of the network backend in use or NULL if the server is not running.
+ */
+const char* server_backend();
 
 const char* peer_addr(int sd, char buf[PEER_ADDR_LEN]);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* TWEAKLIB_INT_SERVER_H */
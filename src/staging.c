@@ -0,0 +1,131 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "tweak/tweak.h"
+#include "log.h"
+#include "staging.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct staged {
+	struct staged* next;
+	tweak_handle handle;                  /* looked up again when applied */
+	size_t size;
+	uint64_t value[];                     /* aligned for any datatype */
+};
+
+static int enabled = 0;
+static struct staged* queue = NULL;   /* LIFO, pushed by server thread */
+
+int staging_enabled(){
+	return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+static struct staged* staging_alloc(const struct var* var){
+	struct staged* staged = malloc(sizeof(struct staged) + var->size);
+	if ( !staged ){
+		logmsg("malloc() failed: %s\n", strerror(errno));
+		return NULL;
+	}
+	staged->handle = var->handle;
+	staged->size = var->size;
+	return staged;
+}
+
+static void staging_push(struct staged* staged){
+	struct staged* head = __atomic_load_n(&queue, __ATOMIC_RELAXED);
+	do {
+		staged->next = head;
+	} while ( !__atomic_compare_exchange_n(&queue, &head, staged, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+}
+
+/**
+ * Take all staged updates in the order they were staged.
+ */
+static struct staged* staging_take(){
+	struct staged* it = __atomic_exchange_n(&queue, NULL, __ATOMIC_ACQUIRE);
+	struct staged* batch = NULL;
+	while ( it ){
+		struct staged* next = it->next;
+		it->next = batch;
+		batch = it;
+		it = next;
+	}
+	return batch;
+}
+
+void staging_load(const struct var* var, struct json_object* value){
+	struct staged* staged = staging_alloc(var);
+	if ( !staged ){
+		return;
+	}
+
+	/* the datatype decodes into the staged copy instead of the variable */
+	struct var tmp = *var;
+	tmp.ptr = staged->value;
+	var->load(&tmp, value);
+	staging_push(staged);
+}
+
+size_t staging_unpack(const struct var* var, const char* src, size_t size){
+	struct staged* staged = staging_alloc(var);
+	if ( !staged ){
+		return 0;
+	}
+
+	struct var tmp = *var;
+	tmp.ptr = staged->value;
+	const size_t bytes = var->unpack(&tmp, src, size);
+	if ( bytes == 0 ){
+		free(staged);
+		return 0;
+	}
+
+	staging_push(staged);
+	return bytes;
+}
+
+void staging_cleanup(){
+	struct staged* it = staging_take();
+	while ( it ){
+		struct staged* next = it->next;
+		free(it);
+		it = next;
+	}
+}
+
+void tweak_defer_updates(int defer){
+	__atomic_store_n(&enabled, defer ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void tweak_sync(){
+	struct staged* batch = staging_take();
+	if ( !batch ){
+		return;
+	}
+
+	/* all values are applied before any trigger runs. A variable updated
+	 * several times since the last sync ends up with the latest value and
+	 * its trigger is only called once (for the last update). Variables
+	 * removed in the meantime are skipped by the handle lookup. */
+	for ( struct staged* it = batch; it; it = it->next ){
+		struct var* var = var_from_handle(it->handle);
+		if ( var && var->size == it->size ){
+			memcpy(var->ptr, it->value, it->size);
+			var->staged++;
+		}
+	}
+
+	while ( batch ){
+		struct staged* next = batch->next;
+		struct var* var = var_from_handle(batch->handle);
+		if ( var && var->size == batch->size && --var->staged == 0 ){
+			var->update(var->handle);
+		}
+		free(batch);
+		batch = next;
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef TWEAKLIB_STAGING_H
+#define TWEAKLIB_STAGING_H
+
+/**
+ * Updates from clients waiting to be applied by tweak_sync(). The server
+ * thread decodes values into a lock-free stack instead of writing them into
+ * application memory, the application thread takes the whole stack at once and
+ * applies it. Neither side ever blocks the other.
+ */
+
+#include "vars.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct json_object;
+
+/**
+ * Non-zero if updates are deferred (see tweak_defer_updates()).
+ */
+int staging_enabled();
+
+/**
+ * Stage an update of a variable (same as var->load() and var->unpack() but
+ * the value is decoded into the staging area). Called from the server thread.
+ *
+ * @return staging_unpack() returns the number of bytes consumed or 0 if src
+ *         is too short (nothing is staged).
+ */
+void staging_load(const struct var* var, struct json_object* value);
+size_t staging_unpack(const struct var* var, const char* src, size_t size);
+
+/**
+ * Discard all staged updates, the server thread must not be running.
+ */
+void staging_cleanup();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_STAGING_H */
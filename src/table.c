@@ -0,0 +1,174 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "tweak/tweak.h"
+#include "buffer.h"
+#include "log.h"
+#include "utils/json_writer.h"
+#include "vars.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* formatted options by range, direct-mapped */
+#define OPTIONS_CACHE 64
+
+struct options {
+	tweak_type type;
+	double min;
+	double max;
+	double step;
+	char* json;                           /* NULL if unused, freed after registering */
+};
+
+/**
+ * Size of the variable of a descriptor or zero if the type is invalid.
+ */
+static size_t table_size(const tweak_descriptor* desc){
+	switch ( desc->type ){
+	case TWEAK_INT: return sizeof(int);
+	case TWEAK_FLOAT: return sizeof(float);
+	case TWEAK_DOUBLE: return sizeof(double);
+	}
+	return 0;
+}
+
+static void table_setup(struct var* var, tweak_type type){
+	switch ( type ){
+	case TWEAK_INT:
+		var_setup_int(var);
+		break;
+	case TWEAK_FLOAT:
+		var_setup_float(var);
+		break;
+	case TWEAK_DOUBLE:
+		var_setup_double(var);
+		break;
+	}
+}
+
+static void table_write_number(struct json_writer* w, tweak_type type, const char* key, double value){
+	json_write_key(w, key);
+	switch ( type ){
+	case TWEAK_INT:
+		json_write_int(w, (long long)value);
+		break;
+	case TWEAK_FLOAT:
+		json_write_float(w, (float)value);
+		break;
+	case TWEAK_DOUBLE:
+		json_write_double(w, value);
+		break;
+	}
+}
+
+static unsigned int table_hash(const tweak_descriptor* desc){
+	uint64_t bits[3];
+	memcpy(&bits[0], &desc->min, sizeof(double));
+	memcpy(&bits[1], &desc->max, sizeof(double));
+	memcpy(&bits[2], &desc->step, sizeof(double));
+	const uint64_t hash = (bits[0] * 31 + bits[1]) * 31 + bits[2] + desc->type;
+	return (unsigned int)((hash * UINT64_C(0x9e3779b97f4a7c15)) >> 32) % OPTIONS_CACHE;
+}
+
+/**
+ * Options of a descriptor as encoded JSON. Tables usually repeat the same
+ * ranges so formatted options are cached for the duration of the call, each
+ * variable gets its own copy (released with the variable).
+ *
+ * @return options, NULL if there are no options or on errors.
+ */
+static const char* table_options(const tweak_descriptor* desc, struct options cache[OPTIONS_CACHE], struct buffer* buf){
+	if ( desc->min == desc->max && desc->step == 0 ){
+		return NULL;
+	}
+
+	struct options* cached = &cache[table_hash(desc)];
+	if ( cached->json && cached->type == desc->type && cached->min == desc->min && cached->max == desc->max && cached->step == desc->step ){
+		return cached->json;
+	}
+
+	struct json_writer w;
+	buffer_clear(buf);
+	json_writer_init(&w, buf);
+	json_write_begin_object(&w);
+	if ( desc->min != desc->max ){
+		table_write_number(&w, desc->type, "min", desc->min);
+		table_write_number(&w, desc->type, "max", desc->max);
+	}
+	if ( desc->step != 0 ){
+		table_write_number(&w, desc->type, "step", desc->step);
+	}
+	json_write_end_object(&w);
+	buffer_append(buf, "", 1);
+
+	char* json = strdup(buf->data);
+	if ( !json ){
+		logmsg("malloc() failed: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	free(cached->json);
+	cached->type = desc->type;
+	cached->min = desc->min;
+	cached->max = desc->max;
+	cached->step = desc->step;
+	cached->json = json;
+	return json;
+}
+
+size_t tweak_register_table(const tweak_descriptor* table, size_t n, tweak_handle* handles){
+	if ( tweak_disabled() ){
+		if ( handles ){
+			memset(handles, 0, sizeof(tweak_handle) * n);
+		}
+		return 0;
+	}
+
+	/* room for all records and the name index is allocated up front, names
+	 * and descriptions point into the table */
+	if ( var_reserve(n) != 0 ){
+		return 0;
+	}
+
+	struct options cache[OPTIONS_CACHE] = {{0,}};
+	struct buffer buf;
+	buffer_init(&buf);
+
+	size_t registered = 0;
+	for ( size_t i = 0; i < n; i++ ){
+		const tweak_descriptor* desc = &table[i];
+		const size_t size = table_size(desc);
+		tweak_handle handle = 0;
+
+		/* tweak_type uses the same values as datatype_t */
+		struct var* var = NULL;
+		if ( size == 0 ){
+			logmsg("variable \"%s\" has invalid type %d\n", desc->name, desc->type);
+		} else {
+			var = var_create_static(desc->name, size, desc->ptr, (datatype_t)desc->type);
+		}
+
+		if ( var ){
+			table_setup(var, desc->type);
+			const char* options = table_options(desc, cache, &buf);
+			var->options = options ? var_strdup(options) : NULL;
+			var->description = desc->description;
+			var->borrowed |= VAR_BORROWED_DESCRIPTION;
+			handle = var_add(var);
+			registered++;
+		}
+
+		if ( handles ){
+			handles[i] = handle;
+		}
+	}
+
+	for ( size_t i = 0; i < OPTIONS_CACHE; i++ ){
+		free(cache[i].json);
+	}
+	buffer_free(&buf);
+	return registered;
+}
@@ -3,51 +3,64 @@
 #endif
 
 #include "tweak/tweak.h"
+#include "group.h"
 #include "server.h"
-#include "list.h"
+#include "staging.h"
 #include "log.h"
 #include "vars.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
-#include <limits.h>
 #include <json.h>
 
-list_t vars = NULL;
-static unsigned int var_index = 0;
-static unsigned int* var_table = NULL;
-static unsigned int var_table_size = 0;
-static const unsigned int var_invalid = UINT_MAX;
 static pthread_mutex_t tweak_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static void var_free(struct var* var){
-	if ( var->ownership ){
-		free(var->ptr);
+/* runtime kill switch, -1 until read from the environment */
+static int disabled = -1;
+
+static int tweak_disabled_env(){
+	const char* value = getenv("TWEAK_DISABLE");
+	return value && value[0] != '\0' && strcmp(value, "0") != 0;
+}
+
+int tweak_disabled(){
+	int state = __atomic_load_n(&disabled, __ATOMIC_RELAXED);
+	if ( __builtin_expect(state < 0, 0) ){
+		state = tweak_disabled_env();
+		__atomic_store_n(&disabled, state, __ATOMIC_RELAXED);
 	}
-	free(var->name);
-	free(var->description);
-	free(var->options);
-	free(var);
+	return state;
 }
 
-void tweak_init(int port, const char* addr){
-	vars = list_alloc(sizeof(struct var), 100);
-	list_destructor(vars, (list_destructor_callback)var_free);
+/* parenthesized as tweak_init() is also a macro registering the section of
+ * the caller */
+void (tweak_init)(int port, const char* addr){
+	if ( tweak_disabled() ){
+		logmsg("disabled at runtime, server not started\n");
+		return;
+	}
 
 	server_init(port, addr ? addr : "127.0.0.1");
 }
 
-void tweak_init_args(int port, const char* addr, int argc, char* argv[]){
+void (tweak_init_args)(int port, const char* addr, int argc, char* argv[]){
+	int state = tweak_disabled_env();
+	for ( int i = 1; i < argc; i++ ){
+		if ( strcmp(argv[i], "--tweak-disable") == 0 ){
+			state = 1;
+		}
+	}
 
+	__atomic_store_n(&disabled, state, __ATOMIC_RELAXED);
+	(tweak_init)(port, addr);
 }
 
 void tweak_cleanup(){
 	server_cleanup();
-	list_free(vars);
-
-	free(var_table);
-	var_table = NULL;
-	var_table_size = 0;
+	staging_cleanup();
+	var_cleanup();
+	group_cleanup();
 }
 
 void tweak_output(tweak_output_func callback){
@@ -68,26 +81,76 @@ void tweak_trigger(tweak_handle handle, tweak_callback callback){
 void tweak_description(tweak_handle handle, const char* description){
 	struct var* var = var_from_handle(handle);
 	if ( var ){
-		free(var->description);
-		var->description = strdup(description);
+		/* the previous description is reused by later strings, the server
+		 * thread must not be serializing concurrently (same as for options) */
+		if ( !(var->borrowed & VAR_BORROWED_DESCRIPTION) ){
+			var_strfree(var->description);
+		}
+		var->description = var_strdup(description);
+		var->borrowed &= ~VAR_BORROWED_DESCRIPTION;
 	}
 }
 
 void tweak_options(tweak_handle handle, const char* data){
 	struct var* var = var_from_handle(handle);
 	if ( var ){
-		free(var->options);
+		if ( !(var->borrowed & VAR_BORROWED_OPTIONS) ){
+			var_strfree(var->options);
+		}
 		var->options = NULL;
+		var->borrowed &= ~VAR_BORROWED_OPTIONS;
 
 		struct json_object* json = json_tokener_parse(data);
 		if ( !json ){
 			logmsg("Failed to parse options\n");
 			return;
 		}
+
+		/* options are parsed once and stored in compact form so they can be
+		 * written as-is when serializing */
+		var->options = var_strdup(json_object_to_json_string_ext(json, 0));
 		json_object_put(json);
+	}
+}
 
-		var->options = strdup(data);
+void tweak_set_group(tweak_handle handle, const char* group){
+	struct var* var = var_from_handle(handle);
+	if ( !var ){
+		return;
 	}
+
+	const struct group* found;
+	if ( group_create(group ? group : "", &found) != 0 ){
+		logmsg("malloc() failed: %s\n", strerror(errno));
+		return;
+	}
+
+	var->group = found;
+}
+
+void tweak_remove(tweak_handle handle){
+	struct var* var = var_from_handle(handle);
+	if ( !var ){
+		return;
+	}
+
+	/* clients are told before the variable is released as the server thread
+	 * may still refer to it until then */
+	server_remove(var);
+	var_release(var);
+}
+
+void tweak_register_section(const tweak_descriptor* begin, const tweak_descriptor* end){
+	if ( begin == end ){
+		return;
+	}
+
+	const struct var* first = var_from_handle(var_find(begin->name));
+	if ( first && first->ptr == begin->ptr ){
+		return;
+	}
+
+	tweak_register_table(begin, end - begin, NULL);
 }
 
 const char* tweak_get_name(tweak_handle handle){
@@ -95,82 +158,77 @@ const char* tweak_get_name(tweak_handle handle){
 	return var ? var->name : NULL;
 }
 
+tweak_handle tweak_find(const char* name){
+	return var_find(name);
+}
+
+size_t tweak_find_prefix(const char* prefix, tweak_handle* handles, size_t max){
+	return var_find_prefix(prefix, handles, max);
+}
+
 void tweak_lock(){
+	if ( tweak_disabled() ) return;
 	pthread_mutex_lock(&tweak_mutex);
 }
 
 void tweak_unlock(){
+	if ( tweak_disabled() ) return;
 	pthread_mutex_unlock(&tweak_mutex);
 }
 
-void tweak_refresh(){
-	const size_t n = list_size(vars);
-	const size_t bytes = sizeof(void*) * n;
-	struct var** set = malloc(bytes);
-	size_t i;
-	void** it;
-
-	/* fill set with all variables */
-	for ( i = 0, it = list_begin(vars); it != list_end(vars); i++, it++ ){
-		set[i] = *(struct var**)it;
-	}
-
-	server_refresh(set, bytes);
-	free(set);
-}
-
-void tweak_refresh_vars(tweak_set begin, size_t size){
-	const size_t n = size / sizeof(tweak_handle);
-	const size_t bytes = sizeof(void*) * n;
-	struct var** set = malloc(bytes);
-	size_t i;
+void tweak_publish(){
+	if ( tweak_disabled() ) return;
 
-	/* fill set with selected variables */
-	tweak_handle* cur = begin;
-	tweak_handle* end = begin + n;
-	for ( i = 0; cur < end; i++, cur++ ){
-		set[i] = var_from_handle(*cur);
+	const size_t n = var_count();
+	for ( size_t i = 0; i < n; i++ ){
+		struct var* var = var_get(i);
+		if ( var_live(var) ){
+			var_publish(var);
+		}
 	}
-
-	server_refresh(set, bytes);
-	free(set);
 }
 
-tweak_handle var_add(struct var* var){
-	int index = list_push(vars, var);
+void tweak_publish_vars(tweak_set begin, size_t size){
+	if ( tweak_disabled() ) return;
 
-	if ( var_index >= var_table_size ){
-		var_table_size += 100;
-		var_table = realloc(var_table, sizeof(unsigned int) * var_table_size + 100);
+	const size_t n = size / sizeof(tweak_handle);
+	for ( size_t i = 0; i < n; i++ ){
+		struct var* var = var_from_handle(begin[i]);
+		if ( var ){
+			var_publish(var);
+		}
 	}
+}
 
-	var_table[var_index++] = index;
+void tweak_refresh(){
+	if ( tweak_disabled() ) return;
 
-	/* varindex is now +1 so user will see 1 as the first index (on purpose) */
-	var->handle = var_index;
-	return var_index;
+	/* no need to build a set, the server reads the variables directly */
+	server_refresh_all();
 }
 
-struct var* var_from_handle(tweak_handle handle){
-	if ( handle == 0 ) return NULL;
+void tweak_refresh_vars(tweak_set begin, size_t size){
+	if ( tweak_disabled() ) return;
 
-	const unsigned int index = var_table[handle - 1];
-	if ( index != var_invalid ){
-		return (struct var*)list_get(vars, index);
-	} else {
-		return NULL;
+	const size_t n = size / sizeof(tweak_handle);
+	struct refresh* set = refresh_alloc(n);
+	if ( !set ){
+		logmsg("malloc() failed: %s\n", strerror(errno));
+		return;
+	}
+
+	/* fill set with selected variables, invalid handles are skipped */
+	tweak_handle* cur = begin;
+	tweak_handle* end = begin + n;
+	set->n = 0;
+	for ( ; cur < end; cur++ ){
+		struct var* var = var_from_handle(*cur);
+		if ( var ){
+			set->vars[set->n++] = var;
+		}
 	}
-}
 
-struct var* var_create(const char* name, size_t size, void* ptr, datatype_t datatype){
-	struct var* var = malloc(sizeof(struct var));
-	var->name =  strdup(name);
-	var->description = NULL;
-	var->options = NULL;
-	var->size = size;
-	var->ptr = ptr;
-	var->ownership = 0;
-	var->datatype = datatype;
-	var->update = default_trigger;
-	return var;
+	/* the set is handed over as-is, the server frees it when all clients has
+	 * sent it */
+	server_refresh(set);
 }
@@ -0,0 +1,189 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "utils/json_writer.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+void json_writer_init(struct json_writer* w, struct buffer* buf){
+	w->buf = buf;
+	w->depth = 0;
+	w->separator = 0;
+	w->key = 0;
+}
+
+static void json_put(struct json_writer* w, const char* str, size_t len){
+	buffer_append(w->buf, str, len);
+}
+
+static void json_putc(struct json_writer* w, char ch){
+	char* dst = buffer_reserve(w->buf, 1);
+	if ( !dst ) return;
+	*dst = ch;
+	w->buf->size++;
+}
+
+/**
+ * Write separator (if needed) before a value or key.
+ */
+static void json_separate(struct json_writer* w){
+	const uint64_t bit = (uint64_t)1 << w->depth;
+
+	if ( w->key ){
+		w->key = 0;
+		return;
+	}
+
+	if ( w->separator & bit ){
+		json_putc(w, ',');
+	}
+	w->separator |= bit;
+}
+
+static void json_begin(struct json_writer* w, char ch){
+	json_separate(w);
+	json_putc(w, ch);
+
+	assert(w->depth + 1 < JSON_WRITER_MAX_DEPTH);
+	w->depth++;
+	w->separator &= ~((uint64_t)1 << w->depth);
+}
+
+static void json_end(struct json_writer* w, char ch){
+	assert(w->depth > 0);
+	w->depth--;
+	json_putc(w, ch);
+}
+
+void json_write_begin_object(struct json_writer* w){
+	json_begin(w, '{');
+}
+
+void json_write_end_object(struct json_writer* w){
+	json_end(w, '}');
+}
+
+void json_write_begin_array(struct json_writer* w){
+	json_begin(w, '[');
+}
+
+void json_write_end_array(struct json_writer* w){
+	json_end(w, ']');
+}
+
+void json_escape(struct buffer* buf, const char* str){
+	static const char hex[] = "0123456789abcdef";
+	const char* begin = str;
+
+	for ( const char* it = str; *it; it++ ){
+		const unsigned char ch = *it;
+		if ( ch >= 0x20 && ch != '"' && ch != '\\' ){
+			continue;
+		}
+
+		/* flush unescaped run */
+		buffer_append(buf, begin, it - begin);
+		begin = it + 1;
+
+		char esc[6] = {'\\', 0,};
+		size_t len = 2;
+		switch ( ch ){
+		case '"':  esc[1] = '"'; break;
+		case '\\': esc[1] = '\\'; break;
+		case '\b': esc[1] = 'b'; break;
+		case '\f': esc[1] = 'f'; break;
+		case '\n': esc[1] = 'n'; break;
+		case '\r': esc[1] = 'r'; break;
+		case '\t': esc[1] = 't'; break;
+		default:
+			esc[1] = 'u';
+			esc[2] = '0';
+			esc[3] = '0';
+			esc[4] = hex[ch >> 4];
+			esc[5] = hex[ch & 0xf];
+			len = 6;
+		}
+		buffer_append(buf, esc, len);
+	}
+
+	buffer_append(buf, begin, strlen(begin));
+}
+
+void json_write_key(struct json_writer* w, const char* key){
+	json_separate(w);
+	json_putc(w, '"');
+	json_escape(w->buf, key);
+	json_put(w, "\":", 2);
+	w->key = 1;
+}
+
+void json_write_string(struct json_writer* w, const char* str){
+	json_separate(w);
+	json_putc(w, '"');
+	json_escape(w->buf, str);
+	json_putc(w, '"');
+}
+
+void json_write_int(struct json_writer* w, long long value){
+	json_separate(w);
+
+	/* formatted backwards to avoid snprintf */
+	char tmp[24];
+	char* end = tmp + sizeof(tmp);
+	char* it = end;
+	unsigned long long u = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+	do {
+		*--it = '0' + (u % 10);
+		u /= 10;
+	} while ( u > 0 );
+	if ( value < 0 ){
+		*--it = '-';
+	}
+
+	json_put(w, it, end - it);
+}
+
+/**
+ * Write a floating point number with enough significant digits to be read back
+ * exactly.
+ */
+static void json_write_number(struct json_writer* w, double value, int digits){
+	/* JSON has no representation of inf/nan */
+	if ( !isfinite(value) ){
+		json_write_null(w);
+		return;
+	}
+
+	json_separate(w);
+	char* dst = buffer_reserve(w->buf, 32);
+	if ( !dst ) return;
+	int len = snprintf(dst, 32, "%.*g", digits, value);
+
+	/* keep it a floating point number when parsed again */
+	if ( strpbrk(dst, ".eE") == NULL ){
+		memcpy(dst + len, ".0", 2);
+		len += 2;
+	}
+	w->buf->size += len;
+}
+
+void json_write_float(struct json_writer* w, float value){
+	json_write_number(w, value, 9);
+}
+
+void json_write_double(struct json_writer* w, double value){
+	json_write_number(w, value, 17);
+}
+
+void json_write_null(struct json_writer* w){
+	json_separate(w);
+	json_put(w, "null", 4);
+}
+
+void json_write_raw(struct json_writer* w, const char* json, size_t len){
+	json_separate(w);
+	json_put(w, json, len);
+}
@@ -0,0 +1,64 @@
+#ifndef TWEAKLIB_UTILS_JSON_WRITER_H
+#define TWEAKLIB_UTILS_JSON_WRITER_H
+
+/**
+ * Streaming JSON writer.
+ *
+ * Output is written directly into a buffer as values are added, separators are
+ * inserted automatically. No memory is allocated besides growing the buffer so
+ * a reused buffer makes serialization allocation-free.
+ */
+
+#include "buffer.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JSON_WRITER_MAX_DEPTH 64
+
+struct json_writer {
+	struct buffer* buf;
+	unsigned int depth;                   /* current nesting level */
+	uint64_t separator;                   /* bit per level, set if next value needs a comma */
+	int key;                              /* a key was written and its value is next */
+};
+
+/**
+ * Start writing JSON at the end of buf.
+ */
+void json_writer_init(struct json_writer* w, struct buffer* buf);
+
+void json_write_begin_object(struct json_writer* w);
+void json_write_end_object(struct json_writer* w);
+void json_write_begin_array(struct json_writer* w);
+void json_write_end_array(struct json_writer* w);
+
+/**
+ * Write an object key, must be followed by a value.
+ */
+void json_write_key(struct json_writer* w, const char* key);
+
+void json_write_string(struct json_writer* w, const char* str);
+void json_write_int(struct json_writer* w, long long value);
+void json_write_float(struct json_writer* w, float value);
+void json_write_double(struct json_writer* w, double value);
+void json_write_null(struct json_writer* w);
+
+/**
+ * Write an already encoded value as-is.
+ */
+void json_write_raw(struct json_writer* w, const char* json, size_t len);
+
+/**
+ * Escape a string (without surrounding quotes) and append to buffer.
+ */
+void json_escape(struct buffer* buf, const char* str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_UTILS_JSON_WRITER_H */
@@ -0,0 +1,165 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "mask.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MASK_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * Byte-wise reference implementation, also used for unaligned heads and
+ * tails by the others.
+ */
+static void mask_scalar(char* data, size_t size, const uint8_t key[4], size_t offset){
+	for ( size_t i = 0; i < size; i++ ){
+		data[i] ^= key[(offset + i) & 3];
+	}
+}
+
+/**
+ * Key rotated so it starts at key[offset % 4], as stored in memory.
+ */
+static uint32_t key_pattern(const uint8_t key[4], size_t offset){
+	const uint8_t bytes[4] = {key[offset & 3], key[(offset + 1) & 3], key[(offset + 2) & 3], key[(offset + 3) & 3]};
+	uint32_t pattern;
+	memcpy(&pattern, bytes, sizeof(uint32_t));
+	return pattern;
+}
+
+/**
+ * Mask bytes until data is aligned to align (power of two).
+ *
+ * @return number of bytes masked.
+ */
+static size_t mask_head(char* data, size_t size, const uint8_t key[4], size_t offset, size_t align){
+	size_t head = (align - ((uintptr_t)data & (align - 1))) & (align - 1);
+	if ( head > size ){
+		head = size;
+	}
+	mask_scalar(data, head, key, offset);
+	return head;
+}
+
+/**
+ * Portable version processing 8 bytes at a time.
+ */
+static void mask_word(char* data, size_t size, const uint8_t key[4], size_t offset){
+	const size_t head = mask_head(data, size, key, offset, sizeof(uint64_t));
+	data += head;
+	size -= head;
+	offset += head;
+
+	/* offset modulo 4 is unchanged by whole words */
+	const uint64_t pattern = key_pattern(key, offset) * UINT64_C(0x100000001);
+	for ( ; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t) ){
+		uint64_t word;
+		memcpy(&word, data, sizeof(uint64_t));
+		word ^= pattern;
+		memcpy(data, &word, sizeof(uint64_t));
+	}
+
+	mask_scalar(data, size, key, offset);
+}
+
+static int supported_always(void){
+	return 1;
+}
+
+#ifdef MASK_X86
+__attribute__((target("sse2")))
+static void mask_sse2(char* data, size_t size, const uint8_t key[4], size_t offset){
+	const size_t head = mask_head(data, size, key, offset, 16);
+	data += head;
+	size -= head;
+	offset += head;
+
+	const __m128i pattern = _mm_set1_epi32(key_pattern(key, offset));
+
+	for ( ; size >= 64; data += 64, size -= 64 ){
+		__m128i* ptr = (__m128i*)data;
+		_mm_store_si128(ptr + 0, _mm_xor_si128(_mm_load_si128(ptr + 0), pattern));
+		_mm_store_si128(ptr + 1, _mm_xor_si128(_mm_load_si128(ptr + 1), pattern));
+		_mm_store_si128(ptr + 2, _mm_xor_si128(_mm_load_si128(ptr + 2), pattern));
+		_mm_store_si128(ptr + 3, _mm_xor_si128(_mm_load_si128(ptr + 3), pattern));
+	}
+	for ( ; size >= 16; data += 16, size -= 16 ){
+		__m128i* ptr = (__m128i*)data;
+		_mm_store_si128(ptr, _mm_xor_si128(_mm_load_si128(ptr), pattern));
+	}
+
+	mask_scalar(data, size, key, offset);
+}
+
+__attribute__((target("avx2")))
+static void mask_avx2(char* data, size_t size, const uint8_t key[4], size_t offset){
+	const size_t head = mask_head(data, size, key, offset, 32);
+	data += head;
+	size -= head;
+	offset += head;
+
+	const __m256i pattern = _mm256_set1_epi32(key_pattern(key, offset));
+
+	for ( ; size >= 128; data += 128, size -= 128 ){
+		__m256i* ptr = (__m256i*)data;
+		_mm256_store_si256(ptr + 0, _mm256_xor_si256(_mm256_load_si256(ptr + 0), pattern));
+		_mm256_store_si256(ptr + 1, _mm256_xor_si256(_mm256_load_si256(ptr + 1), pattern));
+		_mm256_store_si256(ptr + 2, _mm256_xor_si256(_mm256_load_si256(ptr + 2), pattern));
+		_mm256_store_si256(ptr + 3, _mm256_xor_si256(_mm256_load_si256(ptr + 3), pattern));
+	}
+	for ( ; size >= 32; data += 32, size -= 32 ){
+		__m256i* ptr = (__m256i*)data;
+		_mm256_store_si256(ptr, _mm256_xor_si256(_mm256_load_si256(ptr), pattern));
+	}
+
+	mask_scalar(data, size, key, offset);
+}
+
+static int supported_sse2(void){
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static int supported_avx2(void){
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+/* in order of preference */
+const struct mask_impl mask_impls[] = {
+#ifdef MASK_X86
+	{"avx2", mask_avx2, supported_avx2},
+	{"sse2", mask_sse2, supported_sse2},
+#endif
+	{"word", mask_word, supported_always},
+	{"scalar", mask_scalar, supported_always},
+	{NULL, NULL, NULL},
+};
+
+/* selected on first use, any thread may select it but all select the same */
+static mask_func selected = NULL;
+
+void mask_apply(char* data, size_t size, const uint8_t key[4], size_t offset){
+	/* typical small messages are faster without the vector setup */
+	if ( size < 64 ){
+		mask_word(data, size, key, offset);
+		return;
+	}
+
+	mask_func func = __atomic_load_n(&selected, __ATOMIC_RELAXED);
+	if ( !func ){
+		for ( const struct mask_impl* impl = mask_impls; impl->name; impl++ ){
+			if ( impl->supported() ){
+				func = impl->func;
+				break;
+			}
+		}
+		__atomic_store_n(&selected, func, __ATOMIC_RELAXED);
+	}
+
+	func(data, size, key, offset);
+}
@@ -0,0 +1,40 @@
+#ifndef TWEAKLIB_UTILS_MASK_H
+#define TWEAKLIB_UTILS_MASK_H
+
+/**
+ * Websocket payload masking (XOR with a repeating 4 byte key). The best
+ * implementation for the CPU is selected at runtime.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Mask (or unmask) size bytes in place. Offset is the position of data within
+ * the payload, i.e. the first byte is XORed with key[offset % 4].
+ */
+typedef void (*mask_func)(char* data, size_t size, const uint8_t key[4], size_t offset);
+
+void mask_apply(char* data, size_t size, const uint8_t key[4], size_t offset);
+
+/**
+ * All implementations, for testing and benchmarking. Terminated by an entry
+ * with name NULL.
+ */
+struct mask_impl {
+	const char* name;
+	mask_func func;
+	int (*supported)(void);
+};
+
+extern const struct mask_impl mask_impls[];
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_UTILS_MASK_H */
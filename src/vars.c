@@ -0,0 +1,710 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "arena.h"
+#include "log.h"
+#include "vars.h"
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+/* spins of a snapshot read before yielding to a preempted publisher */
+#define SNAPSHOT_SPINS 64
+
+/* records are stored in chunks where chunk k holds var_chunk_min << k
+ * records, so the registry grows geometrically without moving existing
+ * records (refresh sets and the server thread holds pointers to them) */
+#define VAR_MAX_CHUNKS 32
+static const size_t var_chunk_min = 64;
+
+static struct var* chunks[VAR_MAX_CHUNKS] = {NULL,};
+static size_t num_vars = 0;
+static struct arena strings = ARENA_INITIALIZER;
+static unsigned int layout = 0;
+
+/* slots of removed variables, reused last in first out */
+static size_t* free_slots = NULL;
+static size_t free_n = 0;
+static size_t free_alloc = 0;
+static size_t created_slot = 0;                /* slot of the record from var_create() */
+
+/* names are interned and reference counted by the variables sharing them */
+struct name {
+	unsigned int refs;
+	char str[];
+};
+
+/* name index: open addressing with linear probing, slots hold the handle
+ * (0 is empty) and the name hash so most mismatches are rejected without
+ * touching the record */
+struct name_slot {
+	uint32_t hash;
+	tweak_handle handle;
+};
+
+static struct name_slot* names = NULL;
+static size_t names_mask = 0;                  /* capacity - 1, capacity is a power of two */
+static size_t names_used = 0;
+static size_t names_shared = 0;                /* live variables with a name already indexed */
+static const size_t names_min_capacity = 256;
+
+/* handles sorted by name for prefix lookups, updated lazily with variables
+ * registered since the last lookup (unsorted). Removed variables are left in
+ * place until the next lookup (stale). If unsorted cannot grow the handles are
+ * rebuilt from scratch instead. */
+static tweak_handle* sorted = NULL;
+static size_t sorted_n = 0;
+static size_t sorted_alloc = 0;
+static tweak_handle* unsorted = NULL;
+static size_t unsorted_n = 0;
+static size_t unsorted_alloc = 0;
+static int sorted_stale = 0;
+static int sorted_rebuild = 0;
+
+/**
+ * Locate record by index, the chunk holding it may not be allocated yet.
+ *
+ * @return chunk number.
+ */
+static unsigned int var_locate(size_t index, size_t* offset){
+	const size_t k = index / var_chunk_min + 1;
+	const unsigned int chunk = sizeof(unsigned long) * CHAR_BIT - 1 - __builtin_clzl(k);
+	*offset = index - var_chunk_min * ((1UL << chunk) - 1);
+	return chunk;
+}
+
+/**
+ * FNV-1a
+ */
+static uint32_t var_hash(const char* name){
+	uint32_t hash = 2166136261u;
+	for ( const unsigned char* c = (const unsigned char*)name; *c; c++ ){
+		hash ^= *c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Find slot holding name or the empty slot where it should be inserted.
+ */
+static struct name_slot* var_probe(const char* name, uint32_t hash){
+	for ( size_t i = hash & names_mask; ; i = (i + 1) & names_mask ){
+		struct name_slot* slot = &names[i];
+		if ( slot->handle == 0 ){
+			return slot;
+		}
+		if ( slot->hash == hash && strcmp(var_get(VAR_INDEX(slot->handle))->name, name) == 0 ){
+			return slot;
+		}
+	}
+}
+
+/**
+ * Grow name index so n more names can be added without exceeding 3/4 load.
+ *
+ * @return zero if successful.
+ */
+static int var_index_reserve(size_t n){
+	const size_t capacity = names ? names_mask + 1 : 0;
+	if ( (names_used + n) * 4 <= capacity * 3 ){
+		return 0;
+	}
+
+	size_t grown = capacity > 0 ? capacity * 2 : names_min_capacity;
+	while ( (names_used + n) * 4 > grown * 3 ){
+		grown *= 2;
+	}
+	struct name_slot* tmp = calloc(grown, sizeof(struct name_slot));
+	if ( !tmp ){
+		return 1;
+	}
+
+	struct name_slot* old = names;
+	names = tmp;
+	names_mask = grown - 1;
+	for ( size_t i = 0; i < capacity; i++ ){
+		if ( old[i].handle == 0 ) continue;
+		size_t j = old[i].hash & names_mask;
+		while ( names[j].handle != 0 ){
+			j = (j + 1) & names_mask;
+		}
+		names[j] = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+/**
+ * Insert handle into name index, room must be reserved.
+ */
+static void var_index_insert(uint32_t hash, tweak_handle handle){
+	size_t i = hash & names_mask;
+	while ( names[i].handle != 0 ){
+		i = (i + 1) & names_mask;
+	}
+	names[i].hash = hash;
+	names[i].handle = handle;
+	names_used++;
+}
+
+/**
+ * Remove slot from name index. Following slots are shifted back so probing
+ * never stops early at the hole.
+ */
+static void var_index_erase(struct name_slot* slot){
+	size_t hole = slot - names;
+	for ( size_t i = (hole + 1) & names_mask; names[i].handle != 0; i = (i + 1) & names_mask ){
+		/* an entry may fill the hole unless its home is between the hole and it */
+		const size_t home = names[i].hash & names_mask;
+		const int keep = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+		if ( keep ) continue;
+
+		names[hole] = names[i];
+		hole = i;
+	}
+	names[hole].handle = 0;
+	names_used--;
+}
+
+/**
+ * Strings in the arena are only const to readers.
+ */
+static char* var_mutable(const char* str){
+	return (char*)(uintptr_t)str;
+}
+
+static struct name* var_name(const char* str){
+	return (struct name*)(var_mutable(str) - offsetof(struct name, str));
+}
+
+static char* var_name_alloc(const char* str){
+	const size_t len = strlen(str) + 1;
+	struct name* name = arena_alloc(&strings, sizeof(struct name) + len, sizeof(unsigned int));
+	if ( !name ){
+		return NULL;
+	}
+	name->refs = 1;
+	memcpy(name->str, str, len);
+	return name->str;
+}
+
+static void var_name_unref(const char* str){
+	struct name* name = var_name(str);
+	if ( --name->refs == 0 ){
+		arena_release(&strings, name, sizeof(struct name) + strlen(str) + 1);
+	}
+}
+
+/**
+ * Ensure array can hold n handles.
+ *
+ * @return zero if successful.
+ */
+static int var_reserve_handles(tweak_handle** array, size_t* alloc, size_t n){
+	if ( n <= *alloc ){
+		return 0;
+	}
+	tweak_handle* tmp = realloc(*array, sizeof(tweak_handle) * n);
+	if ( !tmp ){
+		return 1;
+	}
+	*array = tmp;
+	*alloc = n;
+	return 0;
+}
+
+/**
+ * Allocate chunks for slots up to (not including) end.
+ *
+ * @return zero if successful.
+ */
+static int var_reserve_chunks(size_t end){
+	if ( end == 0 ){
+		return 0;
+	}
+
+	size_t offset;
+	const unsigned int last = var_locate(end - 1, &offset);
+	if ( last >= VAR_MAX_CHUNKS || end > VAR_SLOT_MASK ){
+		logmsg("Too many variables registered\n");
+		return 1;
+	}
+
+	for ( unsigned int chunk = 0; chunk <= last; chunk++ ){
+		if ( chunks[chunk] ) continue;
+
+		chunks[chunk] = malloc(sizeof(struct var) * (var_chunk_min << chunk));
+		if ( !chunks[chunk] ){
+			logmsg("malloc() failed: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int var_reserve(size_t n){
+	const size_t appended = n > free_n ? n - free_n : 0;
+	if ( var_reserve_chunks(num_vars + appended) != 0 ){
+		return 1;
+	}
+
+	if ( var_index_reserve(n) != 0 || var_reserve_handles(&unsorted, &unsorted_alloc, unsorted_n + n) != 0 ){
+		logmsg("malloc() failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+static struct var* var_create_ex(const char* name, int borrowed, size_t size, void* ptr, datatype_t datatype){
+	/* nothing is registered when turned off, callers get handle 0 */
+	if ( tweak_disabled() ){
+		return NULL;
+	}
+
+	/* the slot is only taken from the free list by var_add() */
+	const size_t index = free_n > 0 ? free_slots[free_n - 1] : num_vars;
+	size_t offset;
+	const unsigned int chunk = var_locate(index, &offset);
+	if ( chunk >= VAR_MAX_CHUNKS || index >= VAR_SLOT_MASK ){
+		logmsg("Too many variables registered\n");
+		return NULL;
+	}
+
+	if ( !chunks[chunk] ){
+		chunks[chunk] = malloc(sizeof(struct var) * (var_chunk_min << chunk));
+		if ( !chunks[chunk] ){
+			logmsg("malloc() failed: %s\n", strerror(errno));
+			return NULL;
+		}
+	}
+
+	if ( var_index_reserve(1) != 0 ){
+		logmsg("malloc() failed: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	/* names are interned, a variable with the same name shares the string
+	 * unless either name is borrowed */
+	const uint32_t hash = var_hash(name);
+	const struct name_slot* slot = var_probe(name, hash);
+	const struct var* shared = slot->handle ? var_get(VAR_INDEX(slot->handle)) : NULL;
+	if ( borrowed || (shared && (shared->borrowed & VAR_BORROWED_NAME)) ){
+		shared = NULL;
+	}
+
+	/* a reused record keeps its handle until var_add() as it holds the
+	 * generation of the slot */
+	struct var* var = &chunks[chunk][offset];
+	if ( index == num_vars ){
+		__atomic_store_n(&var->handle, 0, __ATOMIC_RELAXED);
+		var->live = 0;
+	}
+	var->hash = hash;
+	var->name = borrowed ? name : shared ? shared->name : var_name_alloc(name);
+	var->description = NULL;
+	var->options = NULL;
+	var->borrowed = borrowed ? VAR_BORROWED_NAME : 0;
+	var->group = NULL;
+	var->size = size;
+	var->ptr = ptr;
+	var->ownership = 0;
+	var->datatype = datatype;
+	var->store = NULL;
+	var->load = NULL;
+	var->pack = NULL;
+	var->unpack = NULL;
+	var->update = default_trigger;
+	var->staged = 0;
+	var->seq = 0;
+	var->published = 0;
+
+	if ( !var->name ){
+		logmsg("malloc() failed: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	if ( shared ){
+		var_name(var->name)->refs++;
+	}
+
+	created_slot = index;
+	return var;
+}
+
+struct var* var_create(const char* name, size_t size, void* ptr, datatype_t datatype){
+	return var_create_ex(name, 0, size, ptr, datatype);
+}
+
+struct var* var_create_static(const char* name, size_t size, void* ptr, datatype_t datatype){
+	return var_create_ex(name, 1, size, ptr, datatype);
+}
+
+tweak_handle var_add(struct var* var){
+	/* handle is slot + 1 so user will see 1 as the first handle (on purpose).
+	 * A reused slot gets the next generation, it wraps after 128 reuses. */
+	const size_t index = created_slot;
+	const int reused = index < num_vars;
+	const tweak_handle generation = reused ? (((var->handle >> VAR_SLOT_BITS) + 1) & VAR_GENERATION_MASK) << VAR_SLOT_BITS : 0;
+	__atomic_store_n(&var->handle, generation | (tweak_handle)(index + 1), __ATOMIC_RELAXED);
+
+	/* room was reserved by var_create(), duplicate names keep the first */
+	struct name_slot* slot = var_probe(var->name, var->hash);
+	if ( slot->handle == 0 ){
+		slot->hash = var->hash;
+		slot->handle = var->handle;
+		names_used++;
+	} else {
+		names_shared++;
+	}
+
+	if ( unsorted_n == unsorted_alloc ){
+		const size_t alloc = unsorted_alloc > 0 ? unsorted_alloc * 2 : 64;
+		tweak_handle* tmp = realloc(unsorted, sizeof(tweak_handle) * alloc);
+		if ( tmp ){
+			unsorted = tmp;
+			unsorted_alloc = alloc;
+		}
+	}
+	if ( unsorted_n < unsorted_alloc ){
+		unsorted[unsorted_n++] = var->handle;
+	} else {
+		sorted_rebuild = 1;
+	}
+
+	/* publish the record only after it has been filled in as the server thread
+	 * may be iterating the registry */
+	__atomic_store_n(&var->live, 1, __ATOMIC_RELEASE);
+	if ( reused ){
+		free_n--;
+		__atomic_add_fetch(&layout, 1, __ATOMIC_RELEASE);
+	} else {
+		__atomic_store_n(&num_vars, num_vars + 1, __ATOMIC_RELEASE);
+	}
+	return var->handle;
+}
+
+struct var* var_from_handle(tweak_handle handle){
+	const size_t index = VAR_INDEX(handle);
+	if ( (handle & VAR_SLOT_MASK) == 0 || index >= var_count() ) return NULL;
+
+	struct var* var = var_get(index);
+	if ( !var_live(var) || __atomic_load_n(&var->handle, __ATOMIC_RELAXED) != handle ){
+		return NULL;
+	}
+	return var;
+}
+
+void var_retire(struct var* var){
+	__atomic_store_n(&var->live, 0, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&layout, 1, __ATOMIC_RELEASE);
+}
+
+void var_release(struct var* var){
+	if ( var->ownership ){
+		free(var->ptr);
+		var->ownership = 0;
+	}
+	var->ptr = NULL;
+	if ( !(var->borrowed & VAR_BORROWED_DESCRIPTION) ){
+		var_strfree(var->description);
+	}
+	if ( !(var->borrowed & VAR_BORROWED_OPTIONS) ){
+		var_strfree(var->options);
+	}
+	var->description = NULL;
+	var->options = NULL;
+
+	/* if the index refers to this variable another variable with the same name
+	 * (the lowest slot) takes its place, variables are only scanned if any
+	 * name is shared */
+	struct name_slot* slot = var_probe(var->name, var->hash);
+	if ( slot->handle != var->handle ){
+		names_shared--;
+	} else {
+		var_index_erase(slot);
+
+		const size_t n = num_vars;
+		for ( size_t i = 0; names_shared > 0 && i < n; i++ ){
+			const struct var* it = var_get(i);
+			if ( it != var && var_live(it) && it->hash == var->hash && strcmp(it->name, var->name) == 0 ){
+				var_index_insert(it->hash, it->handle);
+				names_shared--;
+				break;
+			}
+		}
+	}
+	if ( !(var->borrowed & VAR_BORROWED_NAME) ){
+		var_name_unref(var->name);
+	}
+	var->name = NULL;
+	var->borrowed = 0;
+	sorted_stale = 1;
+
+	/* if the slot cannot be pushed it is never reused */
+	if ( free_n == free_alloc ){
+		const size_t alloc = free_alloc > 0 ? free_alloc * 2 : 64;
+		size_t* tmp = realloc(free_slots, sizeof(size_t) * alloc);
+		if ( !tmp ){
+			logmsg("malloc() failed: %s\n", strerror(errno));
+			return;
+		}
+		free_slots = tmp;
+		free_alloc = alloc;
+	}
+	free_slots[free_n++] = var_index(var);
+}
+
+struct var* var_get(size_t index){
+	size_t offset;
+	const unsigned int chunk = var_locate(index, &offset);
+	return &chunks[chunk][offset];
+}
+
+size_t var_count(){
+	return __atomic_load_n(&num_vars, __ATOMIC_ACQUIRE);
+}
+
+void var_publish(struct var* var){
+	/* larger values have no room for a snapshot and are read directly */
+	if ( var->size > sizeof(var->snapshot) ){
+		return;
+	}
+
+	const unsigned int seq = __atomic_load_n(&var->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&var->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&var->snapshot, var->ptr, var->size);
+	__atomic_store_n(&var->seq, seq + 2, __ATOMIC_RELEASE);
+
+	if ( !var->published ){
+		__atomic_store_n(&var->published, 1, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&layout, 1, __ATOMIC_RELEASE);
+	}
+}
+
+const struct var* var_snapshot(const struct var* var, struct var* tmp, union var_value* value){
+	if ( !var_published(var) ){
+		return var;
+	}
+
+	/* the writer never blocks, a read overlapping a publish is retried. A
+	 * publish is only a few instructions so a retry rarely fails, unless the
+	 * publishing thread was preempted midway and the CPU is yielded to it. */
+	for ( unsigned int spins = 1;; spins++ ){
+		const unsigned int seq = __atomic_load_n(&var->seq, __ATOMIC_ACQUIRE);
+		if ( !(seq & 1) ){
+			memcpy(value, &var->snapshot, var->size);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if ( __atomic_load_n(&var->seq, __ATOMIC_RELAXED) == seq ){
+				break;
+			}
+		}
+
+		if ( spins % SNAPSHOT_SPINS == 0 ){
+			sched_yield();
+		} else {
+			cpu_relax();
+		}
+	}
+
+	*tmp = *var;
+	tmp->ptr = value;
+	return tmp;
+}
+
+unsigned int var_layout(){
+	return __atomic_load_n(&layout, __ATOMIC_ACQUIRE);
+}
+
+tweak_handle var_find(const char* name){
+	if ( !names ) return 0;
+	return var_probe(name, var_hash(name))->handle;
+}
+
+static int var_compare_name(const void* a, const void* b){
+	const size_t i = VAR_INDEX(*(const tweak_handle*)a);
+	const size_t j = VAR_INDEX(*(const tweak_handle*)b);
+	const int cmp = strcmp(var_get(i)->name, var_get(j)->name);
+	if ( cmp != 0 ) return cmp;
+
+	/* stable so duplicate names are listed by slot (order of registration
+	 * unless slots have been reused) */
+	return i < j ? -1 : i > j;
+}
+
+/**
+ * Drop handles of removed variables.
+ */
+static size_t var_compact(tweak_handle* handles, size_t n){
+	size_t kept = 0;
+	for ( size_t i = 0; i < n; i++ ){
+		if ( var_from_handle(handles[i]) ){
+			handles[kept++] = handles[i];
+		}
+	}
+	return kept;
+}
+
+/**
+ * Add variables registered since last call to the sorted handles. New handles
+ * are sorted by themselves and merged with the existing.
+ *
+ * @return zero if successful.
+ */
+static int var_sort(){
+	if ( sorted_rebuild ){
+		const size_t n = num_vars;
+		if ( var_reserve_handles(&unsorted, &unsorted_alloc, n) != 0 ){
+			return 1;
+		}
+		unsorted_n = 0;
+		for ( size_t i = 0; i < n; i++ ){
+			const struct var* var = var_get(i);
+			if ( var_live(var) ){
+				unsorted[unsorted_n++] = var->handle;
+			}
+		}
+		sorted_n = 0;
+		sorted_stale = 0;
+		sorted_rebuild = 0;
+	}
+
+	if ( sorted_stale ){
+		sorted_n = var_compact(sorted, sorted_n);
+		unsorted_n = var_compact(unsorted, unsorted_n);
+		sorted_stale = 0;
+	}
+
+	if ( unsorted_n == 0 ){
+		return 0;
+	}
+
+	const size_t n = sorted_n + unsorted_n;
+	if ( n > sorted_alloc && var_reserve_handles(&sorted, &sorted_alloc, n * 2) != 0 ){
+		return 1;
+	}
+
+	/* new handles are sorted by themselves and merged backwards */
+	qsort(unsorted, unsorted_n, sizeof(tweak_handle), var_compare_name);
+
+	size_t a = sorted_n;
+	size_t b = unsorted_n;
+	size_t dst = n;
+	while ( b > 0 ){
+		if ( a > 0 && var_compare_name(&sorted[a - 1], &unsorted[b - 1]) > 0 ){
+			sorted[--dst] = sorted[--a];
+		} else {
+			sorted[--dst] = unsorted[--b];
+		}
+	}
+
+	sorted_n = n;
+	unsorted_n = 0;
+	return 0;
+}
+
+size_t var_find_prefix(const char* prefix, tweak_handle* handles, size_t max){
+	if ( var_sort() != 0 ){
+		logmsg("malloc() failed: %s\n", strerror(errno));
+		return 0;
+	}
+
+	/* binary search for the first name not less than prefix */
+	const size_t len = strlen(prefix);
+	size_t lo = 0;
+	size_t hi = sorted_n;
+	while ( lo < hi ){
+		const size_t mid = lo + (hi - lo) / 2;
+		if ( strcmp(var_get(VAR_INDEX(sorted[mid]))->name, prefix) < 0 ){
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	size_t found = 0;
+	for ( size_t i = lo; i < sorted_n; i++, found++ ){
+		const tweak_handle handle = sorted[i];
+		if ( strncmp(var_get(VAR_INDEX(handle))->name, prefix, len) != 0 ) break;
+		if ( found < max ){
+			handles[found] = handle;
+		}
+	}
+
+	return found;
+}
+
+char* var_strdup(const char* str){
+	return arena_strdup(&strings, str);
+}
+
+void var_strfree(const char* str){
+	if ( str ){
+		arena_release(&strings, var_mutable(str), strlen(str) + 1);
+	}
+}
+
+
+size_t var_memory(){
+	size_t bytes = strings.allocated;
+	bytes += names ? sizeof(struct name_slot) * (names_mask + 1) : 0;
+	for ( size_t i = 0; i < VAR_MAX_CHUNKS && chunks[i]; i++ ){
+		bytes += sizeof(struct var) * (var_chunk_min << i);
+	}
+	return bytes;
+}
+
+void var_cleanup(){
+	for ( size_t i = 0; i < num_vars; i++ ){
+		struct var* var = var_get(i);
+		if ( var->ownership ){
+			free(var->ptr);
+		}
+	}
+
+	for ( size_t i = 0; i < VAR_MAX_CHUNKS; i++ ){
+		free(chunks[i]);
+		chunks[i] = NULL;
+	}
+
+	free(names);
+	names = NULL;
+	names_mask = 0;
+	names_used = 0;
+	names_shared = 0;
+
+	free(sorted);
+	sorted = NULL;
+	sorted_n = 0;
+	sorted_alloc = 0;
+	free(unsorted);
+	unsorted = NULL;
+	unsorted_n = 0;
+	unsorted_alloc = 0;
+	sorted_stale = 0;
+	sorted_rebuild = 0;
+
+	free(free_slots);
+	free_slots = NULL;
+	free_n = 0;
+	free_alloc = 0;
+
+	num_vars = 0;
+	layout++;
+	arena_free(&strings);
+}
@@ -1,10 +1,18 @@
 #ifndef TWEAKLIB_VARS_H
 #define TWEAKLIB_VARS_H
 
-#include "list.h"
+#include "group.h"
 #include "tweak/tweak.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 struct var;
+struct json_object;
+struct json_writer;
 
 typedef enum {
 	DATATYPE_INTEGER = 1,
@@ -18,14 +26,48 @@ typedef enum {
 } datatype_t;
 
 typedef void(*update_callback)(tweak_handle handle);
-typedef struct json_object* (*store_callback)(const struct var*);
+typedef void (*store_callback)(const struct var*, struct json_writer*);
 typedef void (*load_callback)(struct var*, struct json_object*);
 
+/* binary protocol: values are packed little-endian, the size is given by the
+ * datatype. unpack returns the number of bytes consumed or 0 if src is too
+ * short. */
+#define VAR_PACKED_MAX 8
+typedef size_t (*pack_callback)(const struct var*, char dst[VAR_PACKED_MAX]);
+typedef size_t (*unpack_callback)(struct var*, const char* src, size_t size);
+
+/* copy of a value of any datatype (at most VAR_PACKED_MAX bytes) */
+union var_value {
+	int i;
+	float f;
+	double d;
+	char bytes[VAR_PACKED_MAX];
+};
+
+/* handles hold the slot (index + 1) in the low bits and the generation of the
+ * slot in the high bits, so a handle to a removed variable is not mistaken
+ * for a later variable reusing the slot. The top bit is unused so handles are
+ * positive when sent as JSON integers. */
+#define VAR_SLOT_BITS 24
+#define VAR_SLOT_MASK ((1u << VAR_SLOT_BITS) - 1)
+#define VAR_GENERATION_MASK 0x7fu
+#define VAR_INDEX(handle) (((handle) & VAR_SLOT_MASK) - 1)
+
+/* strings the variable does not own and must not release, either owned by the
+ * user or shared between variables */
+#define VAR_BORROWED_NAME        0x1
+#define VAR_BORROWED_DESCRIPTION 0x2
+#define VAR_BORROWED_OPTIONS     0x4
+
 struct var {
-	tweak_handle handle;
-	char* name;
-	char* description;
-	char* options;
+	tweak_handle handle;                  /* kept when removed, see var_live() */
+	int live;                             /* zero when removed (or not yet added) */
+	uint32_t hash;                        /* hash of name */
+	const char* name;                     /* interned, shared by variables with the same name */
+	const char* description;
+	const char* options;                  /* encoded JSON */
+	unsigned int borrowed;                /* VAR_BORROWED_* */
+	const struct group* group;            /* NULL for the root group */
 	size_t size;
 	void* ptr;
 	int ownership;
@@ -33,15 +75,165 @@ struct var {
 
 	store_callback store;
 	load_callback load;
+	pack_callback pack;                   /* optional */
+	unpack_callback unpack;               /* optional */
 	update_callback update;
-};
+	unsigned int staged;                  /* updates being applied by tweak_sync() */
 
-extern list_t vars;
+	/* seqlock protecting the snapshot, odd while tweak_publish() copies the
+	 * value. Once published the server reads the snapshot instead of ptr. */
+	unsigned int seq;
+	int published;
+	union var_value snapshot;
+};
 
+/**
+ * Create a record for a new variable, it is not visible until var_add() is
+ * called. Only one variable may be created at a time. Slots of removed
+ * variables are reused before the registry grows.
+ *
+ * @return record or NULL if the registry is full or malloc() failed.
+ */
 struct var* var_create(const char* name, size_t size, void* ptr, datatype_t datatype);
+
+/**
+ * Same as var_create() but the name is borrowed (not copied) and must stay
+ * valid until the variable is removed.
+ */
+struct var* var_create_static(const char* name, size_t size, void* ptr, datatype_t datatype);
 tweak_handle var_add(struct var* var);
+
+/**
+ * Make room for registering n more variables so var_create() does not need
+ * to allocate (except for copying names).
+ *
+ * @return zero if successful.
+ */
+int var_reserve(size_t n);
+
+/**
+ * @return variable or NULL if the handle is invalid or the variable has been
+ *         removed.
+ */
 struct var* var_from_handle(tweak_handle handle);
 
+/**
+ * Mark variable as removed. Readers skip it from now on but the record (and
+ * the memory it refers to) stays valid until var_release(). Bumps the layout
+ * version.
+ */
+void var_retire(struct var* var);
+
+/**
+ * Release a retired variable: owned memory and strings are freed, it is
+ * removed from the name index and its slot is reused by a later variable.
+ * Nothing may refer to the variable afterwards, i.e. the server thread must be
+ * done with it.
+ */
+void var_release(struct var* var);
+
+/**
+ * Registered variables are indexed by VAR_INDEX(handle) and records never move
+ * so pointers to them stay valid until var_cleanup(). Safe to call from any
+ * thread, variables registered concurrently may or may not be counted. Slots
+ * of removed variables are still counted, use var_live() to skip them.
+ */
+size_t var_count();
+struct var* var_get(size_t index);
+
+/**
+ * Safe to call from any thread, the rest of the record is only valid to read
+ * if the variable is live.
+ */
+static inline int var_live(const struct var* var){
+	return __atomic_load_n(&var->live, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Index of the variable, constant for the lifetime of the record even if the
+ * slot is reused so it is safe to read from any thread.
+ */
+static inline size_t var_index(const struct var* var){
+	return VAR_INDEX(__atomic_load_n(&var->handle, __ATOMIC_RELAXED));
+}
+
+/**
+ * Non-zero if the value is read from the snapshot (see var_publish()). Safe to
+ * call from any thread.
+ */
+static inline int var_published(const struct var* var){
+	return __atomic_load_n(&var->published, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Copy the current value into the snapshot of the variable. Must only be
+ * called from one thread at a time (the one writing the value). The first
+ * publish bumps the layout version as the value moves to the snapshot.
+ */
+void var_publish(struct var* var);
+
+/**
+ * Record to read a consistent value from, var itself unless it is published.
+ * For published variables a copy of the snapshot is read into value (retrying
+ * while it is being published) and tmp is set up as a copy of var pointing to
+ * it. Called from the server thread.
+ */
+const struct var* var_snapshot(const struct var* var, struct var* tmp, union var_value* value);
+
+/**
+ * Version which changes whenever a variable is removed, a slot is reused or
+ * a variable is published the first time, i.e. anything caching the set of
+ * variables by index or the location of values must be rebuilt. Safe to call
+ * from any thread.
+ */
+unsigned int var_layout();
+
+/**
+ * Find variable by name using the name index. If several variables has the
+ * same name the first registered is found.
+ *
+ * @return handle or 0 if not found.
+ */
+tweak_handle var_find(const char* name);
+
+/**
+ * Find variables whose name starts with prefix, see tweak_find_prefix().
+ */
+size_t var_find_prefix(const char* prefix, tweak_handle* handles, size_t max);
+
+/**
+ * Copy a string (description or options) into the registry string arena.
+ * Strings are released by var_strfree() or var_cleanup().
+ */
+char* var_strdup(const char* str);
+void var_strfree(const char* str);
+
+/**
+ * Bytes allocated for records and strings.
+ */
+size_t var_memory();
+
+/**
+ * Release all variables.
+ */
+void var_cleanup();
+
 void default_trigger(tweak_handle handle);
 
+/**
+ * Non-zero if the library is turned off at runtime (see tweak_init_args()).
+ */
+int tweak_disabled();
+
+/**
+ * Set the callbacks of a datatype on a record from var_create().
+ */
+void var_setup_int(struct var* var);
+void var_setup_float(struct var* var);
+void var_setup_double(struct var* var);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* TWEAKLIB_VARS_H */
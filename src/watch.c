@@ -0,0 +1,239 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "watch.h"
+#include "vars.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* variables adjacent in memory are compared as a single run, limited so a
+ * change only requires a small part to be compared again per variable */
+#define RUN_MAX 256
+
+struct entry {
+	const char* ptr;                      /* live value */
+	size_t size;
+	size_t offset;                        /* position in shadow copy */
+	struct var* var;
+	tweak_handle handle;
+};
+
+struct run {
+	const char* ptr;
+	size_t size;
+	size_t offset;
+	size_t first;                         /* index of first entry */
+	size_t count;
+};
+
+static struct entry* entries = NULL;
+static size_t num_entries = 0;
+static size_t num_slots = 0;                  /* registry slots watched so far */
+static unsigned int layout = 0;               /* var_layout() the entries were built from */
+static size_t alloc_entries = 0;
+static struct run* runs = NULL;
+static size_t num_runs = 0;
+static size_t alloc_runs = 0;
+static char* shadow = NULL;
+static size_t shadow_size = 0;
+static size_t shadow_alloc = 0;
+
+/**
+ * Append entry to the last run if it directly follows it in memory, otherwise
+ * start a new run.
+ *
+ * @return zero if successful.
+ */
+static int watch_add_run(const struct entry* entry, size_t index){
+	struct run* last = num_runs > 0 ? &runs[num_runs - 1] : NULL;
+	if ( last && last->ptr + last->size == entry->ptr && last->size + entry->size <= RUN_MAX ){
+		last->size += entry->size;
+		last->count++;
+		return 0;
+	}
+
+	if ( num_runs == alloc_runs ){
+		const size_t alloc = alloc_runs > 0 ? alloc_runs * 2 : 64;
+		struct run* tmp = realloc(runs, sizeof(struct run) * alloc);
+		if ( !tmp ){
+			return 1;
+		}
+		runs = tmp;
+		alloc_runs = alloc;
+	}
+
+	struct run* run = &runs[num_runs++];
+	run->ptr = entry->ptr;
+	run->size = entry->size;
+	run->offset = entry->offset;
+	run->first = index;
+	run->count = 1;
+	return 0;
+}
+
+/**
+ * Add variables registered since the last scan. If memory cannot be allocated
+ * the remaining variables are added by a later scan.
+ */
+static void watch_add_new(){
+	const size_t n = var_count();
+	for ( ; num_slots < n; num_slots++ ){
+		struct var* var = var_get(num_slots);
+		if ( !var_live(var) ) continue;
+
+		if ( num_entries == alloc_entries ){
+			const size_t alloc = alloc_entries > 0 ? alloc_entries * 2 : 64;
+			struct entry* tmp = realloc(entries, sizeof(struct entry) * alloc);
+			if ( !tmp ){
+				return;
+			}
+			entries = tmp;
+			alloc_entries = alloc;
+		}
+
+		if ( shadow_size + var->size > shadow_alloc ){
+			size_t alloc = shadow_alloc > 0 ? shadow_alloc : 1024;
+			while ( alloc < shadow_size + var->size ){
+				alloc *= 2;
+			}
+			char* tmp = realloc(shadow, alloc);
+			if ( !tmp ){
+				return;
+			}
+			shadow = tmp;
+			shadow_alloc = alloc;
+		}
+
+		/* published variables only change when published, the snapshot is
+		 * compared instead (the layout changes when first published) */
+		struct entry* entry = &entries[num_entries];
+		entry->ptr = var_published(var) ? var->snapshot.bytes : var->ptr;
+		entry->size = var->size;
+		entry->offset = shadow_size;
+		entry->var = var;
+		entry->handle = var->handle;
+		if ( watch_add_run(entry, num_entries) != 0 ){
+			return;
+		}
+		memcpy(shadow + shadow_size, entry->ptr, var->size);
+		shadow_size += var->size;
+		num_entries++;
+	}
+}
+
+/**
+ * Rebuild all entries after variables has been removed or slots reused.
+ * Variables still present keep their previous copy so changes made since the
+ * last scan are reported.
+ */
+static void watch_rebuild(){
+	struct entry* old = entries;
+	const size_t old_n = num_entries;
+	char* old_shadow = shadow;
+
+	entries = NULL;
+	num_entries = 0;
+	alloc_entries = 0;
+	num_slots = 0;
+	num_runs = 0;
+	shadow = NULL;
+	shadow_size = 0;
+	shadow_alloc = 0;
+	watch_add_new();
+
+	/* both old and new entries are ordered by slot */
+	size_t j = 0;
+	for ( size_t i = 0; i < num_entries; i++ ){
+		const struct entry* entry = &entries[i];
+		while ( j < old_n && VAR_INDEX(old[j].handle) < VAR_INDEX(entry->handle) ){
+			j++;
+		}
+		if ( j < old_n && old[j].handle == entry->handle ){
+			memcpy(shadow + entry->offset, old_shadow + old[j].offset, entry->size);
+		}
+	}
+
+	free(old);
+	free(old_shadow);
+}
+
+/**
+ * Compare a live value against its copy. Most variables are a single word and
+ * compared directly, larger ones use memcmp() which is vectorized by libc.
+ */
+static int equal(const void* live, const void* copy, size_t size){
+	switch ( size ){
+	case sizeof(uint32_t):
+		{
+			uint32_t a, b;
+			memcpy(&a, live, sizeof(uint32_t));
+			memcpy(&b, copy, sizeof(uint32_t));
+			return a == b;
+		}
+	case sizeof(uint64_t):
+		{
+			uint64_t a, b;
+			memcpy(&a, live, sizeof(uint64_t));
+			memcpy(&b, copy, sizeof(uint64_t));
+			return a == b;
+		}
+	default:
+		return memcmp(live, copy, size) == 0;
+	}
+}
+
+size_t watch_scan(struct dirty* dirty){
+	size_t changed = 0;
+
+	/* removed variables might have their memory freed so the entries must be
+	 * rebuilt before anything is compared */
+	const unsigned int current = var_layout();
+	if ( current != layout ){
+		watch_rebuild();
+		layout = current;
+	}
+
+	/* values are compared bitwise, e.g. a NaN is unchanged if the bits are.
+	 * Only runs with changes are compared again per variable. */
+	for ( const struct run* run = runs; run < runs + num_runs; run++ ){
+		if ( equal(run->ptr, shadow + run->offset, run->size) ) continue;
+
+		for ( size_t i = run->first; i < run->first + run->count; i++ ){
+			const struct entry* entry = &entries[i];
+			char* copy = shadow + entry->offset;
+			if ( equal(entry->ptr, copy, entry->size) ) continue;
+
+			memcpy(copy, entry->ptr, entry->size);
+			dirty_mark(dirty, entry->var);
+			changed++;
+		}
+	}
+
+	/* clients learn about new variables from the hello message so they are not
+	 * reported */
+	watch_add_new();
+
+	return changed;
+}
+
+size_t watch_size(){
+	return shadow_size;
+}
+
+void watch_cleanup(){
+	free(entries);
+	free(runs);
+	free(shadow);
+	entries = NULL;
+	num_entries = 0;
+	num_slots = 0;
+	alloc_entries = 0;
+	runs = NULL;
+	num_runs = 0;
+	alloc_runs = 0;
+	shadow = NULL;
+	shadow_size = 0;
+	shadow_alloc = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef TWEAKLIB_WATCH_H
+#define TWEAKLIB_WATCH_H
+
+/**
+ * Automatic change detection.
+ *
+ * A shadow copy of the values of all variables is kept in a single contiguous
+ * buffer (in registration order) and compared against the live values, so
+ * only variables which actually changed are refreshed. Variables registered
+ * since the last scan are added to the shadow copy without being reported.
+ * When variables are removed the shadow copy is rebuilt on the next scan.
+ *
+ * All functions must be called from the same thread (the server thread).
+ */
+
+#include "dirty.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Compare all variables against the shadow copy, changed variables are marked
+ * in dirty and the shadow copy updated.
+ *
+ * @return number of changed variables.
+ */
+size_t watch_scan(struct dirty* dirty);
+
+/**
+ * Number of bytes watched (size of the shadow copy).
+ */
+size_t watch_size();
+
+/**
+ * Release the shadow copy.
+ */
+void watch_cleanup();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_WATCH_H */
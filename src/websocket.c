@@ -2,28 +2,27 @@
 #include "config.h"
 #endif
 
-#include "list.h"
-#include "ipc.h"
+#include "client.h"
+#include "frame.h"
+#include "group.h"
 #include "log.h"
 #include "server.h"
+#include "staging.h"
 #include "utils/base64.h"
+#include "utils/json_writer.h"
+#include "utils/mask.h"
 #include "utils/sha1.h"
 #include "vars.h"
 #include "websocket.h"
+#include "wsdeflate.h"
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/socket.h>
+#include <endian.h>
 #include <json.h>
 
-static const size_t buffer_size = 16384;
-extern list_t vars;
-
 struct frame_header {
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 	uint8_t opcode:4;
@@ -49,151 +48,386 @@ enum {
 	OPCODE_PONG = 10,
 };
 
-static char* read16(int sd, char* buf, uint16_t* dst){
-	recv(sd, buf, sizeof(uint16_t), 0);
-	*dst = be16toh(*(const uint16_t*)buf);
-	return buf + sizeof(uint16_t);
-}
+static const size_t max_frame_size = 1024*1024;
+
+static const char* protocol_names[WEBSOCKET_NUM_PROTOCOLS] = {
+	"v1.tweaklib.sidvind.com",
+	"v1.binary.tweaklib.sidvind.com",
+};
+
+/* binary message types (first byte of payload) */
+enum {
+	BINARY_REFRESH = 1,
+	BINARY_UPDATE = 2,
+};
+
+static const size_t binary_record_header = sizeof(uint32_t) + sizeof(uint8_t);
+
+/* RSV1 marks a compressed message (permessage-deflate) */
+static const int res_compressed = 0x4;
+
+/* frame reader states */
+enum {
+	READ_HEADER = 0,
+	READ_PAYLOAD,
+};
 
-static char* read32_n(int sd, char* buf, uint32_t* dst){
-	recv(sd, buf, sizeof(uint32_t), 0);
-	*dst = *(const uint32_t*)buf;
-	return buf + sizeof(uint32_t);
+/**
+ * Append a single frame header for a payload of len bytes.
+ */
+static void frame_header_append(struct frame* frame, int fin, int res, int opcode, size_t len){
+	struct frame_header header;
+	header.fin = fin;
+	header.res = res;
+	header.opcode = opcode;
+	header.mask = 0;
+	header.plen1 = len < 126 ? len : (len <= UINT16_MAX ? 126 : 127);
+
+	frame_append(frame, &header, sizeof(struct frame_header));
+	if ( header.plen1 == 126 ){
+		uint16_t plen = htobe16(len);
+		frame_append(frame, &plen, sizeof(uint16_t));
+	} else if ( header.plen1 == 127 ){
+		uint64_t plen = htobe64(len);
+		frame_append(frame, &plen, sizeof(uint64_t));
+	}
 }
 
-static char* read64(int sd, char* buf, uint64_t* dst){
-	recv(sd, buf, sizeof(uint64_t), 0);
-	*dst = be64toh(*(const uint64_t*)buf);
-	return buf + sizeof(uint64_t);
+/**
+ * Encode a complete (unmasked) message. Messages larger than
+ * WEBSOCKET_MAX_FRAGMENT are split into continuation frames, all fragments are
+ * stored in the same output block so it is still sent with a single call.
+ */
+static struct frame* websocket_frame(int opcode, int compressed, const char* buffer, size_t len){
+	const size_t num_fragments = len > 0 ? (len + WEBSOCKET_MAX_FRAGMENT - 1) / WEBSOCKET_MAX_FRAGMENT : 1;
+	const size_t max_header = sizeof(struct frame_header) + sizeof(uint64_t);
+
+	struct frame* frame = frame_alloc(max_header * num_fragments + len);
+	if ( !frame ){
+		return NULL;
+	}
+
+	/* RSV1 is only set on the first fragment of a compressed message */
+	size_t offset = 0;
+	for ( size_t i = 0; i < num_fragments; i++ ){
+		const size_t size = len - offset < WEBSOCKET_MAX_FRAGMENT ? len - offset : WEBSOCKET_MAX_FRAGMENT;
+		const int first = i == 0;
+		const int last = i + 1 == num_fragments;
+		frame_header_append(frame, last, first && compressed ? res_compressed : 0, first ? opcode : OPCODE_CONTINUATION, size);
+		frame_append(frame, buffer + offset, size);
+		offset += size;
+	}
+
+	return frame;
 }
 
-static char* websocket_payload_size(int sd, char* ptr, const struct frame_header* header, size_t* size){
-	*size = header->plen1;
+enum {
+	SERIALIZE_SLIM = 0,
+	SERIALIZE_FULL = 1,                   /* include name, description etc */
+	SERIALIZE_GROUPS = 2,                 /* include list of all groups */
+};
 
-	if ( header->plen1 == 126 ){
-		uint16_t tmp;
-		ptr = read16(sd, ptr, &tmp);
-		*size = tmp;
+/* messages are serialized into this buffer (and compressed into the other)
+ * before being copied into a frame, only used by the server thread */
+static struct buffer scratch = BUFFER_INITIALIZER;
+static struct buffer deflate_scratch = BUFFER_INITIALIZER;
+
+/* received compressed messages are decompressed into this buffer */
+static struct buffer inflated = BUFFER_INITIALIZER;
+
+/* variables visible to a client (see websocket_visible()) */
+static struct var** visible = NULL;
+static size_t visible_alloc = 0;
+
+static void serialize_var(struct json_writer* w, const struct var* var, int mode){
+	json_write_begin_object(w);
+	if ( mode & SERIALIZE_FULL ){
+		json_write_key(w, "name");
+		json_write_string(w, var->name);
+		json_write_key(w, "group");
+		if ( var->group ){
+			json_write_string(w, var->group->name);
+		} else {
+			json_write_null(w);
+		}
+		json_write_key(w, "description");
+		if ( var->description ){
+			json_write_string(w, var->description);
+		} else {
+			json_write_null(w);
+		}
+		json_write_key(w, "options");
+		if ( var->options ){
+			json_write_raw(w, var->options, strlen(var->options));
+		} else {
+			json_write_null(w);
+		}
+		json_write_key(w, "datatype");
+		json_write_int(w, var->datatype);
 	}
+	json_write_key(w, "handle");
+	json_write_int(w, var->handle);
+	json_write_key(w, "value");
+	struct var tmp;
+	union var_value value;
+	var->store(var_snapshot(var, &tmp, &value), w);
+	json_write_end_object(w);
+}
 
-	if ( header->plen1 == 127 ){
-		uint64_t tmp;
-		ptr = read64(sd, ptr, &tmp);
-		*size = tmp;
+/**
+ * Serialize a message with a list of variables into the scratch buffer. If set
+ * is NULL all variables are serialized. Removed variables are skipped.
+ */
+static void serialize_message(const char* type, int mode, struct var* const set[], size_t n){
+	struct json_writer w;
+	buffer_clear(&scratch);
+	json_writer_init(&w, &scratch);
+
+	json_write_begin_object(&w);
+	json_write_key(&w, "vars");
+	json_write_begin_array(&w);
+	const size_t num = set ? n : var_count();
+	for ( size_t i = 0; i < num; i++ ){
+		const struct var* var = set ? set[i] : var_get(i);
+		if ( !var_live(var) ) continue;
+		serialize_var(&w, var, mode);
+	}
+	json_write_end_array(&w);
+	if ( mode & SERIALIZE_GROUPS ){
+		json_write_key(&w, "groups");
+		json_write_begin_array(&w);
+		for ( const struct group* it = group_first(); it; it = it->next ){
+			json_write_string(&w, it->name);
+		}
+		json_write_end_array(&w);
 	}
+	json_write_key(&w, "type");
+	json_write_string(&w, type);
+	json_write_end_object(&w);
+}
 
-	return ptr;
+/**
+ * Serialize a message telling which variables the client should no longer
+ * display into the scratch buffer.
+ */
+static void serialize_remove(struct var* const set[], size_t n){
+	struct json_writer w;
+	buffer_clear(&scratch);
+	json_writer_init(&w, &scratch);
+
+	json_write_begin_object(&w);
+	json_write_key(&w, "handles");
+	json_write_begin_array(&w);
+	for ( size_t i = 0; i < n; i++ ){
+		json_write_int(&w, set[i]->handle);
+	}
+	json_write_end_array(&w);
+	json_write_key(&w, "type");
+	json_write_string(&w, "remove");
+	json_write_end_object(&w);
 }
 
-static char* websocket_frame_masking_key(int sd, char* ptr, const struct frame_header* header, uint32_t* key){
-	if ( header->mask ){
-		return read32_n(sd, ptr, key);
-	} else {
-		*key = 0;
-		return ptr;
+/**
+ * Ensure the visible array can hold n variables.
+ *
+ * @return zero if successful.
+ */
+static int websocket_reserve_visible(size_t n){
+	if ( n <= visible_alloc ){
+		return 0;
+	}
+
+	size_t alloc = visible_alloc > 0 ? visible_alloc : 64;
+	while ( alloc < n ){
+		alloc *= 2;
 	}
+
+	struct var** tmp = realloc(visible, sizeof(struct var*) * alloc);
+	if ( !tmp ){
+		return 1;
+	}
+	visible = tmp;
+	visible_alloc = alloc;
+	return 0;
 }
 
-static char* websocket_frame_payload(int sd, char* ptr, size_t left, uint32_t masking_key){
-	char* begin = ptr;
+/**
+ * Filter set (NULL for all variables) by the groups the client is subscribed
+ * to. Clients subscribed to everything gets set back as-is, otherwise the
+ * visible variables are stored in the visible array and n updated.
+ */
+static struct var* const* websocket_visible(const struct client* client, struct var* const set[], size_t* n){
+	if ( client->subscription.all ){
+		return set;
+	}
 
-	/** @todo validate buffer size vs payload size */
-	while ( left > 0 ){
-		ssize_t bytes = recv(sd, ptr, left, 0);
-		if ( bytes <= 0 ) return NULL;
-		left -= bytes;
-		ptr += bytes;
+	const size_t num = set ? *n : var_count();
+	if ( websocket_reserve_visible(num + 1) != 0 ){
+		logmsg("%s [%d] - malloc() failed\n", client->peeraddr, client->id);
+		*n = 0;
+		return visible;
 	}
 
-	/* unmask if needed */
-	if ( masking_key ){
-		uint32_t* cur = (uint32_t*)(begin);
-		const uint32_t* end = (uint32_t*)(ptr + 4); /** @todo detect align to 4 */
-		while ( cur < end ){
-			*cur++ ^= masking_key;
+	size_t found = 0;
+	for ( size_t i = 0; i < num; i++ ){
+		struct var* var = set ? set[i] : var_get(i);
+		if ( var_live(var) && subscription_visible(&client->subscription, var->group) ){
+			visible[found++] = var;
 		}
 	}
 
-	return ptr;
+	*n = found;
+	return visible;
 }
 
-static int min(int a, int b){
-	return (a<b) ? a : b;
+/**
+ * Serialize a binary message with a list of variables into the scratch buffer.
+ * If set is NULL all variables are serialized. Variables without binary
+ * representation are skipped.
+ */
+static void serialize_binary(uint8_t type, struct var* const set[], size_t n){
+	buffer_clear(&scratch);
+	buffer_append(&scratch, &type, sizeof(uint8_t));
+
+	const size_t num = set ? n : var_count();
+	for ( size_t i = 0; i < num; i++ ){
+		const struct var* var = set ? set[i] : var_get(i);
+		if ( !var_live(var) || !var->pack ) continue;
+
+		/* record: u32 handle, u8 datatype, value */
+		char* dst = buffer_reserve(&scratch, binary_record_header + VAR_PACKED_MAX);
+		if ( !dst ) break;
+		const uint32_t handle = htole32(var->handle);
+		memcpy(dst, &handle, sizeof(uint32_t));
+		dst[sizeof(uint32_t)] = var->datatype;
+		struct var tmp;
+		union var_value value;
+		scratch.size += binary_record_header + var->pack(var_snapshot(var, &tmp, &value), dst + binary_record_header);
+	}
 }
 
-static void websocket_send(struct worker* client, const char* buffer, size_t len){
-	/* setup frame */
-	struct frame_header frame;
-	frame.fin = 1;
-	frame.res = 0;
-	frame.opcode = OPCODE_TEXT;
-	frame.mask = 0;
-	frame.plen1 = min(len,126);
-	uint16_t plen = htobe16(len);
-
-	/* send frame */
-	send(client->sd, &frame, sizeof(struct frame_header), MSG_MORE);
-	if ( len >= 126 ){
-		send(client->sd, &plen, sizeof(uint16_t), MSG_MORE);
+/**
+ * Serialize a refresh into the scratch buffer.
+ *
+ * @return opcode for the message.
+ */
+static int serialize_refresh(enum websocket_protocol protocol, struct var* const set[], size_t n){
+	switch ( protocol ){
+	case WEBSOCKET_BINARY:
+		serialize_binary(BINARY_REFRESH, set, n);
+		return OPCODE_BINARY;
+	default:
+		serialize_message("refresh", SERIALIZE_SLIM, set, n);
+		return OPCODE_TEXT;
 	}
-	send(client->sd, buffer, len, 0);
 }
 
-enum {
-	SERIALIZE_SLIM = 0,
-	SERIALIZE_FULL = 1,
-};
+/**
+ * Encode a frame which is compressed if large enough. If deflate is NULL the
+ * message is compressed without history so it can be sent to any client using
+ * compression.
+ */
+static struct frame* websocket_frame_deflate(struct wsdeflate* deflate, int opcode, const char* buffer, size_t len){
+	if ( len < wsdeflate_threshold() ){
+		wsdeflate_count_skipped();
+		return websocket_frame(opcode, 0, buffer, len);
+	}
+
+	if ( wsdeflate_compress(deflate, &deflate_scratch, buffer, len) != 0 ){
+		return NULL;
+	}
 
-static struct json_object* serialize_var(const struct var* var, int mode){
-	struct json_object* json = json_object_new_object();
-	if ( mode == SERIALIZE_FULL ){
-		json_object_object_add(json, "name", json_object_new_string(var->name));
-		json_object_object_add(json, "description", var->description ? json_object_new_string(var->description) : NULL);
-		json_object_object_add(json, "options", var->options ? json_tokener_parse(var->options) : NULL);
-		json_object_object_add(json, "datatype", json_object_new_int(var->datatype));
+	return websocket_frame(opcode, 1, deflate_scratch.data, deflate_scratch.size);
+}
+
+/**
+ * Encode a frame for a single client.
+ */
+static struct frame* websocket_message(struct client* client, int opcode, const char* buffer, size_t len){
+	if ( client->deflate ){
+		return websocket_frame_deflate(client->deflate, opcode, buffer, len);
 	}
-	json_object_object_add(json, "handle", json_object_new_int(var->handle));
-	json_object_object_add(json, "value", var->store(var));
-	return json;
+	return websocket_frame(opcode, 0, buffer, len);
 }
 
-static struct json_object* serialize_vars_all(int mode){
-	struct json_object* json_vars = json_object_new_array();
-	for ( void** it = list_begin(vars); it != list_end(vars); it++ ){
-		const struct var* var = *(const struct var**)it;
-		json_object_array_add(json_vars, serialize_var(var, mode));
+static void websocket_hello(struct client* client){
+	size_t n = 0;
+	struct var* const* set = websocket_visible(client, NULL, &n);
+	serialize_message("hello", SERIALIZE_FULL | SERIALIZE_GROUPS, set, n);
+	struct frame* frame = websocket_message(client, OPCODE_TEXT, scratch.data, scratch.size);
+	if ( !frame ){
+		logmsg("%s [%d] - malloc() failed\n", client->peeraddr, client->id);
+		client->state = CLIENT_CLOSED;
+		return;
 	}
-	return json_vars;
+
+	client_send(client, frame);
+	frame_unref(frame);
+}
+
+void websocket_cleanup(){
+	buffer_free(&scratch);
+	buffer_free(&deflate_scratch);
+	buffer_free(&inflated);
+	wsdeflate_cleanup();
+	free(visible);
+	visible = NULL;
+	visible_alloc = 0;
 }
 
-static struct json_object* serialize_vars_set(int mode, struct var* set[], size_t n){
-	struct json_object* json_vars = json_object_new_array();
-	for ( size_t i = 0; i < n; i++ ){;
-		json_object_array_add(json_vars, serialize_var(set[i], mode));
+struct frame* websocket_encode_refresh(enum websocket_protocol protocol, struct var* const set[], size_t n, struct frame** deflated){
+	const int opcode = serialize_refresh(protocol, set, n);
+	if ( deflated ){
+		*deflated = websocket_frame_deflate(NULL, opcode, scratch.data, scratch.size);
 	}
-	return json_vars;
+	return websocket_frame(opcode, 0, scratch.data, scratch.size);
 }
 
-static void websocket_hello(struct worker* client){
-	struct json_object* root = json_object_new_object();
-	json_object_object_add(root, "vars", serialize_vars_all(SERIALIZE_FULL));
-	json_object_object_add(root, "type", json_object_new_string("hello"));
+struct frame* websocket_encode_hello(){
+	serialize_message("hello", SERIALIZE_FULL | SERIALIZE_GROUPS, NULL, 0);
+	return websocket_frame(OPCODE_TEXT, 0, scratch.data, scratch.size);
+}
+
+void websocket_refresh(struct client* client, struct var* const set[], size_t n){
+	set = websocket_visible(client, set, &n);
+	if ( set && n == 0 ){
+		return;
+	}
+
+	const int opcode = serialize_refresh(client->protocol, set, n);
 
-	const char* data = json_object_to_json_string_ext(root, 0);
-	websocket_send(client, data, strlen(data));
+	/* compressed without history like shared refreshes as it may be dropped
+	 * before it is sent */
+	struct frame* frame;
+	if ( client->deflate ){
+		frame = websocket_frame_deflate(NULL, opcode, scratch.data, scratch.size);
+		wsdeflate_desync(client->deflate);
+	} else {
+		frame = websocket_frame(opcode, 0, scratch.data, scratch.size);
+	}
 
-	json_object_put(root);
+	if ( frame ){
+		client_send_droppable(client, frame);
+		frame_unref(frame);
+	}
 }
 
-static void websocket_refresh(struct worker* client, struct var* set[], size_t n){
-	struct json_object* root = json_object_new_object();
-	json_object_object_add(root, "vars", serialize_vars_set(SERIALIZE_SLIM, set, n));
-	json_object_object_add(root, "type", json_object_new_string("refresh"));
+void websocket_remove(struct client* client, struct var* const set[], size_t n){
+	set = websocket_visible(client, set, &n);
+	if ( n == 0 ){
+		return;
+	}
 
-	const char* data = json_object_to_json_string_ext(root, 0);
-	websocket_send(client, data, strlen(data));
+	serialize_remove(set, n);
+	struct frame* frame = websocket_message(client, OPCODE_TEXT, scratch.data, scratch.size);
+	if ( !frame ){
+		logmsg("%s [%d] - malloc() failed\n", client->peeraddr, client->id);
+		client->state = CLIENT_CLOSED;
+		return;
+	}
 
-	json_object_put(root);
+	client_send(client, frame);
+	frame_unref(frame);
 }
 
 static void handle_update(struct json_object* json){
@@ -211,7 +445,9 @@ static void handle_update(struct json_object* json){
 	}
 
 	struct var* var = var_from_handle(json_object_get_int(handle));
-	if ( var ){
+	if ( var && staging_enabled() ){
+		staging_load(var, value);
+	} else if ( var ){
 		tweak_lock();
 		var->load(var, value);
 		tweak_unlock();
@@ -219,7 +455,149 @@ static void handle_update(struct json_object* json){
 	}
 }
 
-static void handle_message(struct worker* client, const char* data){
+/**
+ * Handle binary update message, same record format as refreshes.
+ */
+static void handle_binary(struct client* client, const char* data, size_t size){
+	if ( size < 1 || data[0] != BINARY_UPDATE ){
+		logmsg("%s [%d] - unhandled binary message\n", client->peeraddr, client->id);
+		return;
+	}
+
+	const char* ptr = data + 1;
+	const char* end = data + size;
+	while ( (size_t)(end - ptr) >= binary_record_header ){
+		uint32_t handle;
+		memcpy(&handle, ptr, sizeof(uint32_t));
+		const int datatype = (uint8_t)ptr[sizeof(uint32_t)];
+		ptr += binary_record_header;
+
+		/* the value size depends on the datatype so a mismatch cannot be
+		 * skipped, the rest of the message is discarded */
+		struct var* var = var_from_handle(le32toh(handle));
+		if ( !var || !var->unpack || (int)var->datatype != datatype ){
+			logmsg("%s [%d] - invalid update record\n", client->peeraddr, client->id);
+			return;
+		}
+
+		const int deferred = staging_enabled();
+		size_t bytes;
+		if ( deferred ){
+			bytes = staging_unpack(var, ptr, end - ptr);
+		} else {
+			tweak_lock();
+			bytes = var->unpack(var, ptr, end - ptr);
+			tweak_unlock();
+		}
+		if ( bytes == 0 ){
+			logmsg("%s [%d] - truncated update record\n", client->peeraddr, client->id);
+			return;
+		}
+
+		ptr += bytes;
+		if ( !deferred ){
+			var->update(var->handle);
+		}
+	}
+}
+
+/**
+ * Client asks for a maximum number of refreshes per second, changes are
+ * coalesced in between.
+ */
+static void handle_rate(struct client* client, struct json_object* json){
+	struct json_object* hz;
+
+	if ( !json_object_object_get_ex(json, "hz", &hz) || json_object_get_int(hz) < 0 ){
+		logmsg("%s [%d] - invalid refresh rate\n", client->peeraddr, client->id);
+		return;
+	}
+
+	client_set_refresh_rate(client, json_object_get_int(hz));
+	logmsg("%s [%d] - refresh rate %d Hz\n", client->peeraddr, client->id, json_object_get_int(hz));
+}
+
+/**
+ * Send the variables which became visible (subscribe) or hidden (unsubscribe)
+ * after changing the subscription. Candidates are the variables in the visible
+ * array which were hidden or visible before the change.
+ */
+static void websocket_subscription_changed(struct client* client, size_t candidates, int subscribe){
+	size_t n = 0;
+	for ( size_t i = 0; i < candidates; i++ ){
+		if ( subscription_visible(&client->subscription, visible[i]->group) == subscribe ){
+			visible[n++] = visible[i];
+		}
+	}
+
+	if ( n == 0 ){
+		return;
+	}
+
+	if ( subscribe ){
+		serialize_message("add", SERIALIZE_FULL, visible, n);
+	} else {
+		serialize_remove(visible, n);
+	}
+
+	struct frame* frame = websocket_message(client, OPCODE_TEXT, scratch.data, scratch.size);
+	if ( !frame ){
+		logmsg("%s [%d] - malloc() failed\n", client->peeraddr, client->id);
+		client->state = CLIENT_CLOSED;
+		return;
+	}
+
+	client_send(client, frame);
+	frame_unref(frame);
+}
+
+/**
+ * Client subscribes to or unsubscribes from a list of groups, the empty name
+ * is the root group (all variables). Variables which become visible are sent
+ * with an add message and hidden ones with a remove message.
+ */
+static void handle_subscribe(struct client* client, struct json_object* json, int subscribe){
+	struct json_object* groups;
+
+	if ( !json_object_object_get_ex(json, "groups", &groups) || !json_object_is_type(groups, json_type_array) ){
+		logmsg("%s [%d] - subscription missing groups\n", client->peeraddr, client->id);
+		return;
+	}
+
+	/* variables which might change visibility */
+	const size_t num = var_count();
+	if ( websocket_reserve_visible(num + 1) != 0 ){
+		logmsg("%s [%d] - malloc() failed\n", client->peeraddr, client->id);
+		return;
+	}
+	size_t candidates = 0;
+	for ( size_t i = 0; i < num; i++ ){
+		struct var* var = var_get(i);
+		if ( var_live(var) && subscription_visible(&client->subscription, var->group) != subscribe ){
+			visible[candidates++] = var;
+		}
+	}
+
+	const size_t n = json_object_array_length(groups);
+	for ( size_t i = 0; i < n; i++ ){
+		const char* name = json_object_get_string(json_object_array_get_idx(groups, i));
+		const struct group* group;
+		if ( !name || group_find(name, &group) != 0 ){
+			logmsg("%s [%d] - no group named \"%s\"\n", client->peeraddr, client->id, name ? name : "");
+			continue;
+		}
+
+		if ( !subscribe ){
+			subscription_remove(&client->subscription, group);
+		} else if ( subscription_add(&client->subscription, group) != 0 ){
+			logmsg("%s [%d] - malloc() failed\n", client->peeraddr, client->id);
+		}
+	}
+
+	websocket_subscription_changed(client, candidates, subscribe);
+}
+
+static void handle_message(struct client* client, const char* data){
 	struct json_object* json = json_tokener_parse(data);
 	if ( !json ){
 		logmsg("Failed to parse JSON\n");
@@ -235,6 +613,12 @@ static void handle_message(struct worker* client, const char* data){
 	const char* type_str = json_object_get_string(type);
 	if ( strcmp(type_str, "update") == 0 ){
 		handle_update(json);
+	} else if ( strcmp(type_str, "rate") == 0 ){
+		handle_rate(client, json);
+	} else if ( strcmp(type_str, "subscribe") == 0 ){
+		handle_subscribe(client, json, 1);
+	} else if ( strcmp(type_str, "unsubscribe") == 0 ){
+		handle_subscribe(client, json, 0);
 	} else {
 		logmsg("unhandled message type %s\n", type_str);
 	}
@@ -242,102 +626,318 @@ static void handle_message(struct worker* client, const char* data){
 	json_object_put(json);
 }
 
-static int max(int a, int b){
-	return (a>b) ? a : b;
+enum websocket_protocol websocket_negotiate(const char* header){
+	if ( !header ){
+		return WEBSOCKET_JSON;
+	}
+
+	/* comma separated list in order of client preference */
+	const char* it = header;
+	while ( *it ){
+		it += strspn(it, " \t,");
+		const size_t len = strcspn(it, " \t,");
+		if ( len == strlen(protocol_names[WEBSOCKET_BINARY]) && strncmp(it, protocol_names[WEBSOCKET_BINARY], len) == 0 ){
+			return WEBSOCKET_BINARY;
+		}
+		it += len;
+	}
+
+	return WEBSOCKET_JSON;
 }
 
-void websocket_loop(struct worker* client){
-	const int max_fd = max(client->sd, client->pipe[READ_FD])+1;
-	char* buf = malloc(buffer_size);
+const char* websocket_protocol_name(enum websocket_protocol protocol){
+	return protocol_names[protocol];
+}
 
-	logmsg("%s [%d] - websocket opened\n", client->peeraddr, client->id);
+/**
+ * Decode n bytes of a percent-encoded query string value into dst (at least
+ * n + 1 bytes).
+ */
+static void query_decode(char* dst, const char* src, size_t n){
+	const char* end = src + n;
+	while ( src < end ){
+		unsigned int c;
+		if ( *src == '%' && end - src >= 3 && sscanf(src + 1, "%2x", &c) == 1 ){
+			*dst++ = (char)c;
+			src += 3;
+		} else if ( *src == '+' ){
+			*dst++ = ' ';
+			src++;
+		} else {
+			*dst++ = *src++;
+		}
+	}
+	*dst = 0;
+}
+
+void websocket_subscribe_query(struct client* client, const char* query){
+	while ( query && *query ){
+		const size_t len = strcspn(query, "&");
+		static const char key[] = "groups=";
+		if ( len >= sizeof(key) - 1 && strncmp(query, key, sizeof(key) - 1) == 0 ){
+			client->subscription.all = 0;
+
+			const char* it = query + sizeof(key) - 1;
+			const char* end = query + len;
+			while ( it < end ){
+				const size_t n = strcspn(it, ",&");
+				char* name = malloc(n + 1);
+				const struct group* group;
+				if ( !name ){
+					logmsg("%s [%d] - malloc() failed\n", client->peeraddr, client->id);
+					return;
+				}
+
+				query_decode(name, it, n);
+				if ( group_find(name, &group) != 0 ){
+					logmsg("%s [%d] - no group named \"%s\"\n", client->peeraddr, client->id, name);
+				} else if ( subscription_add(&client->subscription, group) != 0 ){
+					logmsg("%s [%d] - malloc() failed\n", client->peeraddr, client->id);
+				}
+
+				free(name);
+				it += n;
+				it += it < end && *it == ',';
+			}
+		}
 
+		query += len;
+		query += *query == '&';
+	}
+}
+
+void websocket_open(struct client* client){
+	logmsg("%s [%d] - websocket opened\n", client->peeraddr, client->id);
+	client->state = CLIENT_WEBSOCKET;
 	websocket_hello(client);
+}
+
+/**
+ * Parse frame header at the start of data into the reader.
+ *
+ * @return header size or zero if more data is needed.
+ */
+static size_t parse_header(struct websocket_reader* reader, const char* data, size_t size){
+	if ( size < sizeof(struct frame_header) ){
+		return 0;
+	}
 
-	while (client->running){
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(client->sd, &fds);
-		FD_SET(client->pipe[READ_FD], &fds);
+	const struct frame_header* frame = (const struct frame_header*)data;
+	const char* ptr = data + sizeof(struct frame_header);
 
-		/* wait for next request */
-		if ( select(max_fd, &fds, NULL, NULL, NULL) == -1 ){
-			logmsg("select() failed: %s\n", strerror(errno));
-			continue;
-		}
+	/* extended payload size and masking key */
+	size_t ext_size = 0;
+	switch ( frame->plen1 ){
+	case 126: ext_size = sizeof(uint16_t); break;
+	case 127: ext_size = sizeof(uint64_t); break;
+	}
+	const size_t header_size = sizeof(struct frame_header) + ext_size + (frame->mask ? 4 : 0);
+	if ( size < header_size ){
+		return 0;
+	}
 
-		/* handle IPC */
-		if ( FD_ISSET(client->pipe[READ_FD], &fds) ){
-			enum IPC ipc;
-			char* payload = NULL;
-			size_t payload_size = 0;
-			switch ( ipc=ipc_fetch(client, (void**)&payload, &payload_size) ){
-			case IPC_NONE:
-				break;
-			case IPC_REFRESH:
-				websocket_refresh(client, (struct var**)payload, payload_size / sizeof(void*));
-				break;
-			default:
-				logmsg("Unexpected IPC command %s (%d) by websocket worker\n", ipc_name(ipc), ipc);
-			}
-			free(payload);
-			continue;
+	reader->fin = frame->fin;
+	reader->res = frame->res;
+	reader->opcode = frame->opcode;
+	reader->masked = frame->mask;
+
+	reader->payload_size = frame->plen1;
+	if ( frame->plen1 == 126 ){
+		uint16_t tmp;
+		memcpy(&tmp, ptr, sizeof(uint16_t));
+		reader->payload_size = be16toh(tmp);
+	} else if ( frame->plen1 == 127 ){
+		uint64_t tmp;
+		memcpy(&tmp, ptr, sizeof(uint64_t));
+		reader->payload_size = be64toh(tmp);
+	}
+	ptr += ext_size;
+
+	if ( frame->mask ){
+		memcpy(reader->mask, ptr, sizeof(reader->mask));
+	}
+
+	return header_size;
+}
+
+/**
+ * Check that the frame just parsed is allowed, errors closes the connection.
+ *
+ * @return zero if the frame is valid.
+ */
+static int validate_frame(struct client* client){
+	const struct websocket_reader* reader = &client->reader;
+	const char* error = NULL;
+	const int control = reader->opcode >= OPCODE_CLOSE;
+
+	if ( reader->payload_size > max_frame_size ){
+		logmsg("%s [%d] - frame too large (%zu bytes), closing connection\n", client->peeraddr, client->id, (size_t)reader->payload_size);
+		client->state = CLIENT_CLOSED;
+		return 1;
+	}
+
+	if ( reader->res & ~res_compressed ){
+		error = "reserved bits set";
+	} else if ( (reader->res & res_compressed) && (!client->deflate || control || reader->opcode == OPCODE_CONTINUATION) ){
+		error = "unexpected compressed frame";
+	} else if ( control && (!reader->fin || reader->payload_size > 125) ){
+		error = "invalid control frame";
+	} else if ( reader->opcode == OPCODE_CONTINUATION && !reader->message_opcode ){
+		error = "continuation without message";
+	} else if ( (reader->opcode == OPCODE_TEXT || reader->opcode == OPCODE_BINARY) && reader->message_opcode ){
+		error = "new message before previous was finished";
+	} else if ( (reader->opcode > OPCODE_BINARY && !control) || reader->opcode > OPCODE_PONG ){
+		error = "unknown opcode";
+	}
+
+	if ( error ){
+		logmsg("%s [%d] - %s, closing connection\n", client->peeraddr, client->id, error);
+		client->state = CLIENT_CLOSED;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Handle a complete (reassembled) message.
+ */
+static void handle_data(struct client* client, int opcode, int compressed, char* data, size_t size){
+	/* compressed messages are decompressed as a whole */
+	if ( compressed ){
+		if ( wsdeflate_decompress(client->deflate, &inflated, data, size, max_frame_size) != 0 ){
+			logmsg("%s [%d] - failed to decompress message, closing connection\n", client->peeraddr, client->id);
+			client->state = CLIENT_CLOSED;
+			return;
 		}
+		data = inflated.data;
+		size = inflated.size;
+	}
 
-		/* read data */
-		ssize_t bytes = recv(client->sd, buf, sizeof(struct frame_header), 0);
-		if ( bytes == -1 ){
-			logmsg("recv() failed: %s\n", strerror(errno));
-			break;
-		} else if ( bytes == 0 ){
-			logmsg("%s [%d] - connection closed (via websocket)\n", client->peeraddr, client->id);
-			break;
+	switch ( opcode ){
+	case OPCODE_TEXT:
+		{
+			/* temporary null-terminator, buffers always has room for one extra byte */
+			const char saved = data[size];
+			data[size] = 0;
+			logmsg("payload: %s\n", data);
+			handle_message(client, data);
+			data[size] = saved;
 		}
+		break;
 
-		const struct frame_header* frame = (const struct frame_header*)buf;
-		char* ptr = buf + sizeof(struct frame_header);
+	case OPCODE_BINARY:
+		handle_binary(client, data, size);
+		break;
+	}
+}
 
-		/* fragmentation */
-		if ( !frame->fin ){
-			logmsg("Fragmented frames is not supported yet.\n");
-			continue;
+static void handle_control(struct client* client, const char* payload, size_t size){
+	switch ( client->reader.opcode ){
+	case OPCODE_CLOSE:
+		logmsg("%s [%d] - websocket closed\n", client->peeraddr, client->id);
+		client->state = CLIENT_CLOSED;
+		break;
+
+	case OPCODE_PING:
+		{
+			struct frame* frame = websocket_frame(OPCODE_PONG, 0, payload, size);
+			if ( frame ){
+				client_send(client, frame);
+				frame_unref(frame);
+			}
 		}
+		break;
+
+	case OPCODE_PONG:
+		break;
+	}
+}
 
-		/* read frame size */
-		size_t payload_size;
-		ptr = websocket_payload_size(client->sd, ptr, frame, &payload_size);
+/**
+ * Handle a single complete frame, fragments are collected until the final
+ * frame of the message arrives.
+ */
+static void handle_frame(struct client* client, char* payload, size_t size){
+	struct websocket_reader* reader = &client->reader;
 
-		/* read masking key */
-		uint32_t masking_key;
-		ptr = websocket_frame_masking_key(client->sd, ptr, frame, &masking_key);
+	/* control frames may be interleaved with fragments */
+	if ( reader->opcode >= OPCODE_CLOSE ){
+		handle_control(client, payload, size);
+		return;
+	}
+
+	/* unfragmented message is handled directly from the input buffer */
+	if ( reader->opcode != OPCODE_CONTINUATION && reader->fin ){
+		handle_data(client, reader->opcode, reader->res & res_compressed, payload, size);
+		return;
+	}
+
+	/* first fragment */
+	if ( reader->opcode != OPCODE_CONTINUATION ){
+		reader->message_opcode = reader->opcode;
+		reader->message_compressed = reader->res & res_compressed;
+		buffer_clear(&reader->message);
+	}
+
+	if ( reader->message.size + size > max_frame_size ){
+		logmsg("%s [%d] - message too large, closing connection\n", client->peeraddr, client->id);
+		client->state = CLIENT_CLOSED;
+		return;
+	}
+	if ( buffer_append(&reader->message, payload, size) != 0 ){
+		logmsg("%s [%d] - malloc() failed, closing connection\n", client->peeraddr, client->id);
+		client->state = CLIENT_CLOSED;
+		return;
+	}
 
-		/* read full payload */
-		char* payload = ptr;
-		if ( (ptr=websocket_frame_payload(client->sd, ptr, payload_size, masking_key)) == NULL ){
-			logmsg("Failed to receive payload");
+	if ( reader->fin ){
+		const int opcode = reader->message_opcode;
+		reader->message_opcode = 0;
+		handle_data(client, opcode, reader->message_compressed, reader->message.data, reader->message.size);
+	}
+}
+
+void websocket_read(struct client* client){
+	struct websocket_reader* reader = &client->reader;
+	struct buffer* in = &client->in;
+	size_t pos = 0;
+
+	/* handle all complete frames, a partial frame is left in the buffer until
+	 * more data arrives. Consumed data is removed once at the end. */
+	while ( client->state == CLIENT_WEBSOCKET ){
+		const size_t avail = in->size - pos;
+
+		if ( reader->state == READ_HEADER ){
+			const size_t header_size = parse_header(reader, in->data + pos, avail);
+			if ( header_size == 0 ){
+				break;
+			}
+			pos += header_size;
+			if ( validate_frame(client) != 0 ){
+				break;
+			}
+			reader->state = READ_PAYLOAD;
 			continue;
 		}
 
-		switch ( frame->opcode ){
-		case OPCODE_TEXT:
-			/* add null-terminator */
-			payload[payload_size] = 0;
-
-			logmsg("payload: %s\n", payload);
-			handle_message(client, payload);
+		/* wait for full payload */
+		if ( avail < reader->payload_size ){
 			break;
+		}
 
-		case OPCODE_CLOSE:
-			client->running = 0;
-			break;
+		char* payload = in->data + pos;
+		const size_t size = reader->payload_size;
+		pos += size;
+		reader->state = READ_HEADER;
 
-		default:
-			logmsg("unhandled opcode %d\n", frame->opcode);
+		if ( reader->masked ){
+			mask_apply(payload, size, reader->mask, 0);
 		}
+		handle_frame(client, payload, size);
 	}
 
-	logmsg("%s [%d] - websocket closed\n", client->peeraddr, client->id);
-	free(buf);
+	buffer_consume(in, pos);
 }
 
 const char* websocket_derive_key(const char* key){
@@ -1,13 +1,93 @@
 #ifndef TWEAKLIB_WEBSOCKET_H
 #define TWEAKLIB_WEBSOCKET_H
 
-#include "worker.h"
+#include "client.h"
+#include "vars.h"
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void websocket_loop(struct worker* client);
+/**
+ * Largest payload sent in a single frame, larger messages are split into
+ * continuation frames.
+ */
+#define WEBSOCKET_MAX_FRAGMENT (1024*1024)
+
+/**
+ * Sub-protocols, the hello message is always sent as JSON while refreshes and
+ * updates are either JSON or packed binary records.
+ */
+enum websocket_protocol {
+	WEBSOCKET_JSON = 0,                   /* v1.tweaklib.sidvind.com */
+	WEBSOCKET_BINARY,                     /* v1.binary.tweaklib.sidvind.com */
+	WEBSOCKET_NUM_PROTOCOLS,
+};
+
+/**
+ * Select sub-protocol from the Sec-WebSocket-Protocol request header (may be
+ * NULL). JSON is used unless the client offers the binary protocol.
+ */
+enum websocket_protocol websocket_negotiate(const char* header);
+
+/**
+ * Name of sub-protocol as used in Sec-WebSocket-Protocol header.
+ */
+const char* websocket_protocol_name(enum websocket_protocol protocol);
+
+/**
+ * Set initial group subscriptions from the query string of the websocket URL
+ * (without "?", may be NULL). "groups=a,b" subscribes to the listed groups
+ * only, "groups=" to none. Without it the client is sent all variables.
+ */
+void websocket_subscribe_query(struct client* client, const char* query);
+
+/**
+ * Switch client to websocket mode and greet it with the variable listing.
+ */
+void websocket_open(struct client* client);
+
+/**
+ * Handle all complete frames in the client input buffer.
+ */
+void websocket_read(struct client* client);
+
+/**
+ * Release resources shared by all clients.
+ */
+void websocket_cleanup();
+
+/**
+ * Encode a refresh of the given variables as a complete frame which can be
+ * sent to any number of clients using the same protocol. If set is NULL all
+ * variables are refreshed. If deflated is non-NULL it is set to a variant for
+ * clients using permessage-deflate (or NULL on errors).
+ *
+ * @return new frame or NULL on errors.
+ */
+struct frame* websocket_encode_refresh(enum websocket_protocol protocol, struct var* const set[], size_t n, struct frame** deflated);
+
+/**
+ * Encode the hello message (the listing of all variables) as an uncompressed
+ * frame.
+ *
+ * @return new frame or NULL on errors.
+ */
+struct frame* websocket_encode_hello();
+
+/**
+ * Queue a refresh of the variables in set for a single client, if set is NULL
+ * all variables are sent. The frame is droppable (see client_drop()).
+ */
+void websocket_refresh(struct client* client, struct var* const set[], size_t n);
+
+/**
+ * Tell a client the variables in set (which must still be live) are removed,
+ * only variables visible to the client are included.
+ */
+void websocket_remove(struct client* client, struct var* const set[], size_t n);
+
 const char* websocket_derive_key(const char* key);
 
 #ifdef __cplusplus
@@ -3,20 +3,18 @@
 #endif
 
 #include "worker.h"
+#include "ipc.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
-#include <sys/socket.h>
 
 static void worker_reset(struct worker* worker){
 	assert(worker);
 	memset(worker, 0, sizeof(struct worker));
-	worker->pipe[0] = -1;
-	worker->pipe[0] = -1;
+	worker->efd = -1;
 	worker->sd = -1;
-	worker->slot = -1;
 }
 
 struct worker* worker_new(){
@@ -29,11 +27,12 @@ struct worker* worker_new(){
 }
 
 void worker_free(struct worker* worker){
+	const int heap = worker->heap;
+
 	/* release resources */
-	if ( worker->pipe[0] >= 0 ) close(worker->pipe[0]);
-	if ( worker->pipe[1] >= 0 ) close(worker->pipe[1]);
-	if ( worker->sd >= 0 ) shutdown(worker->sd, SHUT_RDWR);
-	free(worker->peeraddr);
+	ipc_cleanup(worker);
+	if ( worker->efd >= 0 ) close(worker->efd);
+	if ( worker->sd >= 0 ) close(worker->sd);
 
 	/* reset memory in case someone tries to access it again */
 	worker_reset(worker);
@@ -41,7 +40,7 @@ void worker_free(struct worker* worker){
 	/* if this worker was allocated using worker_new() heap will be true, if it
 	 * was allocated manually the user should either set this flag or free
 	 * manually. */
-	if ( worker->heap ){
+	if ( heap ){
 		free(worker);
 	}
 }
@@ -3,26 +3,22 @@
 
 #include <pthread.h>
 
+struct ipc_command;
+
 struct worker {
 	pthread_t thread;
-	unsigned int id;
-	int pipe[2];
+	int efd;                          /* eventfd signaled when commands are queued */
+	struct ipc_command* queue;        /* pending commands, pushed by any thread */
+	struct ipc_command* batch;        /* commands taken by the worker, oldest first */
 	int sd;
-	int slot;
 	int running;
-	char* peeraddr;
 	int heap;
 };
 
 /**
  * For statically initializing a worker.
  */
-#define WORKER_INITIALIZER {0, 0, {-1, -1}, -1, -1, 1, NULL, 0}
-
-enum {
-	READ_FD = 0,
-	WRITE_FD = 1,
-};
+#define WORKER_INITIALIZER {0, -1, NULL, NULL, -1, 1, 0}
 
 struct worker* worker_new();
 void worker_free(struct worker* worker);
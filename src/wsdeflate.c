@@ -0,0 +1,345 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "tweak/tweak.h"
+#include "log.h"
+#include "wsdeflate.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ZLIB_CONST
+#include <zlib.h>
+
+/* raw deflate (no zlib header) with the largest window, the only window size
+ * supported for the server side */
+static const int window_bits = 15;
+static const int mem_level = 8;
+
+/* each message ends with an empty stored block which is stripped before
+ * sending and added back before decompressing */
+static const char tail[4] = {0x00, 0x00, (char)0xff, (char)0xff};
+
+static size_t threshold = 256;
+
+/* compressor for messages shared by all connections, server thread only */
+static z_stream* shared = NULL;
+
+/* counters are written by the server thread and read by anyone */
+static struct tweak_deflate_stats stats = {0,};
+
+static uint64_t cputime(){
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void count(unsigned long long* counter, unsigned long long value){
+	__atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Match parameter name (of length len) against expected name.
+ */
+static int param_is(const char* name, size_t len, const char* expected){
+	return len == strlen(expected) && strncmp(name, expected, len) == 0;
+}
+
+/**
+ * Parse a single extension offer (up to the next comma).
+ *
+ * @return zero if the offer is acceptable.
+ */
+static int parse_offer(const char* it, size_t len, int* no_context_takeover, int* client_no_context_takeover){
+	const char* end = it + len;
+	*no_context_takeover = 0;
+	*client_no_context_takeover = 0;
+
+	/* extension name */
+	it += strspn(it, " \t");
+	const size_t name_len = strcspn(it, " \t;,");
+	if ( !param_is(it, name_len, "permessage-deflate") ){
+		return 1;
+	}
+	it += name_len;
+
+	/* parameters: ; name [= value] */
+	while ( it < end ){
+		it += strspn(it, " \t;");
+		if ( it >= end ) break;
+
+		const size_t param_len = strcspn(it, " \t;,=");
+		const char* param = it;
+		it += param_len;
+		it += strspn(it, " \t");
+
+		char value[8] = {0,};
+		if ( *it == '=' ){
+			it++;
+			it += strspn(it, " \t\"");
+			const size_t value_len = strcspn(it, " \t\";,");
+			if ( value_len >= sizeof(value) ) return 1;
+			memcpy(value, it, value_len);
+			it += value_len;
+			it += strspn(it, "\"");
+		}
+
+		if ( param_is(param, param_len, "server_no_context_takeover") ){
+			*no_context_takeover = 1;
+		} else if ( param_is(param, param_len, "client_no_context_takeover") ){
+			/* a hint that the client never refers back to earlier messages,
+			 * no need to reply */
+			*client_no_context_takeover = 1;
+		} else if ( param_is(param, param_len, "client_max_window_bits") ){
+			/* the decompressor always uses the largest window so any client
+			 * window works, no need to reply */
+		} else if ( param_is(param, param_len, "server_max_window_bits") ){
+			/* smaller windows are not supported as shared messages are
+			 * compressed once for all clients */
+			if ( atoi(value) != window_bits ){
+				return 1;
+			}
+		} else {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+struct wsdeflate* wsdeflate_negotiate(const char* header, char* response, size_t size){
+	if ( !header ){
+		return NULL;
+	}
+
+	/* comma separated list of offers in order of client preference */
+	const char* it = header;
+	while ( *it ){
+		it += strspn(it, " \t,");
+		const size_t len = strcspn(it, ",");
+		int no_context_takeover;
+		int client_no_context_takeover;
+		if ( len > 0 && parse_offer(it, len, &no_context_takeover, &client_no_context_takeover) == 0 ){
+			struct wsdeflate* state = calloc(1, sizeof(struct wsdeflate));
+			if ( !state ){
+				return NULL;
+			}
+			state->no_context_takeover = no_context_takeover;
+			state->client_no_context_takeover = client_no_context_takeover;
+			snprintf(response, size, "permessage-deflate%s", no_context_takeover ? "; server_no_context_takeover" : "");
+			return state;
+		}
+		it += len;
+	}
+
+	return NULL;
+}
+
+void wsdeflate_free(struct wsdeflate* state){
+	if ( !state ) return;
+
+	if ( state->tx ){
+		deflateEnd(state->tx);
+		free(state->tx);
+	}
+	if ( state->rx ){
+		inflateEnd(state->rx);
+		free(state->rx);
+	}
+	free(state);
+}
+
+void wsdeflate_cleanup(){
+	if ( !shared ) return;
+
+	deflateEnd(shared);
+	free(shared);
+	shared = NULL;
+}
+
+size_t wsdeflate_threshold(){
+	return __atomic_load_n(&threshold, __ATOMIC_RELAXED);
+}
+
+void wsdeflate_set_threshold(size_t bytes){
+	__atomic_store_n(&threshold, bytes, __ATOMIC_RELAXED);
+}
+
+static z_stream* compressor_alloc(){
+	z_stream* zs = calloc(1, sizeof(z_stream));
+	if ( !zs ){
+		return NULL;
+	}
+
+	if ( deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -window_bits, mem_level, Z_DEFAULT_STRATEGY) != Z_OK ){
+		logmsg("deflateInit2() failed: %s\n", zs->msg ? zs->msg : "unknown error");
+		free(zs);
+		return NULL;
+	}
+
+	return zs;
+}
+
+int wsdeflate_compress(struct wsdeflate* state, struct buffer* dst, const char* src, size_t size){
+	const uint64_t begin = cputime();
+	z_stream** zs = state ? &state->tx : &shared;
+	if ( !*zs && !(*zs=compressor_alloc()) ){
+		return 1;
+	}
+
+	/* shared messages never use history, per-connection messages lose it if
+	 * the history no longer matches what the client has */
+	if ( !state || state->no_context_takeover || state->desync ){
+		deflateReset(*zs);
+	}
+	if ( state ){
+		state->desync = 0;
+	}
+
+	buffer_clear(dst);
+	(*zs)->next_in = (const Bytef*)src;
+	(*zs)->avail_in = size;
+	do {
+		const size_t avail = size / 2 + 64;
+		(*zs)->next_out = (Bytef*)buffer_reserve(dst, avail);
+		(*zs)->avail_out = avail;
+		if ( !(*zs)->next_out ){
+			if ( state ){
+				state->desync = 1;
+			}
+			return 1;
+		}
+		if ( deflate(*zs, Z_SYNC_FLUSH) == Z_STREAM_ERROR ){
+			logmsg("deflate() failed\n");
+			if ( state ){
+				state->desync = 1;
+			}
+			return 1;
+		}
+		dst->size += avail - (*zs)->avail_out;
+	} while ( (*zs)->avail_out == 0 );
+
+	/* the sync flush always ends with the empty block */
+	if ( dst->size >= sizeof(tail) ){
+		dst->size -= sizeof(tail);
+	}
+
+	count(&stats.messages, 1);
+	count(&stats.bytes_in, size);
+	count(&stats.bytes_out, dst->size);
+	count(&stats.cpu_ns, cputime() - begin);
+	return 0;
+}
+
+void wsdeflate_desync(struct wsdeflate* state){
+	state->desync = 1;
+}
+
+/**
+ * Restart the decompressor after a stream ended with a final block, keeping
+ * the window if context takeover is used.
+ *
+ * @return zero if successful.
+ */
+static int decompressor_restart(struct wsdeflate* state){
+	z_stream* zs = state->rx;
+	if ( state->client_no_context_takeover ){
+		return inflateReset(zs) != Z_OK;
+	}
+
+	Bytef window[1 << 15]; /* 1 << window_bits */
+	uInt window_size = sizeof(window);
+	if ( inflateGetDictionary(zs, window, &window_size) != Z_OK ){
+		return 1;
+	}
+	if ( inflateReset(zs) != Z_OK ){
+		return 1;
+	}
+	if ( window_size > 0 && inflateSetDictionary(zs, window, window_size) != Z_OK ){
+		return 1;
+	}
+	return 0;
+}
+
+int wsdeflate_decompress(struct wsdeflate* state, struct buffer* dst, const char* src, size_t size, size_t max){
+	const uint64_t begin = cputime();
+	if ( !state->rx ){
+		state->rx = calloc(1, sizeof(z_stream));
+		if ( !state->rx ){
+			return 1;
+		}
+		if ( inflateInit2(state->rx, -window_bits) != Z_OK ){
+			free(state->rx);
+			state->rx = NULL;
+			return 1;
+		}
+	}
+
+	z_stream* zs = state->rx;
+	buffer_clear(dst);
+
+	/* payload followed by the stripped tail */
+	const char* input[2] = {src, tail};
+	const size_t input_size[2] = {size, sizeof(tail)};
+	int ended = 0;
+	for ( int i = 0; i < 2 && !ended; i++ ){
+		zs->next_in = (const Bytef*)input[i];
+		zs->avail_in = input_size[i];
+		while ( zs->avail_in > 0 ){
+			const size_t avail = size * 2 + 256;
+			zs->next_out = (Bytef*)buffer_reserve(dst, avail);
+			zs->avail_out = avail;
+			if ( !zs->next_out ){
+				return 1;
+			}
+			const int ret = inflate(zs, Z_SYNC_FLUSH);
+			dst->size += avail - zs->avail_out;
+
+			if ( ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END ){
+				return 1;
+			}
+			if ( dst->size > max ){
+				return 1;
+			}
+			if ( ret == Z_STREAM_END ){
+				/* the message ended with a BFINAL block (RFC 7692 7.2.3.4), any
+				 * remaining input including the tail is ignored */
+				ended = 1;
+				break;
+			}
+			if ( ret == Z_BUF_ERROR && zs->avail_out > 0 ){
+				break; /* no progress possible */
+			}
+		}
+	}
+
+	/* a final block ends the stream but unless the client disabled context
+	 * takeover the next message may still refer back to this one, so the
+	 * window is carried over to the new stream */
+	if ( ended && decompressor_restart(state) != 0 ){
+		return 1;
+	}
+
+	count(&stats.cpu_ns, cputime() - begin);
+	return 0;
+}
+
+void wsdeflate_count_skipped(){
+	count(&stats.skipped, 1);
+}
+
+void tweak_get_deflate_stats(struct tweak_deflate_stats* dst){
+	dst->messages = __atomic_load_n(&stats.messages, __ATOMIC_RELAXED);
+	dst->skipped = __atomic_load_n(&stats.skipped, __ATOMIC_RELAXED);
+	dst->bytes_in = __atomic_load_n(&stats.bytes_in, __ATOMIC_RELAXED);
+	dst->bytes_out = __atomic_load_n(&stats.bytes_out, __ATOMIC_RELAXED);
+	dst->cpu_ns = __atomic_load_n(&stats.cpu_ns, __ATOMIC_RELAXED);
+}
+
+void tweak_deflate_threshold(size_t bytes){
+	wsdeflate_set_threshold(bytes);
+}
@@ -0,0 +1,86 @@
+#ifndef TWEAKLIB_WSDEFLATE_H
+#define TWEAKLIB_WSDEFLATE_H
+
+/**
+ * Websocket compression extension "permessage-deflate" (RFC 7692).
+ *
+ * Each connection using the extension has its own compressor and
+ * decompressor. Messages encoded once for many connections are compressed
+ * without any history (see wsdeflate_compress()) which any client can
+ * decompress regardless of its context takeover parameters.
+ */
+
+#include "buffer.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct z_stream_s;
+
+/**
+ * Per-connection compression state.
+ */
+struct wsdeflate {
+	struct z_stream_s* tx;                /* compressor, allocated on first use */
+	struct z_stream_s* rx;                /* decompressor, allocated on first use */
+	int no_context_takeover;              /* server_no_context_takeover negotiated */
+	int client_no_context_takeover;       /* client_no_context_takeover offered */
+	int desync;                           /* tx history no longer matches the client window */
+};
+
+/**
+ * Parse the Sec-WebSocket-Extensions request header (may be NULL) and accept
+ * the first permessage-deflate offer with supported parameters. The response
+ * extension header is written to response.
+ *
+ * @return new state or NULL if no offer was accepted.
+ */
+struct wsdeflate* wsdeflate_negotiate(const char* header, char* response, size_t size);
+
+void wsdeflate_free(struct wsdeflate* state);
+
+/**
+ * Release the shared compressor.
+ */
+void wsdeflate_cleanup();
+
+/**
+ * Messages smaller than this (in bytes) are sent uncompressed.
+ */
+size_t wsdeflate_threshold();
+void wsdeflate_set_threshold(size_t bytes);
+
+/**
+ * Compress a message payload into dst (replacing its content). If state is
+ * NULL the message is compressed without history so it can be shared by all
+ * connections.
+ *
+ * @return zero if successful.
+ */
+int wsdeflate_compress(struct wsdeflate* state, struct buffer* dst, const char* src, size_t size);
+
+/**
+ * A shared message was compressed outside the connection's context, the
+ * connection compressor must be reset before its next message.
+ */
+void wsdeflate_desync(struct wsdeflate* state);
+
+/**
+ * Decompress a message payload into dst (replacing its content).
+ *
+ * @return zero if successful, non-zero if the data is corrupt or larger than max.
+ */
+int wsdeflate_decompress(struct wsdeflate* state, struct buffer* dst, const char* src, size_t size, size_t max);
+
+/**
+ * Count a message sent uncompressed because it was below the threshold.
+ */
+void wsdeflate_count_skipped();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWEAKLIB_WSDEFLATE_H */
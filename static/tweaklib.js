@@ -33,10 +33,23 @@ var tweaklib = (function(){
 		}
 	}
 
+	function remove_vars(handles){
+		for ( var key in handles ){
+			var handle = handles[key];
+			if ( handle in vars ){
+				vars[handle].remove();
+				delete vars[handle];
+			}
+		}
+	}
+
 	function update_vars(data){
 		for ( var key in data ){
 			var elem = data[key];
 			var item = var_from_handle(elem.handle);
+			if ( !item ){
+				continue;
+			}
 			item.unserialize(elem.value);
 			item.render();
 		}
@@ -69,6 +82,16 @@ var tweaklib = (function(){
 			refresh: function(data){
 				update_vars(data.vars);
 			},
+
+			/* variables in groups subscribed to */
+			add: function(data){
+				create_vars(data.vars);
+				update_vars(data.vars);
+			},
+
+			remove: function(data){
+				remove_vars(data.handles);
+			},
 		});
 		return socket.connect();
 	}
@@ -156,7 +179,16 @@ var tweaklib = (function(){
 		factory: factory,
 
 		send: function(data){
-			socket.send(JSON.stringify(data));
+			socket.send(data);
+		},
+
+		/* only receive variables in the given groups ('' is all variables) */
+		subscribe: function(groups){
+			socket.send({type: 'subscribe', groups: groups});
+		},
+
+		unsubscribe: function(groups){
+			socket.send({type: 'unsubscribe', groups: groups});
 		},
 
 		register_field: function(datatype, callback){
@@ -103,6 +103,7 @@ var Field = (function(){
 		tweaklib.send({
 			type: 'update',
 			handle: this.get_handle(),
+			datatype: this.datatype,
 			value: this.serialize(),
 		});
 	};
@@ -6,6 +6,94 @@ var TweakSocket = (function(){
 	var STATUS_FAILURE = 2;
 	var STATUS_CONNECTING = 3;
 	var PROTOCOL = 'v1.tweaklib.sidvind.com';
+	var BINARY_PROTOCOL = 'v1.binary.tweaklib.sidvind.com';
+
+	/* binary message types */
+	var BINARY_REFRESH = 1;
+	var BINARY_UPDATE = 2;
+
+	/* refreshes per second, no point in updating faster than the display */
+	var REFRESH_RATE = 30;
+
+	/* binary records are u32 handle, u8 datatype followed by the value, all
+	 * little-endian */
+	var RECORD_HEADER = 5;
+
+	function value_size(datatype){
+		switch ( datatype ){
+		case constants.DATATYPE_INTEGER: return 4;
+		case constants.DATATYPE_FLOAT: return 4;
+		case constants.DATATYPE_DOUBLE: return 8;
+		default: return undefined;
+		}
+	}
+
+	function read_value(view, offset, datatype){
+		switch ( datatype ){
+		case constants.DATATYPE_INTEGER: return view.getInt32(offset, true);
+		case constants.DATATYPE_FLOAT: return view.getFloat32(offset, true);
+		case constants.DATATYPE_DOUBLE: return view.getFloat64(offset, true);
+		}
+	}
+
+	function write_value(view, offset, datatype, value){
+		switch ( datatype ){
+		case constants.DATATYPE_INTEGER: view.setInt32(offset, value, true); break;
+		case constants.DATATYPE_FLOAT: view.setFloat32(offset, value, true); break;
+		case constants.DATATYPE_DOUBLE: view.setFloat64(offset, value, true); break;
+		}
+	}
+
+	/**
+	 * Decode a binary message into the same form as the JSON messages.
+	 */
+	function decode_binary(buffer){
+		var view = new DataView(buffer);
+		var type = view.getUint8(0);
+		var vars = [];
+
+		if ( type !== BINARY_REFRESH ){
+			return {type: 'binary-' + type};
+		}
+
+		var offset = 1;
+		while ( offset + RECORD_HEADER <= view.byteLength ){
+			var handle = view.getUint32(offset, true);
+			var datatype = view.getUint8(offset + 4);
+			var size = value_size(datatype);
+			offset += RECORD_HEADER;
+
+			/* unknown datatypes cannot be skipped */
+			if ( size === undefined || offset + size > view.byteLength ){
+				console.log('invalid binary record for handle ' + handle + ', ignored');
+				break;
+			}
+
+			vars.push({handle: handle, value: read_value(view, offset, datatype)});
+			offset += size;
+		}
+
+		return {type: 'refresh', vars: vars};
+	}
+
+	/**
+	 * Encode an update message as a binary record, returns undefined if the
+	 * datatype has no binary representation.
+	 */
+	function encode_update(data){
+		var size = value_size(data.datatype);
+		if ( size === undefined ){
+			return undefined;
+		}
+
+		var buffer = new ArrayBuffer(1 + RECORD_HEADER + size);
+		var view = new DataView(buffer);
+		view.setUint8(0, BINARY_UPDATE);
+		view.setUint32(1, data.handle, true);
+		view.setUint8(5, data.datatype);
+		write_value(view, 1 + RECORD_HEADER, data.datatype, data.value);
+		return buffer;
+	}
 
 	function TweakSocket(handlers){
 		this.handlers = handlers;
@@ -17,10 +105,12 @@ var TweakSocket = (function(){
 		var self = this;
 
 		this.set_status('Connecting', STATUS_CONNECTING);
-		this.socket = new WebSocket(this.get_url(), PROTOCOL);
+		this.socket = new WebSocket(this.get_url(), [BINARY_PROTOCOL, PROTOCOL]);
+		this.socket.binaryType = 'arraybuffer';
 
 		this.socket.onopen = function(event){
 			self.set_status('Connected', STATUS_OK);
+			self.send({type: 'rate', hz: REFRESH_RATE});
 		};
 
 		this.socket.onerror = function(event){
@@ -34,7 +124,7 @@ var TweakSocket = (function(){
 		};
 
 		this.socket.onmessage = function(event){
-			var data = JSON.parse(event.data);
+			var data = typeof event.data === 'string' ? JSON.parse(event.data) : decode_binary(event.data);
 
 			if ( data.type in self.handlers ){
 				self.handlers[data.type](data);
@@ -52,7 +142,16 @@ var TweakSocket = (function(){
 	};
 
 	TweakSocket.prototype.send = function(data){
-		this.socket.send(data);
+		/* updates are sent as binary records if the server agreed on it */
+		if ( this.socket.protocol === BINARY_PROTOCOL && data.type === 'update' ){
+			var buffer = encode_update(data);
+			if ( buffer ){
+				this.socket.send(buffer);
+				return;
+			}
+		}
+
+		this.socket.send(JSON.stringify(data));
 	};
 
 	TweakSocket.prototype.get_url = function(){
@@ -5,6 +5,7 @@ var Variable = (function(){
 	function Variable(item){
 		this.datatype = item.datatype;
 		this.name = item.name;
+		this.group = item.group;
 		this.handle = item.handle;
 		this.description = item.description;
 		this.options = item.options;
@@ -24,6 +25,12 @@ var Variable = (function(){
 		$('#vars').append(this.element);
 	};
 
+	Variable.prototype.remove = function(){
+		if ( this.element ){
+			this.element.remove();
+		}
+	};
+
 	Variable.prototype.template = function(){
 		return $(Handlebars.templates['wrapper.html'](this));
 	};
@@ -0,0 +1,725 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "tweak/tweak.h"
+#include "dirty.h"
+#include "frame.h"
+#include "vars.h"
+#include "watch.h"
+#include "websocket.h"
+#include "utils/mask.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/**
+ * Microbenchmarks, run all with `tests/bench` or a single one by name.
+ */
+
+static const int port = 18081;
+
+static void output(const char* str){
+	/* suppress server logging */
+}
+
+static double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cputime(){
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void register_vars(size_t n, int** values, tweak_handle** handles){
+	*values = calloc(n, sizeof(int));
+	*handles = malloc(n * sizeof(tweak_handle));
+	for ( size_t i = 0; i < n; i++ ){
+		char name[32];
+		snprintf(name, sizeof(name), "var%zu", i);
+		(*handles)[i] = tweak_int(name, &(*values)[i]);
+	}
+}
+
+static int connect_websocket(){
+	static const char request[] =
+		"GET /socket HTTP/1.1\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"Sec-WebSocket-Version: 13\r\n"
+		"\r\n";
+
+	int sd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = {0,};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr.s_addr);
+	if ( connect(sd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+	     send(sd, request, sizeof(request) - 1, 0) != sizeof(request) - 1 ){
+		perror("connect");
+		exit(1);
+	}
+
+	/* skip response header, the hello frame is counted as any other frame */
+	const char* terminator = "\r\n\r\n";
+	int matched = 0;
+	while ( terminator[matched] ){
+		char ch;
+		if ( recv(sd, &ch, 1, 0) != 1 ){
+			perror("recv");
+			exit(1);
+		}
+		matched = ch == terminator[matched] ? matched + 1 : (ch == '\r');
+	}
+
+	return sd;
+}
+
+/**
+ * Websocket reader state, counts the number of frames received.
+ */
+struct reader {
+	int sd;
+	unsigned char buf[65536];
+	size_t size;
+	uint64_t frames;
+};
+
+static void reader_read(struct reader* r){
+	ssize_t bytes = recv(r->sd, r->buf + r->size, sizeof(r->buf) - r->size, 0);
+	if ( bytes <= 0 ){
+		perror("recv");
+		exit(1);
+	}
+	r->size += bytes;
+
+	/* count complete frames and discard them, partial frames are kept until
+	 * the rest is received */
+	size_t pos = 0;
+	while ( r->size - pos >= 2 ){
+		uint64_t len = r->buf[pos+1] & 0x7f;
+		size_t header = 2;
+		if ( len == 126 ){
+			if ( r->size - pos < 4 ) break;
+			len = (r->buf[pos+2] << 8) | r->buf[pos+3];
+			header = 4;
+		} else if ( len == 127 ){
+			if ( r->size - pos < 10 ) break;
+			len = 0;
+			for ( int i = 0; i < 8; i++ ){
+				len = (len << 8) | r->buf[pos+2+i];
+			}
+			header = 10;
+		}
+
+		if ( r->size - pos < header + len ){
+			if ( header + len > sizeof(r->buf) ){
+				fprintf(stderr, "frame too large for benchmark\n");
+				exit(1);
+			}
+			break;
+		}
+
+		pos += header + len;
+		r->frames++;
+	}
+
+	memmove(r->buf, r->buf + pos, r->size - pos);
+	r->size -= pos;
+}
+
+/**
+ * Connect n clients and report back each time all clients has received the
+ * given number of frames.
+ */
+static void broadcast_child(int n, int fd, uint64_t per_round, int rounds){
+	struct reader* reader = calloc(n, sizeof(struct reader));
+	struct pollfd* pfd = calloc(n, sizeof(struct pollfd));
+	for ( int i = 0; i < n; i++ ){
+		reader[i].sd = connect_websocket();
+		pfd[i].fd = reader[i].sd;
+		pfd[i].events = POLLIN;
+	}
+
+	uint64_t target = 1; /* hello */
+	for ( int round = 0; round <= rounds; round++, target += per_round ){
+		for (;;){
+			int done = 1;
+			for ( int i = 0; i < n; i++ ){
+				done &= reader[i].frames >= target;
+			}
+			if ( done ) break;
+
+			poll(pfd, n, -1);
+			for ( int i = 0; i < n; i++ ){
+				if ( pfd[i].revents ){
+					reader_read(&reader[i]);
+				}
+			}
+		}
+
+		if ( write(fd, "", 1) != 1 ){
+			exit(1);
+		}
+	}
+
+	_exit(0);
+}
+
+/**
+ * Server CPU time per refresh with an increasing number of clients. The
+ * clients run in a separate process so only the cost of the server is
+ * measured (and the application thread publishing the refreshes). Each
+ * refresh is received by all clients before the next is made.
+ */
+static void bench_broadcast(){
+	static const size_t num_vars = 100;
+	static const int clients[] = {1, 2, 5, 10, 20, 50, 100};
+	static const int per_round = 1; /* refreshes in flight would be coalesced */
+	static const int rounds = 2000;
+
+	int* values;
+	tweak_handle* handles;
+	tweak_init(port, "127.0.0.1");
+	tweak_refresh_rate(0);
+	register_vars(num_vars, &values, &handles);
+
+	printf("%-10s %12s %14s %16s\n", "clients", "refreshes", "us/refresh", "us/refresh/client");
+	for ( size_t i = 0; i < sizeof(clients) / sizeof(clients[0]); i++ ){
+		const int n = clients[i];
+		int fd[2];
+		char ch;
+		if ( pipe(fd) != 0 ){
+			perror("pipe");
+			exit(1);
+		}
+
+		pid_t pid = fork();
+		if ( pid == 0 ){
+			close(fd[0]);
+			broadcast_child(n, fd[1], per_round, rounds);
+		}
+		close(fd[1]);
+
+		/* wait for all clients to be connected */
+		if ( read(fd[0], &ch, 1) != 1 ){
+			fprintf(stderr, "client process failed\n");
+			exit(1);
+		}
+
+		const double begin = cputime();
+		for ( int round = 0; round < rounds; round++ ){
+			for ( int r = 0; r < per_round; r++ ){
+				values[r % num_vars]++;
+				tweak_refresh_vars(handles, num_vars * sizeof(tweak_handle));
+			}
+			if ( read(fd[0], &ch, 1) != 1 ){
+				fprintf(stderr, "client process failed\n");
+				exit(1);
+			}
+		}
+		const double elapsed = cputime() - begin;
+		const int total = rounds * per_round;
+
+		printf("%-10d %12d %14.2f %16.2f\n", n, total, elapsed / total * 1e6, elapsed / total / n * 1e6);
+
+		waitpid(pid, NULL, 0);
+		close(fd[0]);
+	}
+
+	tweak_cleanup();
+	free(handles);
+	free(values);
+}
+
+/**
+ * Time to encode a refresh of a mix of datatypes with each protocol, with and
+ * without compression.
+ */
+static void bench_serialize(){
+	static const size_t sizes[] = {10, 100, 1000, 5000};
+	static const size_t max_vars = 5000;
+
+	tweak_init(port, "127.0.0.1");
+	int* ivalues = calloc(max_vars, sizeof(int));
+	float* fvalues = calloc(max_vars, sizeof(float));
+	double* dvalues = calloc(max_vars, sizeof(double));
+	struct var** set = malloc(max_vars * sizeof(struct var*));
+	for ( size_t i = 0; i < max_vars; i++ ){
+		char name[32];
+		snprintf(name, sizeof(name), "var%zu", i);
+		tweak_handle handle;
+		switch ( i % 3 ){
+		case 0: ivalues[i] = i; handle = tweak_int(name, &ivalues[i]); break;
+		case 1: fvalues[i] = i * 0.1f; handle = tweak_float(name, &fvalues[i]); break;
+		default: dvalues[i] = i * 0.01; handle = tweak_double(name, &dvalues[i]); break;
+		}
+		tweak_options(handle, "{\"min\": 0, \"max\": 100, \"step\": 0.5}");
+		set[i] = var_from_handle(handle);
+	}
+
+	printf("%-10s %-8s %-8s %12s %12s %14s %12s\n", "vars", "protocol", "deflate", "iterations", "us/refresh", "ns/variable", "bytes");
+	for ( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ){
+		for ( int protocol = 0; protocol < WEBSOCKET_NUM_PROTOCOLS; protocol++ ){
+			for ( int deflate = 0; deflate < 2; deflate++ ){
+				const size_t n = sizes[i];
+				const unsigned int iterations = 1000000 / n;
+				size_t bytes = 0;
+
+				const double begin = now();
+				for ( unsigned int it = 0; it < iterations; it++ ){
+					struct frame* deflated = NULL;
+					struct frame* frame = websocket_encode_refresh(protocol, set, n, deflate ? &deflated : NULL);
+					bytes = deflate ? deflated->size : frame->size;
+					frame_unref(deflated);
+					frame_unref(frame);
+				}
+				const double elapsed = now() - begin;
+
+				printf("%-10zu %-8s %-8s %12u %12.2f %14.2f %12zu\n", n, protocol == WEBSOCKET_BINARY ? "binary" : "json", deflate ? "yes" : "no",
+				       iterations, elapsed / iterations * 1e6, elapsed / iterations / n * 1e9, bytes);
+			}
+		}
+	}
+
+	tweak_cleanup();
+	free(set);
+	free(dvalues);
+	free(fvalues);
+	free(ivalues);
+}
+
+/**
+ * Registration time, registry memory per variable and time to serialize the
+ * full registry (the hello message and a refresh of all variables).
+ */
+static void bench_registry(){
+	static const size_t sizes[] = {1000, 100000, 1000000};
+
+	printf("%-10s %12s %12s %12s %12s %12s\n", "vars", "ns/register", "bytes/var", "ms/hello", "ms/refresh", "hello bytes");
+	for ( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ){
+		const size_t n = sizes[i];
+		int* values = calloc(n, sizeof(int));
+		tweak_init(port, "127.0.0.1");
+
+		const double begin = now();
+		for ( size_t v = 0; v < n; v++ ){
+			char name[32];
+			snprintf(name, sizeof(name), "var%zu", v);
+			tweak_int(name, &values[v]);
+		}
+		const double registration = now() - begin;
+
+		const unsigned int iterations = n >= 1000000 ? 3 : 1000000 / n;
+		size_t bytes = 0;
+		double hello = 0;
+		double refresh = 0;
+		for ( unsigned int it = 0; it < iterations; it++ ){
+			const double a = now();
+			struct frame* frame = websocket_encode_hello();
+			const double b = now();
+			bytes = frame->size;
+			frame_unref(frame);
+
+			const double c = now();
+			frame = websocket_encode_refresh(WEBSOCKET_JSON, NULL, 0, NULL);
+			refresh += now() - c;
+			hello += b - a;
+			frame_unref(frame);
+		}
+
+		printf("%-10zu %12.2f %12.2f %12.3f %12.3f %12zu\n", n, registration / n * 1e9, (double)var_memory() / n,
+		       hello / iterations * 1e3, refresh / iterations * 1e3, bytes);
+
+		tweak_cleanup();
+		free(values);
+	}
+}
+
+/**
+ * Registration of variables with description and options one call at a time
+ * compared to a static descriptor table.
+ */
+static void bench_table(){
+	static const size_t sizes[] = {1000, 100000, 1000000};
+
+	printf("%-10s %12s %12s %12s %12s\n", "vars", "ns/call", "ns/table", "bytes/call", "bytes/table");
+	for ( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ){
+		const size_t n = sizes[i];
+		float* values = calloc(n, sizeof(float));
+		char* names = malloc(n * 32);
+		tweak_descriptor* table = malloc(n * sizeof(tweak_descriptor));
+		for ( size_t v = 0; v < n; v++ ){
+			snprintf(names + v * 32, 32, "var%zu", v);
+			tweak_descriptor desc = {names + v * 32, TWEAK_FLOAT, &values[v], "description", 0, 1, 0.1};
+			table[v] = desc;
+		}
+
+		tweak_init(port, "127.0.0.1");
+		double begin = now();
+		for ( size_t v = 0; v < n; v++ ){
+			const tweak_handle handle = tweak_float(table[v].name, &values[v]);
+			tweak_description(handle, table[v].description);
+			tweak_options(handle, "{\"min\":0,\"max\":1,\"step\":0.1}");
+		}
+		const double call = now() - begin;
+		const size_t call_bytes = var_memory();
+		tweak_cleanup();
+
+		tweak_init(port, "127.0.0.1");
+		begin = now();
+		if ( tweak_register_table(table, n, NULL) != n ) abort();
+		const double bulk = now() - begin;
+		const size_t table_bytes = var_memory();
+		tweak_cleanup();
+
+		printf("%-10zu %12.2f %12.2f %12.2f %12.2f\n", n, call / n * 1e9, bulk / n * 1e9,
+		       (double)call_bytes / n, (double)table_bytes / n);
+
+		free(table);
+		free(names);
+		free(values);
+	}
+}
+
+/**
+ * Time to look up variables by name (existing and missing) and by prefix.
+ */
+static void bench_find(){
+	static const size_t sizes[] = {1000, 100000, 1000000};
+	static const unsigned int lookups = 1000000;
+
+	printf("%-10s %12s %12s %12s %14s\n", "vars", "ns/hit", "ns/miss", "ms/sort", "us/prefix");
+	for ( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ){
+		const size_t n = sizes[i];
+		int* values;
+		tweak_handle* handles;
+		tweak_init(port, "127.0.0.1");
+		register_vars(n, &values, &handles);
+
+		char name[32];
+		double begin = now();
+		for ( unsigned int it = 0; it < lookups; it++ ){
+			snprintf(name, sizeof(name), "var%zu", (it * 7919) % n);
+			if ( !tweak_find(name) ) abort();
+		}
+		const double hit = now() - begin;
+
+		begin = now();
+		for ( unsigned int it = 0; it < lookups; it++ ){
+			snprintf(name, sizeof(name), "missing%u", it);
+			if ( tweak_find(name) ) abort();
+		}
+		const double miss = now() - begin;
+
+		/* first prefix lookup sorts the names */
+		begin = now();
+		tweak_find_prefix("", handles, 0);
+		const double sort = now() - begin;
+
+		/* "var12" matches 11, 1111 and 11111 variables respectively */
+		begin = now();
+		for ( unsigned int it = 0; it < 10000; it++ ){
+			tweak_find_prefix("var12", handles, n);
+		}
+		const double prefix = now() - begin;
+
+		printf("%-10zu %12.2f %12.2f %12.2f %14.2f\n", n, hit / lookups * 1e9, miss / lookups * 1e9, sort * 1e3, prefix / 10000 * 1e6);
+
+		tweak_cleanup();
+		free(handles);
+		free(values);
+	}
+}
+
+/**
+ * Time to publish refresh sets of increasing size.
+ */
+static void bench_publish(){
+	static const size_t max_vars = 100000;
+	static const size_t sizes[] = {1, 10, 100, 1000, 10000, 100000};
+
+	int* values;
+	tweak_handle* handles;
+	tweak_init(port, "127.0.0.1");
+	register_vars(max_vars, &values, &handles);
+
+	printf("%-10s %12s %12s %14s\n", "vars", "iterations", "us/publish", "ns/variable");
+	for ( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ){
+		const size_t n = sizes[i];
+		const unsigned int iterations = n >= 10000 ? 100 : 10000;
+
+		const double begin = now();
+		for ( unsigned int it = 0; it < iterations; it++ ){
+			tweak_refresh_vars(handles, n * sizeof(tweak_handle));
+		}
+		const double elapsed = now() - begin;
+
+		printf("%-10zu %12u %12.2f %14.2f\n", n, iterations, elapsed / iterations * 1e6, elapsed / iterations / n * 1e9);
+	}
+
+	tweak_cleanup();
+	free(handles);
+	free(values);
+}
+
+/**
+ * Cost of automatic change detection (tweak_auto_refresh()) per scan and per
+ * million bytes watched, with no variables changed and with 1% changed. Both
+ * with variables adjacent in memory (e.g. arrays, compared in runs) and
+ * scattered.
+ */
+static void bench_scan(){
+	static const size_t sizes[] = {1000, 10000, 100000, 1000000};
+	static const size_t max_vars = 1000000;
+
+	int* values = calloc(max_vars * 2, sizeof(int));
+	struct dirty dirty = DIRTY_INITIALIZER;
+
+	printf("%-10s %-10s %-8s %12s %12s %12s\n", "vars", "layout", "changed", "iterations", "us/scan", "us/MB");
+	for ( size_t stride = 1; stride <= 2; stride++ ){
+		tweak_init(port, "127.0.0.1");
+		size_t registered = 0;
+
+		for ( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ){
+			const size_t n = sizes[i];
+			for ( ; registered < n; registered++ ){
+				char name[32];
+				snprintf(name, sizeof(name), "var%zu", registered);
+				tweak_int(name, &values[registered * stride]);
+			}
+
+			/* first scan takes the shadow copy of the new variables */
+			watch_scan(&dirty);
+			dirty_clear(&dirty);
+
+			for ( int percent = 0; percent <= 1; percent++ ){
+				const unsigned int iterations = 10000000 / n;
+				double elapsed = 0;
+				for ( unsigned int it = 0; it < iterations; it++ ){
+					for ( size_t v = it % 100; percent && v < n; v += 100 ){
+						values[v * stride]++;
+					}
+
+					const double begin = now();
+					watch_scan(&dirty);
+					elapsed += now() - begin;
+					dirty_clear(&dirty);
+				}
+
+				const double mb = watch_size() * 1e-6;
+				printf("%-10zu %-10s %-8s %12u %12.2f %12.2f\n", n, stride == 1 ? "adjacent" : "scattered", percent ? "1%" : "0%",
+				       iterations, elapsed / iterations * 1e6, elapsed / iterations / mb * 1e6);
+			}
+		}
+
+		tweak_cleanup();
+	}
+
+	dirty_free(&dirty);
+	free(values);
+}
+
+/**
+ * Throughput of each websocket unmasking implementation.
+ */
+static void bench_unmask(){
+	static const size_t sizes[] = {16, 128, 1024, 65536, 1024*1024};
+	static const uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+	static const size_t total = 256*1024*1024; /* bytes per measurement */
+
+	/* odd offset so the unaligned head is included */
+	char* buf = malloc(sizes[4] + 1);
+	memset(buf, 0x55, sizes[4] + 1);
+
+	printf("%-10s %-8s %12s %12s\n", "size", "impl", "ns/call", "GB/s");
+	for ( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ){
+		for ( const struct mask_impl* impl = mask_impls; impl->name; impl++ ){
+			if ( !impl->supported() ) continue;
+			const size_t n = sizes[i];
+			const size_t iterations = total / n;
+
+			const double begin = now();
+			for ( size_t it = 0; it < iterations; it++ ){
+				impl->func(buf + 1, n, key, it);
+			}
+			const double elapsed = now() - begin;
+
+			printf("%-10zu %-8s %12.2f %12.2f\n", n, impl->name, elapsed / iterations * 1e9, (double)n * iterations / elapsed * 1e-9);
+		}
+	}
+
+	free(buf);
+}
+
+static volatile int publishing = 0;
+
+static void* publisher(void* arg){
+	while ( publishing ){
+		tweak_publish();
+	}
+	return NULL;
+}
+
+/**
+ * Cost of consistent snapshots: publishing from the application and encoding
+ * refreshes from snapshots, also while another thread keeps publishing (reads
+ * overlapping a publish are retried).
+ */
+static void bench_snapshot(){
+	static const size_t n = 1000;
+	static const unsigned int iterations = 1000;
+
+	int* values;
+	tweak_handle* handles;
+	register_vars(n, &values, &handles);
+	struct var** set = malloc(n * sizeof(struct var*));
+	for ( size_t i = 0; i < n; i++ ){
+		set[i] = var_from_handle(handles[i]);
+	}
+
+	printf("%-22s %-8s %12s %14s\n", "mode", "protocol", "iterations", "ns/variable");
+	for ( int mode = 0; mode < 3; mode++ ){
+		static const char* modes[] = {"direct", "published", "published (writer)"};
+		pthread_t thread;
+		if ( mode == 1 ){
+			const double begin = now();
+			for ( unsigned int it = 0; it < iterations; it++ ){
+				tweak_publish_vars(handles, n * sizeof(tweak_handle));
+			}
+			const double elapsed = now() - begin;
+			printf("%-22s %-8s %12u %14.2f\n", "publish", "-", iterations, elapsed / iterations / n * 1e9);
+		}
+		if ( mode == 2 ){
+			publishing = 1;
+			pthread_create(&thread, NULL, publisher, NULL);
+		}
+
+		for ( int protocol = 0; protocol < WEBSOCKET_NUM_PROTOCOLS; protocol++ ){
+			const double begin = now();
+			for ( unsigned int it = 0; it < iterations; it++ ){
+				frame_unref(websocket_encode_refresh(protocol, set, n, NULL));
+			}
+			const double elapsed = now() - begin;
+			printf("%-22s %-8s %12u %14.2f\n", modes[mode], protocol == WEBSOCKET_BINARY ? "binary" : "json", iterations, elapsed / iterations / n * 1e9);
+		}
+
+		if ( mode == 2 ){
+			publishing = 0;
+			pthread_join(thread, NULL);
+		}
+	}
+
+	tweak_cleanup();
+	free(set);
+	free(handles);
+	free(values);
+}
+
+/* tests/bench_disabled.c */
+void bench_frames_disabled(int* value, tweak_handle handle, unsigned int iterations);
+
+/**
+ * Typical per-frame usage: the value is updated under the lock and refreshed.
+ * Not inlined so the loop is the same as the compiled out one.
+ */
+static void __attribute__((noinline)) bench_frames(int* value, tweak_handle handle, unsigned int iterations){
+	for ( unsigned int it = 0; it < iterations; it++ ){
+		tweak_lock();
+		*(volatile int*)value = (int)it;
+		tweak_unlock();
+		tweak_refresh_vars(&handle, sizeof(tweak_handle));
+	}
+}
+
+/**
+ * Overhead of the library when turned off, at runtime (--tweak-disable) and
+ * at compile time (TWEAK_DISABLE), compared to running normally.
+ */
+static void bench_disabled(){
+	static const unsigned int iterations = 1000000;
+	static char arg0[] = "bench";
+	static char flag[] = "--tweak-disable";
+	char* args[] = {arg0, flag, NULL};
+
+	int value = 0;
+	printf("%-14s %12s %12s\n", "mode", "iterations", "ns/frame");
+
+	tweak_init_args(port, "127.0.0.1", 1, args);
+	tweak_handle handle = tweak_int("value", &value);
+	double begin = now();
+	bench_frames(&value, handle, iterations);
+	const double enabled = now() - begin;
+	tweak_cleanup();
+	printf("%-14s %12u %12.2f\n", "enabled", iterations, enabled / iterations * 1e9);
+
+	tweak_init_args(port, "127.0.0.1", 2, args);
+	handle = tweak_int("value", &value);
+	if ( handle != 0 ) abort();
+	begin = now();
+	bench_frames(&value, handle, iterations);
+	const double runtime = now() - begin;
+	printf("%-14s %12u %12.2f\n", "runtime off", iterations, runtime / iterations * 1e9);
+
+	begin = now();
+	bench_frames_disabled(&value, handle, iterations);
+	const double compiled = now() - begin;
+	printf("%-14s %12u %12.2f\n", "compiled out", iterations, compiled / iterations * 1e9);
+
+	/* turn it back on for the remaining benchmarks */
+	tweak_init_args(port, "127.0.0.1", 1, args);
+	tweak_cleanup();
+}
+
+static const struct {
+	const char* name;
+	void (*func)();
+} benchmarks[] = {
+	{"registry", bench_registry},
+	{"table", bench_table},
+	{"find", bench_find},
+	{"publish", bench_publish},
+	{"broadcast", bench_broadcast},
+	{"serialize", bench_serialize},
+	{"snapshot", bench_snapshot},
+	{"scan", bench_scan},
+	{"unmask", bench_unmask},
+	{"disabled", bench_disabled},
+	{NULL, NULL},
+};
+
+int main(int argc, const char* argv[]){
+	const char* name = argc > 1 ? argv[1] : NULL;
+	int found = 0;
+
+	tweak_output(output);
+
+	for ( int i = 0; benchmarks[i].name; i++ ){
+		if ( name && strcmp(name, benchmarks[i].name) != 0 ) continue;
+		printf("== %s\n", benchmarks[i].name);
+		benchmarks[i].func();
+		found = 1;
+	}
+
+	if ( !found ){
+		fprintf(stderr, "%s: no benchmark named \"%s\"\n", argv[0], name);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,20 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* compiled out, see bench_disabled() in bench.c */
+#define TWEAK_DISABLE
+#include "tweak/tweak.h"
+
+/**
+ * Same loop as bench_frames() in bench.c with every call compiled into a
+ * no-op, i.e. what is left of it in a production build.
+ */
+void bench_frames_disabled(int* value, tweak_handle handle, unsigned int iterations){
+	for ( unsigned int it = 0; it < iterations; it++ ){
+		tweak_lock();
+		*(volatile int*)value = (int)it;
+		tweak_unlock();
+		tweak_refresh_vars(&handle, sizeof(tweak_handle));
+	}
+}
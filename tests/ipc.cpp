@@ -15,7 +15,9 @@
 #include <cstring>
 #include <cerrno>
 #include <unistd.h>
-#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
 
 static struct worker worker;
 
@@ -29,6 +31,9 @@ class Test: public CppUnit::TestFixture {
 	CPPUNIT_TEST(test_ipc_payload);
 	CPPUNIT_TEST(test_ipc_reset);
 	CPPUNIT_TEST(test_ipc_flush);
+	CPPUNIT_TEST(test_ipc_order);
+	CPPUNIT_TEST(test_ipc_doorbell);
+	CPPUNIT_TEST(test_ipc_concurrent);
 	CPPUNIT_TEST_SUITE_END();
 public:
 
@@ -80,13 +85,91 @@ public:
 	}
 
 
-	void assert_empty(){
-		char buf[64];
-		ssize_t r = read(worker.pipe[READ_FD], buf, sizeof(buf));
-		CPPUNIT_ASSERT_EQUAL_MESSAGE("pipe read didn't fail when it was expected, probably still have data", (ssize_t)-1, r);
-		if ( r == -1 ){
-			CPPUNIT_ASSERT_EQUAL_MESSAGE("pipe read should have blocked", true, errno == EAGAIN || errno == EWOULDBLOCK);
+	void test_ipc_order(){
+		for ( char i = 0; i < 10; i++ ){
+			ipc_push(&worker, IPC_TESTING, &i, 1);
+		}
+
+		for ( char i = 0; i < 10; i++ ){
+			char* dst;
+			CPPUNIT_ASSERT_EQUAL(IPC_TESTING, ipc_fetch(&worker, (void**)&dst, NULL));
+			CPPUNIT_ASSERT_EQUAL(i, *dst);
+			free(dst);
 		}
+
+		assert_empty();
+	}
+
+	void test_ipc_doorbell(){
+		/* only the first command should signal the worker */
+		struct pollfd pfd = {worker.efd, POLLIN, 0};
+		CPPUNIT_ASSERT_EQUAL(0, poll(&pfd, 1, 0));
+		ipc_push(&worker, IPC_TESTING, NULL, 0);
+		ipc_push(&worker, IPC_TESTING, NULL, 0);
+		ipc_push(&worker, IPC_TESTING, NULL, 0);
+		CPPUNIT_ASSERT_EQUAL(1, poll(&pfd, 1, 0));
+
+		uint64_t value;
+		CPPUNIT_ASSERT_EQUAL((ssize_t)sizeof(value), read(worker.efd, &value, sizeof(value)));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1, value);
+
+		/* draining must reset the signal */
+		ipc_push(&worker, IPC_TESTING, NULL, 0);
+		while ( ipc_fetch(&worker, NULL, NULL) != IPC_NONE ){}
+		CPPUNIT_ASSERT_EQUAL(0, poll(&pfd, 1, 0));
+	}
+
+	struct message {
+		unsigned int producer;
+		unsigned int seq;
+	};
+
+	static const unsigned int num_producers = 4;
+	static const unsigned int num_messages = 20000;
+
+	static void* producer(void* arg){
+		struct message msg = {(unsigned int)(uintptr_t)arg, 0};
+		for ( ; msg.seq < num_messages; msg.seq++ ){
+			ipc_push(&worker, IPC_TESTING, &msg, sizeof(msg));
+		}
+		return NULL;
+	}
+
+	void test_ipc_concurrent(){
+		pthread_t thread[num_producers];
+		for ( unsigned int i = 0; i < num_producers; i++ ){
+			pthread_create(&thread[i], NULL, producer, (void*)(uintptr_t)i);
+		}
+
+		/* each producer must be received in order and nothing may be lost */
+		unsigned int next[num_producers] = {0,};
+		unsigned int received = 0;
+		while ( received < num_producers * num_messages ){
+			struct pollfd pfd = {worker.efd, POLLIN, 0};
+			CPPUNIT_ASSERT_MESSAGE("lost wakeup", poll(&pfd, 1, 5000) == 1);
+
+			struct message* msg;
+			while ( ipc_fetch(&worker, (void**)&msg, NULL) == IPC_TESTING ){
+				CPPUNIT_ASSERT(msg->producer < num_producers);
+				CPPUNIT_ASSERT_EQUAL(next[msg->producer], msg->seq);
+				next[msg->producer]++;
+				received++;
+				free(msg);
+			}
+		}
+
+		for ( unsigned int i = 0; i < num_producers; i++ ){
+			pthread_join(thread[i], NULL);
+		}
+
+		assert_empty();
+	}
+
+	void assert_empty(){
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("queue still have commands", IPC_NONE, ipc_fetch(&worker, NULL, NULL));
+
+		struct pollfd pfd = {worker.efd, POLLIN, 0};
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("doorbell still signaled", 0, poll(&pfd, 1, 0));
 	}
 };
 
@@ -98,7 +181,7 @@ int main(int argc, const char* argv[]){
 
 	tweak_output(output);
 
-	if ( pipe2(worker.pipe, O_NONBLOCK) != 0){ /* non-block so it is possible to easily test that the pipe is actually empty */
+	if ( ipc_init(&worker) != 0 ){
 		abort();
 	}
 
@@ -0,0 +1,116 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "utils/json_writer.h"
+#include <cmath>
+#include <climits>
+#include <string>
+
+class Test: public CppUnit::TestFixture {
+	CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_empty);
+	CPPUNIT_TEST(test_nested);
+	CPPUNIT_TEST(test_escape);
+	CPPUNIT_TEST(test_int);
+	CPPUNIT_TEST(test_double);
+	CPPUNIT_TEST(test_raw);
+	CPPUNIT_TEST_SUITE_END();
+public:
+
+	void setUp(){
+		buffer_init(&buf);
+		json_writer_init(&w, &buf);
+	}
+
+	void tearDown(){
+		buffer_free(&buf);
+	}
+
+	void test_empty(){
+		json_write_begin_object(&w);
+		json_write_key(&w, "a");
+		json_write_begin_array(&w);
+		json_write_end_array(&w);
+		json_write_key(&w, "b");
+		json_write_begin_object(&w);
+		json_write_end_object(&w);
+		json_write_end_object(&w);
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"a\":[],\"b\":{}}"), str());
+	}
+
+	void test_nested(){
+		json_write_begin_array(&w);
+		for ( int i = 0; i < 2; i++ ){
+			json_write_begin_object(&w);
+			json_write_key(&w, "x");
+			json_write_int(&w, i);
+			json_write_key(&w, "y");
+			json_write_begin_array(&w);
+			json_write_null(&w);
+			json_write_string(&w, "z");
+			json_write_end_array(&w);
+			json_write_end_object(&w);
+		}
+		json_write_end_array(&w);
+		CPPUNIT_ASSERT_EQUAL(std::string("[{\"x\":0,\"y\":[null,\"z\"]},{\"x\":1,\"y\":[null,\"z\"]}]"), str());
+	}
+
+	void test_escape(){
+		json_write_string(&w, "a\"b\\c\nd\x01");
+		CPPUNIT_ASSERT_EQUAL(std::string("\"a\\\"b\\\\c\\nd\\u0001\""), str());
+	}
+
+	void test_int(){
+		json_write_begin_array(&w);
+		json_write_int(&w, 0);
+		json_write_int(&w, -42);
+		json_write_int(&w, LLONG_MIN);
+		json_write_end_array(&w);
+		CPPUNIT_ASSERT_EQUAL(std::string("[0,-42,-9223372036854775808]"), str());
+	}
+
+	void test_double(){
+		json_write_begin_array(&w);
+		json_write_double(&w, 1.0);
+		json_write_double(&w, 0.5);
+		json_write_float(&w, 0.1f);
+		json_write_double(&w, NAN);
+		json_write_end_array(&w);
+		CPPUNIT_ASSERT_EQUAL(std::string("[1.0,0.5,0.100000001,null]"), str());
+	}
+
+	void test_raw(){
+		json_write_begin_object(&w);
+		json_write_key(&w, "options");
+		json_write_raw(&w, "{\"min\":0}", 9);
+		json_write_key(&w, "value");
+		json_write_int(&w, 1);
+		json_write_end_object(&w);
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"options\":{\"min\":0},\"value\":1}"), str());
+	}
+
+	std::string str(){
+		return std::string(buf.data, buf.size);
+	}
+
+private:
+	struct buffer buf;
+	struct json_writer w;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+	CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+	CppUnit::TextUi::TestRunner runner;
+
+	runner.addTest( suite );
+	runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr));
+	return runner.run() ? 0 : 1;
+}
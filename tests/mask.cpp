@@ -0,0 +1,112 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "utils/mask.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const uint8_t key[4] = {0x12, 0x9f, 0x5a, 0xe3};
+static const size_t max_align = 64;
+static const size_t max_size = 300;
+static const size_t guard = 64;
+
+class Test: public CppUnit::TestFixture {
+	CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_exhaustive);
+	CPPUNIT_TEST(test_large);
+	CPPUNIT_TEST(test_roundtrip);
+	CPPUNIT_TEST_SUITE_END();
+public:
+
+	/**
+	 * Byte-wise reference.
+	 */
+	static void reference(char* data, size_t size, size_t offset){
+		for ( size_t i = 0; i < size; i++ ){
+			data[i] ^= key[(offset + i) % 4];
+		}
+	}
+
+	static void fill(std::vector<char>& buf){
+		for ( size_t i = 0; i < buf.size(); i++ ){
+			buf[i] = (char)(i * 31 + 7);
+		}
+	}
+
+	/**
+	 * Compare impl against the reference for a single alignment, size and
+	 * offset. Bytes around the data must be untouched.
+	 */
+	static void check(const struct mask_impl* impl, size_t align, size_t size, size_t offset){
+		std::vector<char> expected(guard + max_align + max_size + guard);
+		fill(expected);
+		std::vector<char> actual = expected;
+
+		/* vector storage is at least 16 byte aligned, align it further */
+		const size_t base = (64 - ((uintptr_t)&actual[guard] & 63)) & 63;
+		reference(&expected[guard + base + align], size, offset);
+		impl->func(&actual[guard + base + align], size, key, offset);
+
+		if ( expected != actual ){
+			char msg[128];
+			snprintf(msg, sizeof(msg), "%s failed with align %zu, size %zu and offset %zu", impl->name, align, size, offset);
+			CPPUNIT_FAIL(msg);
+		}
+	}
+
+	void test_exhaustive(){
+		for ( const struct mask_impl* impl = mask_impls; impl->name; impl++ ){
+			if ( !impl->supported() ) continue;
+			for ( size_t align = 0; align < max_align; align++ ){
+				for ( size_t size = 0; size <= max_size; size++ ){
+					for ( size_t offset = 0; offset < 8; offset++ ){
+						check(impl, align, size, offset);
+					}
+				}
+			}
+		}
+	}
+
+	void test_large(){
+		for ( const struct mask_impl* impl = mask_impls; impl->name; impl++ ){
+			if ( !impl->supported() ) continue;
+			std::vector<char> expected(1024*1024 + 13);
+			fill(expected);
+			std::vector<char> actual = expected;
+			reference(&expected[3], expected.size() - 3, 1);
+			impl->func(&actual[3], actual.size() - 3, key, 1);
+			CPPUNIT_ASSERT_MESSAGE(impl->name, expected == actual);
+		}
+	}
+
+	void test_roundtrip(){
+		std::string data = "The quick brown fox jumps over the lazy dog";
+		const std::string original = data;
+		mask_apply(&data[0], data.size(), key, 0);
+		CPPUNIT_ASSERT(data != original);
+
+		/* unmasking in two pieces */
+		mask_apply(&data[0], 10, key, 0);
+		mask_apply(&data[10], data.size() - 10, key, 10);
+		CPPUNIT_ASSERT_EQUAL(original, data);
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+	CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+	CppUnit::TextUi::TestRunner runner;
+
+	runner.addTest( suite );
+	runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr));
+	return runner.run() ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "ring.h"
+#include <cstring>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+
+static const size_t num_slots = 8;
+static const size_t payload_size = 64;
+
+class Test: public CppUnit::TestFixture {
+	CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_ring_empty);
+	CPPUNIT_TEST(test_ring_fetch);
+	CPPUNIT_TEST(test_ring_consumers);
+	CPPUNIT_TEST(test_ring_lapped);
+	CPPUNIT_TEST(test_ring_too_large);
+	CPPUNIT_TEST(test_ring_concurrent);
+	CPPUNIT_TEST_SUITE_END();
+
+	ring_t ring;
+
+public:
+	void setUp(){
+		ring = ring_alloc(num_slots, payload_size);
+	}
+
+	void tearDown(){
+		ring_free(ring);
+	}
+
+	void test_ring_empty(){
+		uint64_t cursor = ring_head(ring);
+		char buf[payload_size];
+		size_t size;
+		CPPUNIT_ASSERT_EQUAL(RING_EMPTY, ring_fetch(ring, &cursor, buf, &size));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, cursor);
+	}
+
+	void test_ring_fetch(){
+		uint64_t cursor = ring_head(ring);
+		publish("foo");
+		publish("bar");
+
+		CPPUNIT_ASSERT_EQUAL(std::string("foo"), fetch(&cursor));
+		CPPUNIT_ASSERT_EQUAL(std::string("bar"), fetch(&cursor));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)2, cursor);
+		assert_empty(&cursor);
+	}
+
+	void test_ring_consumers(){
+		/* consumers have independent cursors */
+		uint64_t a = ring_head(ring);
+		publish("foo");
+		uint64_t b = ring_head(ring);
+		publish("bar");
+
+		CPPUNIT_ASSERT_EQUAL(std::string("bar"), fetch(&b));
+		assert_empty(&b);
+		CPPUNIT_ASSERT_EQUAL(std::string("foo"), fetch(&a));
+		CPPUNIT_ASSERT_EQUAL(std::string("bar"), fetch(&a));
+		assert_empty(&a);
+	}
+
+	void test_ring_lapped(){
+		uint64_t cursor = ring_head(ring);
+		for ( size_t i = 0; i < num_slots + 1; i++ ){
+			publish("foo");
+		}
+
+		/* consumer is moved to head and only gets new events */
+		char buf[payload_size];
+		size_t size;
+		CPPUNIT_ASSERT_EQUAL(RING_LAPPED, ring_fetch(ring, &cursor, buf, &size));
+		CPPUNIT_ASSERT_EQUAL(ring_head(ring), cursor);
+		publish("bar");
+		CPPUNIT_ASSERT_EQUAL(std::string("bar"), fetch(&cursor));
+	}
+
+	void test_ring_too_large(){
+		char buf[payload_size + 1] = {0,};
+		CPPUNIT_ASSERT(ring_publish(ring, buf, sizeof(buf)) != 0);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, ring_head(ring));
+	}
+
+	static void* producer(void* arg){
+		ring_t ring = (ring_t)arg;
+		char buf[payload_size];
+		for ( unsigned int i = 0; i < 100000; i++ ){
+			memset(buf, i & 0xff, sizeof(buf));
+			ring_publish(ring, buf, sizeof(buf));
+
+			/* give the consumer a chance to keep up now and then */
+			if ( (i % 4) == 0 ){
+				sched_yield();
+			}
+		}
+		return NULL;
+	}
+
+	void test_ring_concurrent(){
+		/* a consumer must never see a torn payload even if it is lapped */
+		pthread_t thread;
+		pthread_create(&thread, NULL, producer, ring);
+
+		uint64_t cursor = 0;
+		unsigned int events = 0;
+		while ( ring_head(ring) < 100000 ){
+			char buf[payload_size];
+			size_t size;
+			if ( ring_fetch(ring, &cursor, buf, &size) != RING_EVENT ) continue;
+
+			CPPUNIT_ASSERT_EQUAL(payload_size, size);
+			for ( size_t i = 1; i < size; i++ ){
+				CPPUNIT_ASSERT_EQUAL(buf[0], buf[i]);
+			}
+			CPPUNIT_ASSERT_EQUAL((char)((cursor - 1) & 0xff), buf[0]);
+			events++;
+		}
+
+		pthread_join(thread, NULL);
+		CPPUNIT_ASSERT_MESSAGE("consumer never kept up with producer", events > 0);
+	}
+
+	void publish(const std::string& str){
+		CPPUNIT_ASSERT_EQUAL(0, ring_publish(ring, str.c_str(), str.size()));
+	}
+
+	std::string fetch(uint64_t* cursor){
+		char buf[payload_size];
+		size_t size;
+		CPPUNIT_ASSERT_EQUAL(RING_EVENT, ring_fetch(ring, cursor, buf, &size));
+		return std::string(buf, size);
+	}
+
+	void assert_empty(uint64_t* cursor){
+		char buf[payload_size];
+		size_t size;
+		CPPUNIT_ASSERT_EQUAL(RING_EMPTY, ring_fetch(ring, cursor, buf, &size));
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+	CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+	CppUnit::TextUi::TestRunner runner;
+
+	runner.addTest( suite );
+	runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr));
+	return runner.run() ? 0 : 1;
+}
@@ -0,0 +1,731 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "tweak/tweak.h"
+#include "server.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+static const int port = 18080;
+static int value = 7;
+static const char json_protocol[] = "v1.tweaklib.sidvind.com";
+static const char binary_protocol[] = "v1.binary.tweaklib.sidvind.com";
+
+static void output(const char* str){
+	fputs(str, stderr);
+}
+
+class Test: public CppUnit::TestFixture {
+	CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_static_file);
+	CPPUNIT_TEST(test_not_found);
+	CPPUNIT_TEST(test_pipelined);
+	CPPUNIT_TEST(test_websocket_hello);
+	CPPUNIT_TEST(test_websocket_refresh);
+	CPPUNIT_TEST(test_websocket_refresh_large);
+	CPPUNIT_TEST(test_websocket_hello_fragmented);
+	CPPUNIT_TEST(test_websocket_refresh_threads);
+	CPPUNIT_TEST(test_websocket_refresh_rate);
+	CPPUNIT_TEST(test_websocket_auto_refresh);
+	CPPUNIT_TEST(test_websocket_groups);
+	CPPUNIT_TEST(test_websocket_remove);
+	CPPUNIT_TEST(test_websocket_binary_refresh);
+	CPPUNIT_TEST(test_websocket_binary_update);
+	CPPUNIT_TEST(test_websocket_deferred_update);
+	CPPUNIT_TEST(test_websocket_publish);
+	CPPUNIT_TEST(test_websocket_deflate);
+	CPPUNIT_TEST(test_websocket_many_frames);
+	CPPUNIT_TEST(test_websocket_fragmented);
+	CPPUNIT_TEST(test_websocket_stalled_client);
+	CPPUNIT_TEST(test_websocket_flooding_client);
+	CPPUNIT_TEST_SUITE_END();
+public:
+
+	void setUp(){
+		tweak_init(port, "127.0.0.1");
+		tweak_int("value", &value);
+	}
+
+	void tearDown(){
+		tweak_cleanup();
+	}
+
+	void test_static_file(){
+		int sd = connect_server();
+		send_string(sd, "GET /index.html HTTP/1.1\r\n\r\n");
+		const std::string response = recv_string(sd, "0\r\n\r\n");
+		CPPUNIT_ASSERT_EQUAL(std::string("HTTP/1.1 200 OK\r\n"), response.substr(0, 17));
+		close(sd);
+	}
+
+	void test_not_found(){
+		int sd = connect_server();
+		send_string(sd, "GET /missing HTTP/1.1\r\n\r\n");
+		const std::string response = recv_string(sd, "0\r\n\r\n");
+		CPPUNIT_ASSERT_EQUAL(std::string("HTTP/1.1 404 Not Found\r\n"), response.substr(0, 24));
+		close(sd);
+	}
+
+	void test_pipelined(){
+		/* both requests in a single send, both must be answered */
+		int sd = connect_server();
+		send_string(sd, "GET /missing HTTP/1.1\r\n\r\nGET /index.html HTTP/1.1\r\n\r\n");
+		std::string response = recv_string(sd, "0\r\n\r\n");
+		CPPUNIT_ASSERT_EQUAL(std::string("HTTP/1.1 404"), response.substr(0, 12));
+		response = response.substr(response.find("0\r\n\r\n") + 5) + recv_string(sd, "0\r\n\r\n");
+		CPPUNIT_ASSERT_EQUAL(std::string("HTTP/1.1 200"), response.substr(0, 12));
+		close(sd);
+	}
+
+	void test_websocket_hello(){
+		int sd = connect_websocket();
+		const std::string hello = recv_frame(sd);
+		CPPUNIT_ASSERT(hello.find("\"type\":\"hello\"") != std::string::npos);
+		CPPUNIT_ASSERT(hello.find("\"name\":\"value\"") != std::string::npos);
+		close(sd);
+	}
+
+	void test_websocket_refresh(){
+		int sd = connect_websocket();
+		recv_frame(sd); /* hello */
+
+		value = 12;
+		tweak_refresh();
+
+		const std::string refresh = recv_frame(sd);
+		CPPUNIT_ASSERT(refresh.find("\"type\":\"refresh\"") != std::string::npos);
+		CPPUNIT_ASSERT(refresh.find("\"value\":12") != std::string::npos);
+		close(sd);
+	}
+
+	void test_websocket_groups(){
+		static int light, quality, volume;
+		tweak_set_group(tweak_int("light", &light), "render/light");
+		tweak_set_group(tweak_int("quality", &quality), "render");
+		tweak_set_group(tweak_int("volume", &volume), "/audio/");
+
+		/* only variables in subscribed groups (and subgroups) are sent */
+		int sd = connect_websocket(json_protocol, "", NULL, "/socket?groups=render%2Flight");
+		const std::string hello = recv_frame(sd);
+		CPPUNIT_ASSERT(hello.find("\"name\":\"light\",\"group\":\"render/light\"") != std::string::npos);
+		CPPUNIT_ASSERT(hello.find("\"name\":\"value\"") == std::string::npos);
+		CPPUNIT_ASSERT(hello.find("\"name\":\"quality\"") == std::string::npos);
+		CPPUNIT_ASSERT(hello.find("\"name\":\"volume\"") == std::string::npos);
+		CPPUNIT_ASSERT(hello.find("\"audio\"") != std::string::npos);
+
+		send_string(sd, client_frame(0x81, "{\"type\":\"subscribe\",\"groups\":[\"audio\"]}"));
+		const std::string add = recv_frame(sd);
+		CPPUNIT_ASSERT(add.find("\"type\":\"add\"") != std::string::npos);
+		CPPUNIT_ASSERT(add.find("\"name\":\"volume\"") != std::string::npos);
+		CPPUNIT_ASSERT(add.find("\"name\":\"light\"") == std::string::npos);
+
+		tweak_refresh();
+		const std::string refresh = recv_frame(sd);
+		CPPUNIT_ASSERT(refresh.find("\"handle\":1,") == std::string::npos);
+		CPPUNIT_ASSERT(refresh.find("\"handle\":2,") != std::string::npos);
+		CPPUNIT_ASSERT(refresh.find("\"handle\":3,") == std::string::npos);
+		CPPUNIT_ASSERT(refresh.find("\"handle\":4,") != std::string::npos);
+
+		send_string(sd, client_frame(0x81, "{\"type\":\"unsubscribe\",\"groups\":[\"render/light\"]}"));
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"handles\":[2],\"type\":\"remove\"}"), recv_frame(sd));
+		close(sd);
+	}
+
+	void test_websocket_remove(){
+		static int other, hidden, kept;
+		const tweak_handle handle = tweak_int("other", &other);
+		tweak_set_group(handle, "render");
+		tweak_set_group(tweak_int("hidden", &hidden), "audio");
+		tweak_set_group(tweak_int("kept", &kept), "render");
+		int sd = connect_websocket(json_protocol, "", NULL, "/socket?groups=render");
+		recv_frame(sd); /* hello */
+
+		/* clients are told incrementally and only about variables they see */
+		tweak_remove(tweak_find("hidden"));
+		tweak_remove(handle);
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"handles\":[2],\"type\":\"remove\"}"), recv_frame(sd));
+
+		/* removed variables are no longer refreshed */
+		tweak_refresh();
+		const std::string refresh = recv_frame(sd);
+		CPPUNIT_ASSERT(refresh.find("\"handle\":2,") == std::string::npos);
+		CPPUNIT_ASSERT(refresh.find("\"handle\":4,") != std::string::npos);
+		close(sd);
+	}
+
+	void test_websocket_binary_refresh(){
+		/* binary protocol is preferred when offered */
+		int sd = connect_websocket(std::string(json_protocol) + ", " + binary_protocol);
+		int opcode;
+		const std::string hello = recv_frame(sd, &opcode);
+		CPPUNIT_ASSERT_EQUAL(0x1, opcode);
+		CPPUNIT_ASSERT(hello.find("\"type\":\"hello\"") != std::string::npos);
+
+		value = 12;
+		tweak_refresh();
+
+		/* type, handle, datatype and value */
+		const std::string refresh = recv_frame(sd, &opcode);
+		CPPUNIT_ASSERT_EQUAL(0x2, opcode);
+		CPPUNIT_ASSERT_EQUAL(std::string("\x01" "\x01\x00\x00\x00" "\x01" "\x0c\x00\x00\x00", 10), refresh);
+		close(sd);
+	}
+
+	void test_websocket_binary_update(){
+		int sd = connect_websocket(binary_protocol);
+		recv_frame(sd); /* hello */
+
+		/* masked binary frame (zero mask) with a single update record */
+		send_string(sd, std::string("\x82\x8a" "\x00\x00\x00\x00"
+		                            "\x02" "\x01\x00\x00\x00" "\x01" "\x2a\x00\x00\x00", 16));
+
+		for ( int i = 0; i < 1000 && value != 42; i++ ){
+			usleep(1000);
+		}
+		CPPUNIT_ASSERT_EQUAL(42, value);
+		close(sd);
+	}
+
+	void test_websocket_deferred_update(){
+		value = 7;
+		tweak_defer_updates(1);
+		int sd = connect_websocket();
+		recv_frame(sd); /* hello */
+
+		send_string(sd, client_frame(0x81, "{\"type\":\"update\",\"handle\":1,\"value\":43}"));
+
+		/* only written by tweak_sync() */
+		usleep(50000);
+		CPPUNIT_ASSERT_EQUAL(7, value);
+		for ( int i = 0; i < 1000 && value != 43; i++ ){
+			usleep(1000);
+			tweak_sync();
+		}
+		CPPUNIT_ASSERT_EQUAL(43, value);
+
+		close(sd);
+		tweak_defer_updates(0);
+	}
+
+	void test_websocket_publish(){
+		tweak_handle set[] = {1};
+		int sd = connect_websocket();
+		recv_frame(sd); /* hello */
+
+		/* once published only the snapshot is sent */
+		value = 5;
+		tweak_publish_vars(set, sizeof(set));
+		value = 6;
+		tweak_refresh();
+		CPPUNIT_ASSERT(recv_frame(sd).find("\"value\":5") != std::string::npos);
+
+		tweak_publish();
+		tweak_refresh();
+		CPPUNIT_ASSERT(recv_frame(sd).find("\"value\":6") != std::string::npos);
+
+		close(sd);
+	}
+
+	void test_websocket_deflate(){
+		tweak_deflate_threshold(0);
+		std::string header;
+		int sd = connect_websocket(json_protocol, "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n", &header);
+		CPPUNIT_ASSERT(header.find("Sec-WebSocket-Extensions: permessage-deflate\r\n") != std::string::npos);
+
+		/* client window is kept between messages */
+		z_stream rx = {};
+		CPPUNIT_ASSERT_EQUAL(Z_OK, inflateInit2(&rx, -15));
+
+		bool compressed;
+		const std::string hello = inflate_message(&rx, recv_frame(sd, NULL, &compressed));
+		CPPUNIT_ASSERT(compressed);
+		CPPUNIT_ASSERT(hello.find("\"type\":\"hello\"") != std::string::npos);
+
+		/* refreshes are compressed once for all clients */
+		for ( int i = 12; i < 14; i++ ){
+			value = i;
+			tweak_refresh();
+			const std::string refresh = inflate_message(&rx, recv_frame(sd, NULL, &compressed));
+			CPPUNIT_ASSERT(compressed);
+			CPPUNIT_ASSERT(refresh.find("\"value\":" + std::to_string(i)) != std::string::npos);
+		}
+		inflateEnd(&rx);
+
+		/* compressed update from client (masked with zero mask) */
+		const std::string update = deflate_message("{\"type\":\"update\",\"handle\":1,\"value\":42}");
+		CPPUNIT_ASSERT(update.size() < 126);
+		send_string(sd, std::string("\xc1") + (char)(0x80 | update.size()) + std::string(4, '\0') + update);
+		for ( int i = 0; i < 1000 && value != 42; i++ ){
+			usleep(1000);
+		}
+		CPPUNIT_ASSERT_EQUAL(42, value);
+
+		close(sd);
+		tweak_deflate_threshold(256);
+	}
+
+	void test_websocket_many_frames(){
+		int sd = connect_websocket();
+		recv_frame(sd); /* hello */
+
+		/* all frames in a single send, the last update must win */
+		std::string data;
+		for ( int i = 1; i <= 50; i++ ){
+			data += client_frame(0x81, "{\"type\":\"update\",\"handle\":1,\"value\":" + std::to_string(i) + "}");
+		}
+		send_string(sd, data);
+		for ( int i = 0; i < 1000 && value != 50; i++ ){
+			usleep(1000);
+		}
+		CPPUNIT_ASSERT_EQUAL(50, value);
+		close(sd);
+	}
+
+	void test_websocket_fragmented(){
+		int sd = connect_websocket();
+		recv_frame(sd); /* hello */
+
+		/* message in three fragments with a ping in between, sent one byte at a
+		 * time so every frame arrives in pieces */
+		const std::string data =
+			client_frame(0x01, "{\"type\":\"update\",") +
+			client_frame(0x89, "ping") +
+			client_frame(0x00, "\"handle\":1,") +
+			client_frame(0x80, "\"value\":77}");
+		for ( size_t i = 0; i < data.size(); i++ ){
+			send_string(sd, data.substr(i, 1));
+			usleep(100);
+		}
+
+		int opcode;
+		CPPUNIT_ASSERT_EQUAL(std::string("ping"), recv_frame(sd, &opcode));
+		CPPUNIT_ASSERT_EQUAL(0xa, opcode);
+		for ( int i = 0; i < 1000 && value != 77; i++ ){
+			usleep(1000);
+		}
+		CPPUNIT_ASSERT_EQUAL(77, value);
+		close(sd);
+	}
+
+	/**
+	 * Encode a masked frame, first is the first header byte (fin, rsv and
+	 * opcode).
+	 */
+	std::string client_frame(unsigned char first, const std::string& payload){
+		static const unsigned char mask[4] = {0x12, 0x34, 0x56, 0x78};
+		std::string frame(1, (char)first);
+		if ( payload.size() < 126 ){
+			frame += (char)(0x80 | payload.size());
+		} else {
+			frame += (char)(0x80 | 126);
+			frame += (char)(payload.size() >> 8);
+			frame += (char)(payload.size() & 0xff);
+		}
+		frame.append((const char*)mask, 4);
+		for ( size_t i = 0; i < payload.size(); i++ ){
+			frame += (char)(payload[i] ^ mask[i & 3]);
+		}
+		return frame;
+	}
+
+	/**
+	 * Decompress a permessage-deflate message.
+	 */
+	std::string inflate_message(z_stream* zs, std::string data){
+		char out[65536];
+		data.append("\x00\x00\xff\xff", 4);
+		zs->next_in = (Bytef*)&data[0];
+		zs->avail_in = data.size();
+		zs->next_out = (Bytef*)out;
+		zs->avail_out = sizeof(out);
+		CPPUNIT_ASSERT_EQUAL(Z_OK, inflate(zs, Z_SYNC_FLUSH));
+		CPPUNIT_ASSERT_EQUAL(0u, zs->avail_in);
+		return std::string(out, sizeof(out) - zs->avail_out);
+	}
+
+	std::string deflate_message(const std::string& data){
+		char out[1024];
+		z_stream zs = {};
+		CPPUNIT_ASSERT_EQUAL(Z_OK, deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY));
+		zs.next_in = (Bytef*)data.data();
+		zs.avail_in = data.size();
+		zs.next_out = (Bytef*)out;
+		zs.avail_out = sizeof(out);
+		CPPUNIT_ASSERT_EQUAL(Z_OK, deflate(&zs, Z_SYNC_FLUSH));
+		const size_t size = sizeof(out) - zs.avail_out - 4;
+		deflateEnd(&zs);
+		return std::string(out, size);
+	}
+
+	void test_websocket_refresh_large(){
+		/* set is much larger than what fits in a ring slot */
+		static int values[1000];
+		tweak_handle handles[1000];
+		for ( int i = 0; i < 1000; i++ ){
+			char name[32];
+			snprintf(name, sizeof(name), "large%d", i);
+			values[i] = i;
+			handles[i] = tweak_int(name, &values[i]);
+		}
+
+		int sd = connect_websocket();
+		recv_frame(sd); /* hello */
+
+		values[999] = 4711;
+		tweak_refresh_vars(handles, sizeof(handles));
+
+		const std::string refresh = recv_frame(sd);
+		CPPUNIT_ASSERT(refresh.find("\"type\":\"refresh\"") != std::string::npos);
+		CPPUNIT_ASSERT(refresh.find("\"value\":998") != std::string::npos);
+		CPPUNIT_ASSERT(refresh.find("\"value\":4711") != std::string::npos);
+		close(sd);
+	}
+
+	void test_websocket_hello_fragmented(){
+		/* hello larger than a single fragment (> 1 MB) */
+		static const int num_vars = 12000;
+		static int values[num_vars];
+		for ( int i = 0; i < num_vars; i++ ){
+			char name[128];
+			snprintf(name, sizeof(name), "a_rather_long_variable_name_to_make_the_hello_message_large_%d", i);
+			tweak_int(name, &values[i]);
+		}
+
+		int sd = connect_websocket();
+		std::string hello;
+		int opcode;
+		bool fin;
+		int fragments = 0;
+		do {
+			hello += recv_frame(sd, &opcode, NULL, &fin);
+			CPPUNIT_ASSERT_EQUAL(fragments == 0 ? 0x1 : 0x0, opcode);
+			fragments++;
+		} while ( !fin );
+
+		CPPUNIT_ASSERT(hello.size() > 1024*1024);
+		CPPUNIT_ASSERT_EQUAL(int((hello.size() + 1024*1024 - 1) / (1024*1024)), fragments);
+		CPPUNIT_ASSERT_EQUAL(std::string("}"), hello.substr(hello.size() - 1));
+		CPPUNIT_ASSERT(hello.find("_large_11999\"") != std::string::npos);
+		close(sd);
+	}
+
+	static const int num_threads = 4;
+	static const int num_refreshes = 50;
+
+	void test_websocket_auto_refresh(){
+		static int other = 5;
+		tweak_handle handle = tweak_int("other", &other);
+		tweak_auto_refresh(100);
+		int sd = connect_websocket();
+		recv_frame(sd); /* hello */
+		usleep(50000); /* let the shadow copy be taken */
+
+		/* no refresh call, only the changed variable is sent */
+		value = 123;
+		const std::string refresh = recv_frame(sd);
+		tweak_auto_refresh(0);
+		CPPUNIT_ASSERT(refresh.find("\"type\":\"refresh\"") != std::string::npos);
+		CPPUNIT_ASSERT(refresh.find("\"value\":123") != std::string::npos);
+		CPPUNIT_ASSERT(refresh.find("\"handle\":" + std::to_string(handle)) == std::string::npos);
+		close(sd);
+	}
+
+	void test_websocket_stalled_client(){
+		/* refreshes large enough to fill the socket buffers quickly */
+		static const int num_vars = 4000;
+		static const int num_refreshes = 500;
+		static int values[num_vars];
+		tweak_handle handles[num_vars];
+		for ( int i = 0; i < num_vars; i++ ){
+			char name[32];
+			snprintf(name, sizeof(name), "stalled%d", i);
+			values[i] = i;
+			handles[i] = tweak_int(name, &values[i]);
+		}
+
+		/* no rate limit and paced refreshes so the output backs up */
+		tweak_refresh_rate(0);
+		int sd = connect_websocket();
+		tweak_refresh_rate(30);
+		recv_frame(sd); /* hello */
+
+		/* client does not read anything meanwhile */
+		for ( int i = 0; i < num_refreshes; i++ ){
+			tweak_refresh_vars(handles, sizeof(handles));
+			usleep(500);
+		}
+		values[num_vars - 1] = 4711;
+		tweak_refresh_vars(handles, sizeof(handles));
+		usleep(100000);
+
+		/* stale refreshes are skipped but the latest value must arrive */
+		int received = 0;
+		for ( ;; ){
+			const std::string refresh = recv_frame(sd);
+			CPPUNIT_ASSERT(refresh.find("\"type\":\"refresh\"") != std::string::npos);
+			received++;
+			if ( refresh.find("\"value\":4711") != std::string::npos ) break;
+		}
+		CPPUNIT_ASSERT(received < num_refreshes);
+		close(sd);
+
+		/* refreshes are held back (coalesced or dropped) while the output is
+		 * backed up so the queue stays bounded */
+		struct tweak_queue_stats stats;
+		tweak_get_queue_stats(&stats);
+		CPPUNIT_ASSERT(stats.max_queued < 64*1024*1024);
+		CPPUNIT_ASSERT_EQUAL(0ULL, stats.overflows);
+	}
+
+	void test_websocket_flooding_client(){
+		/* a client which never stops sending (unsolicited pongs are ignored)
+		 * must not keep the server from answering others */
+		int flood = connect_websocket();
+		recv_frame(flood); /* hello */
+		std::string data;
+		while ( data.size() < 65536 ){
+			data += client_frame(0x8a, std::string(120, 'x'));
+		}
+		fcntl(flood, F_SETFL, O_NONBLOCK);
+
+		int sd = connect_server();
+		send_string(sd, "GET /missing HTTP/1.1\r\n\r\n");
+		fcntl(sd, F_SETFL, O_NONBLOCK);
+		std::string response;
+		size_t offset = 0;
+		struct timeval begin, now;
+		gettimeofday(&begin, NULL);
+		do {
+			/* sends might be partial, frames are kept intact */
+			const ssize_t sent = send(flood, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+			if ( sent == -1 ){
+				CPPUNIT_ASSERT_MESSAGE("send() failed", errno == EAGAIN || errno == EWOULDBLOCK);
+			} else {
+				offset = (offset + sent) % data.size();
+			}
+			char buf[256];
+			const ssize_t bytes = recv(sd, buf, sizeof(buf), 0);
+			if ( bytes > 0 ){
+				response.append(buf, bytes);
+			}
+			gettimeofday(&now, NULL);
+		} while ( response.find("0\r\n\r\n") == std::string::npos && now.tv_sec - begin.tv_sec < 5 );
+		CPPUNIT_ASSERT_EQUAL(std::string("HTTP/1.1 404"), response.substr(0, 12));
+		close(sd);
+
+		/* input left over when the read budget ran out is still read */
+		const struct timeval timeout = {5, 0};
+		fcntl(flood, F_SETFL, 0);
+		setsockopt(flood, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		send_string(flood, data.substr(offset) + client_frame(0x89, "end"));
+		int opcode;
+		CPPUNIT_ASSERT_EQUAL(std::string("end"), recv_frame(flood, &opcode));
+		CPPUNIT_ASSERT_EQUAL(0xa, opcode);
+		close(flood);
+	}
+
+	static void* refresh_thread(void* arg){
+		tweak_handle handle = *(tweak_handle*)arg;
+		for ( int i = 0; i < num_refreshes; i++ ){
+			tweak_refresh_vars(&handle, sizeof(handle));
+		}
+		return NULL;
+	}
+
+	void test_websocket_refresh_threads(){
+		/* refreshes from several threads at once are coalesced */
+		tweak_handle handle = tweak_int("threaded", &value);
+		int sd = connect_websocket();
+		recv_frame(sd); /* hello */
+
+		pthread_t thread[num_threads];
+		for ( int i = 0; i < num_threads; i++ ){
+			pthread_create(&thread[i], NULL, refresh_thread, &handle);
+		}
+		for ( int i = 0; i < num_threads; i++ ){
+			pthread_join(thread[i], NULL);
+		}
+		value = 4711;
+		tweak_refresh_vars(&handle, sizeof(handle));
+
+		int received = 0;
+		for ( ;; ){
+			const std::string refresh = recv_frame(sd);
+			CPPUNIT_ASSERT(refresh.find("\"type\":\"refresh\"") != std::string::npos);
+			received++;
+			if ( refresh.find("\"value\":4711") != std::string::npos ) break;
+		}
+		CPPUNIT_ASSERT(received < num_threads * num_refreshes);
+		close(sd);
+	}
+
+	void test_websocket_refresh_rate(){
+		int sd = connect_websocket();
+		recv_frame(sd); /* hello */
+		send_string(sd, client_frame(0x81, "{\"type\":\"rate\",\"hz\":10}"));
+		usleep(20000);
+
+		/* refreshes every 5 ms for 200 ms, at 10 Hz only about three (plus the
+		 * last value) may be sent */
+		for ( int i = 1; i <= 40; i++ ){
+			value = i;
+			tweak_refresh();
+			usleep(5000);
+		}
+
+		int received = 0;
+		for ( ;; ){
+			const std::string refresh = recv_frame(sd);
+			received++;
+			if ( refresh.find("\"value\":40}") != std::string::npos ) break;
+		}
+		CPPUNIT_ASSERT(received <= 5);
+		close(sd);
+	}
+
+	int connect_server(){
+		int sd = socket(AF_INET, SOCK_STREAM, 0);
+		struct timeval timeout = {5, 0};
+		setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr.s_addr);
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("connect() failed", 0, connect(sd, (struct sockaddr*)&addr, sizeof(addr)));
+		return sd;
+	}
+
+	int connect_websocket(const std::string& protocol = json_protocol, const std::string& extra = "", std::string* header = NULL, const std::string& url = "/socket"){
+		int sd = connect_server();
+		send_string(sd,
+		            "GET " + url + " HTTP/1.1\r\n"
+		            "Upgrade: websocket\r\n"
+		            "Connection: Upgrade\r\n"
+		            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		            "Sec-WebSocket-Version: 13\r\n"
+		            "Sec-WebSocket-Protocol: " + protocol + "\r\n" +
+		            extra +
+		            "\r\n");
+		const std::string response = recv_string(sd, "\r\n\r\n");
+		CPPUNIT_ASSERT_EQUAL(std::string("HTTP/1.1 101"), response.substr(0, 12));
+		CPPUNIT_ASSERT(response.find("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") != std::string::npos);
+		if ( header ){
+			*header = response;
+		}
+		return sd;
+	}
+
+	void send_string(int sd, const std::string& data){
+		CPPUNIT_ASSERT_EQUAL((ssize_t)data.size(), send(sd, data.c_str(), data.size(), 0));
+	}
+
+	/**
+	 * Read one byte at a time until terminator is found so no data past the
+	 * terminator is consumed.
+	 */
+	std::string recv_string(int sd, const std::string& terminator){
+		std::string data;
+		char ch;
+		while ( data.size() < terminator.size() || data.compare(data.size() - terminator.size(), terminator.size(), terminator) != 0 ){
+			CPPUNIT_ASSERT_EQUAL_MESSAGE("recv() failed", (ssize_t)1, recv(sd, &ch, 1, 0));
+			data += ch;
+		}
+		return data;
+	}
+
+	void recv_bytes(int sd, void* dst, size_t size){
+		char* ptr = (char*)dst;
+		while ( size > 0 ){
+			ssize_t bytes = recv(sd, ptr, size, 0);
+			CPPUNIT_ASSERT_MESSAGE("recv() failed", bytes > 0);
+			ptr += bytes;
+			size -= bytes;
+		}
+	}
+
+	std::string recv_frame(int sd, int* opcode = NULL, bool* compressed = NULL, bool* fin = NULL){
+		unsigned char header[2];
+		recv_bytes(sd, header, 2);
+		if ( opcode ){
+			*opcode = header[0] & 0x0f;
+		}
+		if ( compressed ){
+			*compressed = header[0] & 0x40;
+		}
+		if ( fin ){
+			*fin = header[0] & 0x80;
+		}
+
+		uint64_t size = header[1] & 0x7f;
+		if ( size == 126 ){
+			unsigned char ext[2];
+			recv_bytes(sd, ext, 2);
+			size = (ext[0] << 8) | ext[1];
+		} else if ( size == 127 ){
+			unsigned char ext[8];
+			recv_bytes(sd, ext, 8);
+			size = 0;
+			for ( int i = 0; i < 8; i++ ){
+				size = (size << 8) | ext[i];
+			}
+		}
+
+		std::string payload(size, 0);
+		recv_bytes(sd, &payload[0], size);
+		return payload;
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+	static const char* backends[] = {"epoll", "io_uring"};
+	int failed = 0;
+
+	tweak_output(output);
+
+	/* the same tests are run against all backends. If a backend isn't
+	 * available the server falls back to another one, that pass is skipped
+	 * instead of running the fallback again under the wrong name. */
+	for ( unsigned int i = 0; i < sizeof(backends) / sizeof(backends[0]); i++ ){
+		setenv("TWEAK_BACKEND", backends[i], 1);
+		tweak_init(port, "127.0.0.1");
+		const char* selected = server_backend();
+		const bool available = selected && strcmp(selected, backends[i]) == 0;
+		tweak_cleanup();
+		if ( !available ){
+			fprintf(stderr, "backend: %s not available, skipped\n", backends[i]);
+			continue;
+		}
+
+		CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+		CppUnit::TextUi::TestRunner runner;
+
+		fprintf(stderr, "backend: %s\n", backends[i]);
+
+		runner.addTest( suite );
+		runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr));
+		failed |= !runner.run();
+	}
+
+	return failed;
+}
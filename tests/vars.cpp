@@ -0,0 +1,545 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "tweak/tweak.h"
+#include "arena.h"
+#include "group.h"
+#include "staging.h"
+#include "vars.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <json.h>
+
+static TWEAK_VAR(float, section_gain, 1.5f, 0.0, 2.0);
+static TWEAK_VAR(int, section_steps, 4, 1, 16);
+
+static int triggered = 0;
+static void trigger(tweak_handle handle){
+	triggered++;
+}
+
+class Test: public CppUnit::TestFixture {
+	CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_handles);
+	CPPUNIT_TEST(test_invalid_handle);
+	CPPUNIT_TEST(test_growth);
+	CPPUNIT_TEST(test_strings);
+	CPPUNIT_TEST(test_find);
+	CPPUNIT_TEST(test_find_duplicate);
+	CPPUNIT_TEST(test_find_prefix);
+	CPPUNIT_TEST(test_remove);
+	CPPUNIT_TEST(test_remove_duplicate);
+	CPPUNIT_TEST(test_remove_prefix);
+	CPPUNIT_TEST(test_register_table);
+	CPPUNIT_TEST(test_register_table_shared);
+	CPPUNIT_TEST(test_register_section);
+	CPPUNIT_TEST(test_disabled);
+	CPPUNIT_TEST(test_sync);
+	CPPUNIT_TEST(test_publish);
+	CPPUNIT_TEST(test_groups);
+	CPPUNIT_TEST(test_subscription);
+	CPPUNIT_TEST(test_arena_alignment);
+	CPPUNIT_TEST(test_arena_release);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void tearDown(){
+		var_cleanup();
+		group_cleanup();
+	}
+
+	void test_handles(){
+		int a, b;
+		CPPUNIT_ASSERT_EQUAL(size_t(0), var_count());
+		CPPUNIT_ASSERT_EQUAL(1U, tweak_int("a", &a));
+		CPPUNIT_ASSERT_EQUAL(2U, tweak_int("b", &b));
+		CPPUNIT_ASSERT_EQUAL(size_t(2), var_count());
+		CPPUNIT_ASSERT_EQUAL(std::string("a"), std::string(tweak_get_name(1)));
+		CPPUNIT_ASSERT_EQUAL(std::string("b"), std::string(tweak_get_name(2)));
+		CPPUNIT_ASSERT(var_from_handle(2)->ptr == &b);
+		CPPUNIT_ASSERT(var_get(0) == var_from_handle(1));
+	}
+
+	void test_invalid_handle(){
+		int a;
+		tweak_int("a", &a);
+		CPPUNIT_ASSERT(var_from_handle(0) == NULL);
+		CPPUNIT_ASSERT(var_from_handle(2) == NULL);
+		CPPUNIT_ASSERT(tweak_get_name(2) == NULL);
+	}
+
+	void test_growth(){
+		/* records must not move as the registry grows across several chunks */
+		static const unsigned int n = 100000;
+		static int values[n];
+		char name[32];
+
+		tweak_int("var0", &values[0]);
+		struct var* first = var_from_handle(1);
+		for ( unsigned int i = 1; i < n; i++ ){
+			snprintf(name, sizeof(name), "var%u", i);
+			CPPUNIT_ASSERT_EQUAL(i + 1, tweak_int(name, &values[i]));
+		}
+
+		CPPUNIT_ASSERT_EQUAL(size_t(n), var_count());
+		CPPUNIT_ASSERT(first == var_from_handle(1));
+		for ( unsigned int i = 0; i < n; i++ ){
+			const struct var* var = var_from_handle(i + 1);
+			snprintf(name, sizeof(name), "var%u", i);
+			CPPUNIT_ASSERT_EQUAL(i + 1, var->handle);
+			CPPUNIT_ASSERT(var->ptr == &values[i]);
+			CPPUNIT_ASSERT_EQUAL(std::string(name), std::string(var->name));
+		}
+	}
+
+	void test_strings(){
+		char name[] = "original";
+		int a;
+		const tweak_handle handle = tweak_int(name, &a);
+		strcpy(name, "modified");
+		tweak_description(handle, "first");
+		tweak_description(handle, "second");
+		tweak_options(handle, "{\"min\": 0}");
+
+		const struct var* var = var_from_handle(handle);
+		CPPUNIT_ASSERT_EQUAL(std::string("original"), std::string(var->name));
+		CPPUNIT_ASSERT_EQUAL(std::string("second"), std::string(var->description));
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"min\":0}"), std::string(var->options));
+	}
+
+	void test_find(){
+		static const unsigned int n = 10000;
+		static int values[n];
+		char name[32];
+
+		CPPUNIT_ASSERT_EQUAL(0U, tweak_find("var0"));
+		for ( unsigned int i = 0; i < n; i++ ){
+			snprintf(name, sizeof(name), "var%u", i);
+			tweak_int(name, &values[i]);
+		}
+
+		for ( unsigned int i = 0; i < n; i++ ){
+			snprintf(name, sizeof(name), "var%u", i);
+			CPPUNIT_ASSERT_EQUAL(i + 1, tweak_find(name));
+		}
+		CPPUNIT_ASSERT_EQUAL(0U, tweak_find("var"));
+		CPPUNIT_ASSERT_EQUAL(0U, tweak_find("var10000"));
+		CPPUNIT_ASSERT_EQUAL(0U, tweak_find(""));
+	}
+
+	void test_find_duplicate(){
+		int a, b;
+		const tweak_handle first = tweak_int("same", &a);
+		const tweak_handle second = tweak_int("same", &b);
+		CPPUNIT_ASSERT_EQUAL(first, tweak_find("same"));
+
+		/* names are interned */
+		CPPUNIT_ASSERT(var_from_handle(first)->name == var_from_handle(second)->name);
+	}
+
+	void test_find_prefix(){
+		int a;
+		tweak_handle handles[8];
+		tweak_int("light/intensity", &a);
+		tweak_int("camera/fov", &a);
+		tweak_int("light/color", &a);
+
+		CPPUNIT_ASSERT_EQUAL(size_t(2), tweak_find_prefix("light/", handles, 8));
+		CPPUNIT_ASSERT_EQUAL(std::string("light/color"), std::string(tweak_get_name(handles[0])));
+		CPPUNIT_ASSERT_EQUAL(std::string("light/intensity"), std::string(tweak_get_name(handles[1])));
+
+		/* registered after the first lookup */
+		tweak_int("light/ambient", &a);
+		tweak_int("lightmap", &a);
+		CPPUNIT_ASSERT_EQUAL(size_t(3), tweak_find_prefix("light/", handles, 1));
+		CPPUNIT_ASSERT_EQUAL(std::string("light/ambient"), std::string(tweak_get_name(handles[0])));
+
+		CPPUNIT_ASSERT_EQUAL(size_t(5), tweak_find_prefix("", handles, 8));
+		CPPUNIT_ASSERT_EQUAL(size_t(0), tweak_find_prefix("sound/", handles, 8));
+		CPPUNIT_ASSERT_EQUAL(size_t(0), tweak_find_prefix("zzz", handles, 8));
+	}
+
+	void test_remove(){
+		int a, b, c;
+		const tweak_handle first = tweak_int("a", &a);
+		const tweak_handle second = tweak_int("b", &b);
+		struct var* var = var_from_handle(first);
+		tweak_description(first, "description");
+
+		tweak_remove(first);
+		CPPUNIT_ASSERT(var_from_handle(first) == NULL);
+		CPPUNIT_ASSERT(tweak_get_name(first) == NULL);
+		CPPUNIT_ASSERT_EQUAL(0U, tweak_find("a"));
+		CPPUNIT_ASSERT_EQUAL(second, tweak_find("b"));
+		tweak_remove(first); /* stale handle is ignored */
+
+		/* the slot is reused with a new generation, the stale handle stays
+		 * invalid */
+		const tweak_handle third = tweak_int("c", &c);
+		CPPUNIT_ASSERT(third != first);
+		CPPUNIT_ASSERT_EQUAL(VAR_INDEX(first), VAR_INDEX(third));
+		CPPUNIT_ASSERT(var_from_handle(third) == var);
+		CPPUNIT_ASSERT(var_from_handle(first) == NULL);
+		CPPUNIT_ASSERT(var->ptr == &c);
+		CPPUNIT_ASSERT(var->description == NULL);
+		CPPUNIT_ASSERT_EQUAL(size_t(2), var_count());
+		CPPUNIT_ASSERT_EQUAL(third, tweak_find("c"));
+
+		/* generations wrap but never produce the invalid handle */
+		tweak_handle handle = third;
+		for ( unsigned int i = 0; i < 300; i++ ){
+			tweak_remove(handle);
+			handle = tweak_int("c", &c);
+			CPPUNIT_ASSERT(handle != 0);
+			CPPUNIT_ASSERT(handle <= 0x7fffffffU);
+			CPPUNIT_ASSERT_EQUAL(VAR_INDEX(first), VAR_INDEX(handle));
+		}
+		CPPUNIT_ASSERT_EQUAL(size_t(2), var_count());
+	}
+
+	void test_remove_duplicate(){
+		int a, b, c;
+		const tweak_handle first = tweak_int("same", &a);
+		const tweak_handle second = tweak_int("same", &b);
+		const tweak_handle third = tweak_int("same", &c);
+
+		/* the next variable with the same name takes over the name index */
+		tweak_remove(first);
+		CPPUNIT_ASSERT_EQUAL(second, tweak_find("same"));
+		tweak_remove(second);
+		CPPUNIT_ASSERT_EQUAL(third, tweak_find("same"));
+		CPPUNIT_ASSERT_EQUAL(std::string("same"), std::string(tweak_get_name(third)));
+		tweak_remove(third);
+		CPPUNIT_ASSERT_EQUAL(0U, tweak_find("same"));
+	}
+
+	void test_remove_prefix(){
+		static const unsigned int n = 1000;
+		static int values[n];
+		tweak_handle handles[n];
+		char name[32];
+
+		for ( unsigned int i = 0; i < n; i++ ){
+			snprintf(name, sizeof(name), "var%04u", i);
+			handles[i] = tweak_int(name, &values[i]);
+		}
+		CPPUNIT_ASSERT_EQUAL(size_t(n), tweak_find_prefix("var", NULL, 0));
+
+		/* remove every other variable and register new ones in their slots */
+		for ( unsigned int i = 0; i < n; i += 2 ){
+			tweak_remove(handles[i]);
+		}
+		CPPUNIT_ASSERT_EQUAL(size_t(n / 2), tweak_find_prefix("var", NULL, 0));
+		for ( unsigned int i = 0; i < n; i += 2 ){
+			snprintf(name, sizeof(name), "new%04u", i);
+			tweak_int(name, &values[i]);
+		}
+		CPPUNIT_ASSERT_EQUAL(size_t(n), var_count());
+		CPPUNIT_ASSERT_EQUAL(size_t(n / 2), tweak_find_prefix("var", NULL, 0));
+		CPPUNIT_ASSERT_EQUAL(size_t(n / 2), tweak_find_prefix("new", handles, n));
+		for ( unsigned int i = 0; i < n / 2; i++ ){
+			snprintf(name, sizeof(name), "new%04u", i * 2);
+			CPPUNIT_ASSERT_EQUAL(std::string(name), std::string(tweak_get_name(handles[i])));
+		}
+	}
+
+	void test_register_table(){
+		static int count;
+		static float gain;
+		static double precise;
+		static const tweak_descriptor table[] = {
+			{"count", TWEAK_INT, &count, "number of things", 0, 10, 1},
+			{"gain", TWEAK_FLOAT, &gain, NULL, 0, 0, 0.25},
+			{"precise", TWEAK_DOUBLE, &precise, NULL, 0, 0, 0},
+			{"broken", (tweak_type)0, &count, NULL, 0, 0, 1},
+		};
+		tweak_handle handles[4];
+
+		CPPUNIT_ASSERT_EQUAL(size_t(3), tweak_register_table(table, 4, handles));
+		CPPUNIT_ASSERT_EQUAL(1U, handles[0]);
+		CPPUNIT_ASSERT_EQUAL(2U, handles[1]);
+		CPPUNIT_ASSERT_EQUAL(3U, handles[2]);
+		CPPUNIT_ASSERT_EQUAL(0U, handles[3]);
+		CPPUNIT_ASSERT_EQUAL(handles[1], tweak_find("gain"));
+
+		/* strings are not copied */
+		const struct var* var = var_from_handle(handles[0]);
+		CPPUNIT_ASSERT(var->name == table[0].name);
+		CPPUNIT_ASSERT(var->description == table[0].description);
+		CPPUNIT_ASSERT(var->ptr == &count);
+		CPPUNIT_ASSERT_EQUAL(DATATYPE_INTEGER, var->datatype);
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"min\":0,\"max\":10,\"step\":1}"), std::string(var->options));
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"step\":0.25}"), std::string(var_from_handle(handles[1])->options));
+		CPPUNIT_ASSERT(var_from_handle(handles[2])->options == NULL);
+
+		/* identical ranges are formatted once but each variable owns its
+		 * copy of the options */
+		static const tweak_descriptor same[] = {
+			{"first", TWEAK_INT, &count, NULL, 0, 10, 1},
+			{"second", TWEAK_INT, &count, NULL, 0, 10, 1},
+		};
+		tweak_handle shared[2];
+		tweak_register_table(same, 2, shared);
+		CPPUNIT_ASSERT(var_from_handle(shared[0])->options != var_from_handle(shared[1])->options);
+		CPPUNIT_ASSERT(!(var_from_handle(shared[0])->borrowed & VAR_BORROWED_OPTIONS));
+		tweak_options(shared[0], "{\"min\":1}");
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"min\":0,\"max\":10,\"step\":1}"), std::string(var_from_handle(shared[1])->options));
+		CPPUNIT_ASSERT_EQUAL(DATATYPE_DOUBLE, var_from_handle(handles[2])->datatype);
+
+		/* borrowed strings are replaced and removed without being freed */
+		tweak_description(handles[0], "copied");
+		CPPUNIT_ASSERT_EQUAL(std::string("copied"), std::string(var->description));
+		tweak_remove(handles[0]);
+		tweak_remove(handles[1]);
+		CPPUNIT_ASSERT_EQUAL(0U, tweak_find("count"));
+		CPPUNIT_ASSERT_EQUAL(std::string("number of things"), std::string(table[0].description));
+	}
+
+	void test_register_table_shared(){
+		/* names from tables are never interned with copied names */
+		static int a, b, c;
+		static const tweak_descriptor table[] = {
+			{"same", TWEAK_INT, &b, NULL, 0, 0, 0},
+		};
+		const tweak_handle first = tweak_int("same", &a);
+		tweak_handle second;
+		tweak_register_table(table, 1, &second);
+		const tweak_handle third = tweak_int("same", &c);
+		CPPUNIT_ASSERT(var_from_handle(second)->name == table[0].name);
+		CPPUNIT_ASSERT(var_from_handle(third)->name == var_from_handle(first)->name);
+
+		tweak_remove(first);
+		CPPUNIT_ASSERT_EQUAL(second, tweak_find("same"));
+		const tweak_handle fourth = tweak_int("same", &a);
+		CPPUNIT_ASSERT(var_from_handle(fourth)->name != table[0].name);
+		tweak_remove(second);
+		CPPUNIT_ASSERT_EQUAL(std::string("same"), std::string(tweak_get_name(fourth)));
+
+		/* the lowest slot takes over, fourth reused the slot of first */
+		CPPUNIT_ASSERT_EQUAL(fourth, tweak_find("same"));
+		tweak_remove(fourth);
+		CPPUNIT_ASSERT_EQUAL(third, tweak_find("same"));
+	}
+
+	void test_register_section(){
+		CPPUNIT_ASSERT_EQUAL(ptrdiff_t(2), __stop_tweak_vars - __start_tweak_vars);
+
+		TWEAK_REGISTER_MODULE();
+		CPPUNIT_ASSERT_EQUAL(size_t(2), var_count());
+		const struct var* gain = var_from_handle(tweak_find("section_gain"));
+		const struct var* steps = var_from_handle(tweak_find("section_steps"));
+		CPPUNIT_ASSERT(gain && gain->ptr == &section_gain);
+		CPPUNIT_ASSERT(steps && steps->ptr == &section_steps);
+		CPPUNIT_ASSERT_EQUAL(1.5f, section_gain);
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"min\":1,\"max\":16}"), std::string(steps->options));
+
+		/* registering again does nothing */
+		TWEAK_REGISTER_MODULE();
+		CPPUNIT_ASSERT_EQUAL(size_t(2), var_count());
+	}
+
+	void test_disabled(){
+		static char arg0[] = "vars";
+		static char flag[] = "--tweak-disable";
+		char* args[] = {arg0, flag, NULL};
+		int a = 0;
+
+		/* nothing is registered, not even the section */
+		tweak_init_args(0, NULL, 2, args);
+		CPPUNIT_ASSERT(tweak_disabled());
+		CPPUNIT_ASSERT_EQUAL(size_t(0), var_count());
+		CPPUNIT_ASSERT_EQUAL(0U, tweak_int("a", &a));
+
+		const tweak_descriptor table[] = {{"b", TWEAK_INT, &a, NULL, 0, 0, 0}};
+		tweak_handle handles[] = {7};
+		CPPUNIT_ASSERT_EQUAL(size_t(0), tweak_register_table(table, 1, handles));
+		CPPUNIT_ASSERT_EQUAL(0U, handles[0]);
+		CPPUNIT_ASSERT_EQUAL(size_t(0), var_count());
+
+		/* lock is a no-op so locking twice does not deadlock */
+		tweak_lock();
+		tweak_lock();
+		tweak_unlock();
+		tweak_refresh_vars(handles, sizeof(handles));
+		tweak_refresh();
+
+		/* without the flag it is turned back on */
+		tweak_init_args(0, NULL, 1, args);
+		CPPUNIT_ASSERT(!tweak_disabled());
+		CPPUNIT_ASSERT_EQUAL(size_t(2), var_count());
+		CPPUNIT_ASSERT(tweak_int("a", &a) != 0);
+		tweak_cleanup();
+	}
+
+	void test_sync(){
+		int a = 1;
+		float b = 2.0f;
+		int c = 3;
+		const tweak_handle ha = tweak_int("a", &a);
+		const tweak_handle hb = tweak_float("b", &b);
+		const tweak_handle hc = tweak_int("c", &c);
+		tweak_trigger(ha, trigger);
+		tweak_trigger(hb, trigger);
+
+		/* staged values are not written until synced */
+		for ( int i = 10; i <= 12; i++ ){
+			struct json_object* value = json_object_new_int(i);
+			staging_load(var_from_handle(ha), value);
+			json_object_put(value);
+		}
+		const char packed[] = {0x00, 0x00, 0x40, 0x40}; /* 3.0f little-endian */
+		CPPUNIT_ASSERT_EQUAL(size_t(4), staging_unpack(var_from_handle(hb), packed, sizeof(packed)));
+		CPPUNIT_ASSERT_EQUAL(size_t(0), staging_unpack(var_from_handle(hb), packed, 2));
+		struct json_object* value = json_object_new_int(99);
+		staging_load(var_from_handle(hc), value);
+		json_object_put(value);
+		CPPUNIT_ASSERT_EQUAL(1, a);
+		CPPUNIT_ASSERT_EQUAL(2.0f, b);
+
+		/* latest value wins and each trigger is called once, removed
+		 * variables are skipped */
+		tweak_remove(hc);
+		triggered = 0;
+		tweak_sync();
+		CPPUNIT_ASSERT_EQUAL(12, a);
+		CPPUNIT_ASSERT_EQUAL(3.0f, b);
+		CPPUNIT_ASSERT_EQUAL(3, c);
+		CPPUNIT_ASSERT_EQUAL(2, triggered);
+
+		/* nothing left */
+		tweak_sync();
+		CPPUNIT_ASSERT_EQUAL(2, triggered);
+	}
+
+	void test_publish(){
+		float a = 1.0f;
+		double b = 2.0;
+		tweak_handle set[] = {tweak_float("a", &a), tweak_double("b", &b)};
+		struct var* va = var_from_handle(set[0]);
+		struct var* vb = var_from_handle(set[1]);
+		struct var tmp;
+		union var_value value;
+
+		/* read directly until published */
+		CPPUNIT_ASSERT(var_snapshot(va, &tmp, &value) == va);
+
+		/* first publish moves the value, later ones do not */
+		const unsigned int layout = var_layout();
+		tweak_publish_vars(set, sizeof(set));
+		CPPUNIT_ASSERT(var_layout() != layout);
+		const unsigned int published = var_layout();
+		a = 3.0f;
+		b = 4.0;
+		CPPUNIT_ASSERT(var_snapshot(va, &tmp, &value) == &tmp);
+		CPPUNIT_ASSERT(tmp.ptr == &value);
+		CPPUNIT_ASSERT_EQUAL(1.0f, value.f);
+		var_snapshot(vb, &tmp, &value);
+		CPPUNIT_ASSERT_EQUAL(2.0, value.d);
+
+		tweak_publish();
+		CPPUNIT_ASSERT_EQUAL(published, var_layout());
+		var_snapshot(va, &tmp, &value);
+		CPPUNIT_ASSERT_EQUAL(3.0f, value.f);
+		var_snapshot(vb, &tmp, &value);
+		CPPUNIT_ASSERT_EQUAL(4.0, value.d);
+		CPPUNIT_ASSERT_EQUAL(4U, vb->seq);
+	}
+
+	void test_groups(){
+		const struct group* light;
+		const struct group* render;
+		const struct group* found;
+
+		CPPUNIT_ASSERT_EQUAL(0, group_create("/render//light/", &light));
+		CPPUNIT_ASSERT_EQUAL(std::string("render/light"), std::string(light->name));
+		render = light->parent;
+		CPPUNIT_ASSERT_EQUAL(std::string("render"), std::string(render->name));
+		CPPUNIT_ASSERT(render->parent == NULL);
+
+		CPPUNIT_ASSERT_EQUAL(0, group_create("render", &found));
+		CPPUNIT_ASSERT(found == render);
+		CPPUNIT_ASSERT_EQUAL(0, group_find("render/light", &found));
+		CPPUNIT_ASSERT(found == light);
+		CPPUNIT_ASSERT_EQUAL(0, group_find("", &found));
+		CPPUNIT_ASSERT(found == NULL);
+		CPPUNIT_ASSERT(group_find("audio", &found) != 0);
+
+		/* variables refer to the group */
+		int a;
+		const tweak_handle handle = tweak_int("a", &a);
+		tweak_set_group(handle, "render/light");
+		CPPUNIT_ASSERT(var_from_handle(handle)->group == light);
+		tweak_set_group(handle, NULL);
+		CPPUNIT_ASSERT(var_from_handle(handle)->group == NULL);
+	}
+
+	void test_subscription(){
+		const struct group* light;
+		const struct group* audio;
+		group_create("render/light", &light);
+		group_create("audio", &audio);
+
+		struct subscription sub;
+		subscription_init(&sub, 0);
+		CPPUNIT_ASSERT(!subscription_visible(&sub, NULL));
+		CPPUNIT_ASSERT(!subscription_visible(&sub, light));
+
+		/* subgroups are included */
+		subscription_add(&sub, light->parent);
+		CPPUNIT_ASSERT(subscription_visible(&sub, light));
+		CPPUNIT_ASSERT(!subscription_visible(&sub, audio));
+		CPPUNIT_ASSERT(!subscription_visible(&sub, NULL));
+
+		/* root includes everything */
+		subscription_add(&sub, NULL);
+		CPPUNIT_ASSERT(subscription_visible(&sub, audio));
+		subscription_remove(&sub, NULL);
+		subscription_remove(&sub, light->parent);
+		CPPUNIT_ASSERT(!subscription_visible(&sub, light));
+		subscription_free(&sub);
+	}
+
+	void test_arena_alignment(){
+		struct arena arena = ARENA_INITIALIZER;
+		arena_strdup(&arena, "x");
+		for ( size_t size = 1; size < 100000; size *= 3 ){
+			void* ptr = arena_alloc(&arena, size, sizeof(double));
+			CPPUNIT_ASSERT(ptr != NULL);
+			CPPUNIT_ASSERT_EQUAL(size_t(0), (size_t)ptr % sizeof(double));
+			memset(ptr, 0xff, size);
+		}
+		arena_free(&arena);
+	}
+
+	void test_arena_release(){
+		struct arena arena = ARENA_INITIALIZER;
+		char* a = arena_strdup(&arena, "first");
+		char* b = arena_strdup(&arena, "second");
+		arena_release(&arena, a, strlen(a) + 1);
+
+		/* same size class is reused, other sizes are not */
+		CPPUNIT_ASSERT(arena_strdup(&arena, "a much longer string") != a);
+		CPPUNIT_ASSERT(arena_strdup(&arena, "third") == a);
+		CPPUNIT_ASSERT(arena_strdup(&arena, "fourth") != a);
+		CPPUNIT_ASSERT_EQUAL(std::string("second"), std::string(b));
+		arena_free(&arena);
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+	CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+	CppUnit::TextUi::TestRunner runner;
+
+	runner.addTest( suite );
+	runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr));
+	return runner.run() ? 0 : 1;
+}
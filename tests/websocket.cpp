@@ -8,13 +8,20 @@
 #include <cppunit/extensions/HelperMacros.h>
 
 #include "websocket.h"
+#include "wsdeflate.h"
 #include "utils/sha1.h"
 #include <cstring>
+#include <zlib.h>
+#include <string>
 
 class Test: public CppUnit::TestFixture {
 	CPPUNIT_TEST_SUITE(Test);
 	CPPUNIT_TEST(test_derive_key);
 	CPPUNIT_TEST(test_sha1);
+	CPPUNIT_TEST(test_deflate_negotiate);
+	CPPUNIT_TEST(test_deflate_roundtrip);
+	CPPUNIT_TEST(test_deflate_shared);
+	CPPUNIT_TEST(test_deflate_final);
 	CPPUNIT_TEST_SUITE_END();
 public:
 
@@ -42,6 +49,150 @@ public:
 
 		sha1_free(s);
 	}
+
+	void test_deflate_negotiate(){
+		struct { const char* header; const char* response; } tests[] = {
+			{NULL, NULL},
+			{"x-webkit-deflate-frame", NULL},
+			{"permessage-deflate", "permessage-deflate"},
+			{"permessage-deflate; client_max_window_bits", "permessage-deflate"},
+			{"permessage-deflate; server_no_context_takeover", "permessage-deflate; server_no_context_takeover"},
+			{"permessage-deflate; client_no_context_takeover", "permessage-deflate"},
+			{"permessage-deflate; server_max_window_bits=10", NULL},
+			{"permessage-deflate; server_max_window_bits=\"15\"", "permessage-deflate"},
+			{"permessage-deflate; unknown_param", NULL},
+			{"permessage-deflate; server_max_window_bits=10, permessage-deflate; server_no_context_takeover", "permessage-deflate; server_no_context_takeover"},
+		};
+
+		for ( unsigned int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++ ){
+			char response[64] = {0,};
+			struct wsdeflate* state = wsdeflate_negotiate(tests[i].header, response, sizeof(response));
+			CPPUNIT_ASSERT_EQUAL_MESSAGE(tests[i].header ?: "NULL", tests[i].response != NULL, state != NULL);
+			if ( state ){
+				CPPUNIT_ASSERT_EQUAL(std::string(tests[i].response), std::string(response));
+			}
+			wsdeflate_free(state);
+		}
+	}
+
+	void test_deflate_roundtrip(){
+		/* tx and rx of the same state acts as both ends of the connection and
+		 * history is kept between messages */
+		char response[64];
+		struct wsdeflate* state = wsdeflate_negotiate("permessage-deflate", response, sizeof(response));
+		struct buffer compressed = BUFFER_INITIALIZER;
+		struct buffer decompressed = BUFFER_INITIALIZER;
+		const std::string message = "{\"type\":\"refresh\",\"vars\":[{\"handle\":1,\"value\":12},{\"handle\":2,\"value\":12}]}";
+
+		size_t first = 0;
+		for ( int i = 0; i < 3; i++ ){
+			CPPUNIT_ASSERT_EQUAL(0, wsdeflate_compress(state, &compressed, message.data(), message.size()));
+			CPPUNIT_ASSERT_EQUAL(0, wsdeflate_decompress(state, &decompressed, compressed.data, compressed.size, 1024));
+			CPPUNIT_ASSERT_EQUAL(message, std::string(decompressed.data, decompressed.size));
+			if ( i == 0 ){
+				first = compressed.size;
+			} else {
+				CPPUNIT_ASSERT_MESSAGE("context takeover not used", compressed.size < first);
+			}
+		}
+
+		/* output exceeding the limit is rejected */
+		CPPUNIT_ASSERT_EQUAL(0, wsdeflate_compress(state, &compressed, message.data(), message.size()));
+		CPPUNIT_ASSERT(wsdeflate_decompress(state, &decompressed, compressed.data, compressed.size, 10) != 0);
+
+		buffer_free(&decompressed);
+		buffer_free(&compressed);
+		wsdeflate_free(state);
+	}
+
+	void test_deflate_shared(){
+		/* shared messages are decompressible by a client with any history */
+		char response[64];
+		struct wsdeflate* state = wsdeflate_negotiate("permessage-deflate", response, sizeof(response));
+		struct buffer compressed = BUFFER_INITIALIZER;
+		struct buffer decompressed = BUFFER_INITIALIZER;
+		const std::string a = "{\"type\":\"hello\",\"vars\":[]}";
+		const std::string b = "{\"type\":\"refresh\",\"vars\":[]}";
+
+		CPPUNIT_ASSERT_EQUAL(0, wsdeflate_compress(state, &compressed, a.data(), a.size()));
+		CPPUNIT_ASSERT_EQUAL(0, wsdeflate_decompress(state, &decompressed, compressed.data, compressed.size, 1024));
+		CPPUNIT_ASSERT_EQUAL(0, wsdeflate_compress(NULL, &compressed, b.data(), b.size()));
+		CPPUNIT_ASSERT_EQUAL(0, wsdeflate_decompress(state, &decompressed, compressed.data, compressed.size, 1024));
+		CPPUNIT_ASSERT_EQUAL(b, std::string(decompressed.data, decompressed.size));
+
+		/* the client window now has the shared message as well so the
+		 * connection compressor must start over */
+		wsdeflate_desync(state);
+		CPPUNIT_ASSERT_EQUAL(0, wsdeflate_compress(state, &compressed, a.data(), a.size()));
+		CPPUNIT_ASSERT_EQUAL(0, wsdeflate_decompress(state, &decompressed, compressed.data, compressed.size, 1024));
+		CPPUNIT_ASSERT_EQUAL(a, std::string(decompressed.data, decompressed.size));
+
+		buffer_free(&decompressed);
+		buffer_free(&compressed);
+		wsdeflate_free(state);
+		wsdeflate_cleanup();
+	}
+
+	/* compress message as a client ending it with a BFINAL block, with the
+	 * window primed with earlier messages when using context takeover */
+	static void deflate_final(struct buffer* dst, const std::string& message, const std::string& history){
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		CPPUNIT_ASSERT_EQUAL(Z_OK, deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY));
+		if ( !history.empty() ){
+			CPPUNIT_ASSERT_EQUAL(Z_OK, deflateSetDictionary(&zs, (const Bytef*)history.data(), history.size()));
+		}
+		buffer_clear(dst);
+		const size_t avail = deflateBound(&zs, message.size());
+		zs.next_in = (Bytef*)message.data();
+		zs.avail_in = message.size();
+		zs.next_out = (Bytef*)buffer_reserve(dst, avail);
+		zs.avail_out = avail;
+		CPPUNIT_ASSERT_EQUAL(Z_STREAM_END, deflate(&zs, Z_FINISH));
+		dst->size += avail - zs.avail_out;
+		deflateEnd(&zs);
+	}
+
+	void test_deflate_final(){
+		/* clients may end a message with a BFINAL block, the next message
+		 * still refers back to it unless context takeover is disabled */
+		char response[64];
+		struct wsdeflate* state = wsdeflate_negotiate("permessage-deflate", response, sizeof(response));
+		struct buffer compressed = BUFFER_INITIALIZER;
+		struct buffer decompressed = BUFFER_INITIALIZER;
+		const std::string a = "{\"type\":\"update\",\"handle\":1,\"value\":12}";
+		const std::string b = "{\"type\":\"update\",\"handle\":2,\"value\":7}";
+
+		std::string history;
+		for ( const std::string& message: {a, b, a} ){
+			deflate_final(&compressed, message, history);
+			CPPUNIT_ASSERT_EQUAL(0, wsdeflate_decompress(state, &decompressed, compressed.data, compressed.size, 1024));
+			CPPUNIT_ASSERT_EQUAL(message, std::string(decompressed.data, decompressed.size));
+			history += message;
+		}
+
+		/* a regular sync flushed message after a final block */
+		CPPUNIT_ASSERT_EQUAL(0, wsdeflate_compress(NULL, &compressed, b.data(), b.size()));
+		CPPUNIT_ASSERT_EQUAL(0, wsdeflate_decompress(state, &decompressed, compressed.data, compressed.size, 1024));
+		CPPUNIT_ASSERT_EQUAL(b, std::string(decompressed.data, decompressed.size));
+		wsdeflate_free(state);
+
+		/* without context takeover each message starts with an empty window */
+		state = wsdeflate_negotiate("permessage-deflate; client_no_context_takeover", response, sizeof(response));
+		CPPUNIT_ASSERT_EQUAL(std::string("permessage-deflate"), std::string(response));
+		for ( const std::string& message: {a, b} ){
+			deflate_final(&compressed, message, "");
+			CPPUNIT_ASSERT_EQUAL(0, wsdeflate_decompress(state, &decompressed, compressed.data, compressed.size, 1024));
+			CPPUNIT_ASSERT_EQUAL(message, std::string(decompressed.data, decompressed.size));
+		}
+		deflate_final(&compressed, a, b);
+		CPPUNIT_ASSERT(wsdeflate_decompress(state, &decompressed, compressed.data, compressed.size, 1024) != 0);
+
+		buffer_free(&decompressed);
+		buffer_free(&compressed);
+		wsdeflate_free(state);
+		wsdeflate_cleanup();
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Test);
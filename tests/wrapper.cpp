@@ -0,0 +1,118 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "tweak/tweak.hpp"
+#include "group.h"
+#include "vars.h"
+#include <string>
+
+class Test: public CppUnit::TestFixture {
+	CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST(test_register);
+	CPPUNIT_TEST(test_range);
+	CPPUNIT_TEST(test_scope);
+	CPPUNIT_TEST(test_churn);
+	CPPUNIT_TEST(test_refresh);
+	CPPUNIT_TEST(test_publish);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void tearDown(){
+		var_cleanup();
+		group_cleanup();
+	}
+
+	void test_register(){
+		tweak::var<int> count("count", 3);
+		tweak::var<float> gain("gain");
+		tweak::var<double> precise("precise", 0.5, tweak::range(), "description");
+
+		const struct var* var = var_from_handle(count.handle());
+		CPPUNIT_ASSERT(var != NULL);
+		CPPUNIT_ASSERT_EQUAL(DATATYPE_INTEGER, var->datatype);
+		CPPUNIT_ASSERT(var->ptr == &count.get());
+		CPPUNIT_ASSERT_EQUAL(DATATYPE_FLOAT, var_from_handle(gain.handle())->datatype);
+		CPPUNIT_ASSERT_EQUAL(DATATYPE_DOUBLE, var_from_handle(precise.handle())->datatype);
+		CPPUNIT_ASSERT_EQUAL(std::string("description"), std::string(var_from_handle(precise.handle())->description));
+
+		/* behaves like the value */
+		CPPUNIT_ASSERT_EQUAL(6, count * 2);
+		count = 5;
+		CPPUNIT_ASSERT_EQUAL(5, *(int*)var->ptr);
+		CPPUNIT_ASSERT_EQUAL(0.0f, gain.get());
+	}
+
+	void test_range(){
+		static constexpr tweak::range unit(0.0, 1.0, 0.25);
+		tweak::var<float> alpha("alpha", 1.0f, unit);
+		tweak::var<int> steps("steps", 0, tweak::range(0, 0, 2));
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"min\":0.0,\"max\":1.0,\"step\":0.25}"), std::string(var_from_handle(alpha.handle())->options));
+		CPPUNIT_ASSERT_EQUAL(std::string("{\"step\":2}"), std::string(var_from_handle(steps.handle())->options));
+	}
+
+	void test_scope(){
+		tweak_handle handle;
+		{
+			tweak::var<int> scoped("scoped");
+			handle = scoped.handle();
+			CPPUNIT_ASSERT_EQUAL(handle, tweak_find("scoped"));
+		}
+
+		/* removed when destroyed */
+		CPPUNIT_ASSERT(var_from_handle(handle) == NULL);
+		CPPUNIT_ASSERT_EQUAL(0U, tweak_find("scoped"));
+	}
+
+	void test_churn(){
+		/* ranged variables created and destroyed repeatedly (e.g. per
+		 * entity) must release everything they allocated */
+		{
+			tweak::var<float> warmup("warmup", 0.5f, tweak::range(0.0, 1.0, 0.1));
+		}
+		const size_t memory = var_memory();
+		for ( int i = 0; i < 10000; i++ ){
+			tweak::var<float> v("entity", 0.5f, tweak::range(0.0, 1.0 + i, 0.1), "per entity");
+			CPPUNIT_ASSERT(v.handle() != 0);
+		}
+		CPPUNIT_ASSERT_EQUAL(memory, var_memory());
+	}
+
+	void test_refresh(){
+		/* server is not running so refreshes are discarded, only checks that
+		 * variables and handles can be mixed */
+		tweak::var<int> a("a");
+		tweak::var<float> b("b");
+		tweak::refresh(a, b, a.handle());
+		tweak::refresh();
+	}
+
+	void test_publish(){
+		tweak::var<double> a("a", 1.5);
+		tweak::var<int> b("b", 2);
+		tweak::publish(a, b.handle());
+		CPPUNIT_ASSERT(var_published(var_from_handle(a.handle())));
+		CPPUNIT_ASSERT(var_published(var_from_handle(b.handle())));
+		CPPUNIT_ASSERT_EQUAL(1.5, var_from_handle(a.handle())->snapshot.d);
+
+		a = 2.5;
+		tweak::publish();
+		CPPUNIT_ASSERT_EQUAL(2.5, var_from_handle(a.handle())->snapshot.d);
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+	CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+	CppUnit::TextUi::TestRunner runner;
+
+	runner.addTest( suite );
+	runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr));
+	return runner.run() ? 0 : 1;
+}
@@ -17,8 +17,19 @@ typedef void(*tweak_callback)(tweak_handle handle);
 typedef void(*tweak_output_func)(const char* str);
 typedef struct {const char* key; int value;} tweak_enum_value;
 
+/**
+ * Start the server. Setting the environment variable TWEAK_DISABLE (to
+ * anything but "" or "0") turns the library off at runtime: the server is not
+ * started, variables are not registered (handles are 0) and locking and
+ * refreshing return immediately.
+ */
 void tweak_init(int port, const char* addr);
 
+/**
+ * Same as tweak_init() but the command line may also turn the library off
+ * with "--tweak-disable" (arguments are not removed). As the switch is read
+ * here it must be called before any variable is registered.
+ */
 void tweak_init_args(int port, const char* addr, int argc, char* argv[]);
 
 void tweak_cleanup();
@@ -53,6 +64,90 @@ tweak_handle tweak_vector(const char* name, float*, unsigned int components);
 tweak_handle tweak_color(const char* name, float*, unsigned int components);
 tweak_handle tweak_enum(const char* name, int* ptr, tweak_enum_value* values, unsigned int n);
 
+/**
+ * Datatypes for tweak_register_table().
+ */
+typedef enum {
+	TWEAK_INT = 1,
+	TWEAK_FLOAT = 2,
+	TWEAK_DOUBLE = 3,
+} tweak_type;
+
+/**
+ * Static description of a tweakable variable. min, max and step are the same
+ * as the options of the same name (see tweak_options()), min and max are only
+ * set if they differ and step if non-zero.
+ */
+typedef struct {
+	const char* name;
+	tweak_type type;
+	void* ptr;
+	const char* description;           /* optional */
+	double min;
+	double max;
+	double step;
+} tweak_descriptor;
+
+/**
+ * Register a table of variables in one pass. Room for all variables is
+ * allocated at once and names and descriptions are not copied, i.e. they must
+ * stay valid until the variables are removed (usually string literals in a
+ * static table).
+ *
+ * @param handles if non-NULL it receives the handle of each variable (0 if it
+ *                could not be registered).
+ * @return number of registered variables.
+ */
+size_t tweak_register_table(const tweak_descriptor* table, size_t n, tweak_handle* handles);
+
+/**
+ * Register the descriptors between begin and end (see TWEAK_VAR()). Nothing
+ * is registered if the first descriptor already is, so calling it again is
+ * harmless.
+ */
+void tweak_register_section(const tweak_descriptor* begin, const tweak_descriptor* end);
+
+/**
+ * Define a tweakable variable with a descriptor in the "tweak_vars" linker
+ * section, so it is registered by tweak_init() without any code elsewhere:
+ *
+ *   TWEAK_VAR(float, gain, 1.0f, 0.0, 2.0);
+ *   static TWEAK_VAR(int, steps, 4, 1, 16);
+ *
+ * Only int, float and double are supported. The descriptor is a constant so
+ * nothing runs before tweak_init(). tweak_init() registers the variables of
+ * the executable or library calling it, other libraries using TWEAK_VAR()
+ * must call TWEAK_REGISTER_MODULE() themselves. With TWEAK_DISABLE defined
+ * only the plain variable is defined.
+ */
+#ifndef TWEAK_DISABLE
+#define TWEAK_TYPE_int TWEAK_INT
+#define TWEAK_TYPE_float TWEAK_FLOAT
+#define TWEAK_TYPE_double TWEAK_DOUBLE
+
+/* descriptors are aligned explicitly so the compiler does not pad them
+ * (the section is walked as an array) */
+#define TWEAK_VAR(type, name, value, min, max) \
+	type name = (value); \
+	static const tweak_descriptor tweak_var_##name \
+	__attribute__((used, section("tweak_vars"), aligned(sizeof(void*)))) = \
+	{#name, TWEAK_TYPE_##type, &name, NULL, (min), (max), 0}
+
+/* bounds of the section defined by the linker, per module as they are
+ * hidden (and NULL if the module has no variables) */
+extern const tweak_descriptor __start_tweak_vars[] __attribute__((weak, visibility("hidden")));
+extern const tweak_descriptor __stop_tweak_vars[] __attribute__((weak, visibility("hidden")));
+
+#define TWEAK_REGISTER_MODULE() tweak_register_section(__start_tweak_vars, __stop_tweak_vars)
+#define tweak_init(port, addr) (TWEAK_REGISTER_MODULE(), tweak_init((port), (addr)))
+
+/* registered afterwards as the arguments may disable the library */
+#define tweak_init_args(port, addr, argc, argv) (tweak_init_args((port), (addr), (argc), (argv)), TWEAK_REGISTER_MODULE())
+#else
+#define TWEAK_VAR(type, name, value, min, max) type name = (value)
+#define TWEAK_REGISTER_MODULE() ((void)0)
+#endif
+
 void tweak_trigger(tweak_handle handle, tweak_callback callback);
 
 void tweak_description(tweak_handle handle, const char* description);
@@ -71,12 +166,50 @@ void tweak_options(tweak_handle handle, const char* json);
 
 /**
  * Assigns a tweakable variable to a named group. This will display all
- * variables together.
+ * variables together. Groups are hierarchical with "/" separating levels, e.g.
+ * "render/lighting" is a subgroup of "render", and are created as needed.
+ * NULL or "" moves the variable back to the root.
+ *
+ * Clients may subscribe to a subset of the groups and are only sent variables
+ * in those groups (and their subgroups). Assign the group directly after
+ * registering the variable, clients are not told when a variable changes
+ * group.
  */
 void tweak_set_group(tweak_handle handle, const char* group);
 
+/**
+ * Remove a tweakable variable. Connected clients are told to remove it and the
+ * handle becomes invalid (functions taking it do nothing). The handle of a
+ * later variable may reuse the slot but with a different generation so stale
+ * handles are detected, generations wrap after 128 reuses of the same slot.
+ *
+ * Blocks until the server thread is no longer using the variable, thus must
+ * not be called with tweak_lock() held. Must not be called concurrently with
+ * registering variables.
+ */
+void tweak_remove(tweak_handle handle);
+
 const char* tweak_get_name(tweak_handle handle);
 
+/**
+ * Find a variable by name. Lookups are constant time using a hashed index of
+ * the names. If several variables share a name the first registered is found
+ * (or, after it is removed, the next remaining in order of handle slot).
+ * Must not be called concurrently with registering or removing variables.
+ *
+ * @return handle or 0 if no variable has that name.
+ */
+tweak_handle tweak_find(const char* name);
+
+/**
+ * Find all variables whose name starts with prefix (an empty prefix matches
+ * all variables), ordered by name. At most max handles are written to handles.
+ * Same restrictions as tweak_find().
+ *
+ * @return total number of matching variables (may be larger than max).
+ */
+size_t tweak_find_prefix(const char* prefix, tweak_handle* handles, size_t max);
+
 /**
  * Lock tweaklib from performing updates (i.e. mutex). Some datatypes will cause
  * race conditions (such as strings) so locking is needed.
@@ -84,6 +217,41 @@ const char* tweak_get_name(tweak_handle handle);
 void tweak_lock();
 void tweak_unlock();
 
+/**
+ * Defer updates from clients until tweak_sync() instead of writing them into
+ * the variables from the server thread (under tweak_lock()). Off by default.
+ * In this mode the application never waits for the server thread and
+ * triggers are called from tweak_sync() rather than the server thread.
+ */
+void tweak_defer_updates(int defer);
+
+/**
+ * Apply all deferred updates and call the triggers of the updated variables,
+ * typically once per frame from the thread owning the variables. A variable
+ * updated several times since the last call gets the latest value and its
+ * trigger is called once, after all values are applied. Never blocks.
+ */
+void tweak_sync();
+
+/**
+ * Publish a consistent snapshot of the values of all (or selected) variables.
+ * Clients are otherwise sent values read from the variables by the server
+ * thread while the application may be writing them. Once a variable has been
+ * published the server only reads its latest snapshot, each copied and read
+ * under a sequence counter so a read overlapping a publish is retried instead
+ * of the application taking tweak_lock(). Publish from the thread writing the
+ * variables, typically at the end of a frame before refreshing:
+ *
+ *   tweak_publish_vars(set, sizeof(set));
+ *   tweak_refresh_vars(set, sizeof(set));
+ *
+ * Updates from clients (or values written afterwards) are not sent until the
+ * variable is published again. Automatic refresh detects changes of published
+ * variables when they are published.
+ */
+void tweak_publish();
+void tweak_publish_vars(tweak_set vars, size_t size);
+
 /**
  * Send an updated copy of all variables to connected clients.
  */
@@ -96,6 +264,117 @@ void tweak_refresh();
  */
 void tweak_refresh_vars(tweak_set vars, size_t size);
 
+/**
+ * Maximum number of refreshes per second sent to each client, variables
+ * refreshed in between are coalesced and sent with their latest value. Clients
+ * may ask for a different rate. Default is 30, zero sends refreshes as soon as
+ * possible. Only affects clients connecting afterwards.
+ */
+void tweak_refresh_rate(unsigned int hz);
+
+/**
+ * Detect changes automatically instead of (or in addition to) calling
+ * tweak_refresh() and tweak_refresh_vars(). A copy of the values of all
+ * variables is compared against the live values hz times per second and only
+ * variables which changed are sent. Zero (default) disables it.
+ */
+void tweak_auto_refresh(unsigned int hz);
+
+/**
+ * Output queue counters since the library was loaded. When a client falls
+ * behind, queued refreshes not yet sent are dropped and replaced by a single
+ * full refresh once its output has drained (resync).
+ */
+struct tweak_queue_stats {
+	unsigned long long dropped;            /* refresh frames dropped before being sent */
+	unsigned long long resyncs;            /* full refreshes sent to clients which fell behind */
+	unsigned long long overflows;          /* connections closed because the output queue was full */
+	unsigned long long max_queued;         /* largest output queue (bytes) of any connection */
+};
+
+void tweak_get_queue_stats(struct tweak_queue_stats* stats);
+
+/**
+ * Websocket compression (permessage-deflate) counters since the library was
+ * loaded. The ratio bytes_out / bytes_in and cpu_ns can be used to tune the
+ * threshold.
+ */
+struct tweak_deflate_stats {
+	unsigned long long messages;           /* messages sent compressed */
+	unsigned long long skipped;            /* messages sent uncompressed (below threshold) */
+	unsigned long long bytes_in;           /* payload bytes before compression */
+	unsigned long long bytes_out;          /* payload bytes after compression */
+	unsigned long long cpu_ns;             /* CPU time spent compressing and decompressing */
+};
+
+void tweak_get_deflate_stats(struct tweak_deflate_stats* stats);
+
+/**
+ * Messages smaller than this (in bytes) are sent uncompressed even if the
+ * client supports compression. Default is 256 bytes.
+ */
+void tweak_deflate_threshold(size_t bytes);
+
+/**
+ * Defining TWEAK_DISABLE before including this header compiles every call
+ * into an inline no-op, the arguments are still evaluated but nothing else
+ * remains (not even a reference to the library, so it need not be linked).
+ * Functions return 0 or NULL and statistics are zeroed. As the functions are
+ * replaced by macros their addresses cannot be taken in this mode.
+ */
+#ifdef TWEAK_DISABLE
+static inline tweak_handle tweak_disabled_handle(void){ return 0; }
+static inline size_t tweak_disabled_size(void){ return 0; }
+static inline const char* tweak_disabled_name(void){ return NULL; }
+
+static inline void tweak_disabled_queue_stats(struct tweak_queue_stats* stats){
+	stats->dropped = stats->resyncs = stats->overflows = stats->max_queued = 0;
+}
+
+static inline void tweak_disabled_deflate_stats(struct tweak_deflate_stats* stats){
+	stats->messages = stats->skipped = stats->bytes_in = stats->bytes_out = stats->cpu_ns = 0;
+}
+
+#define tweak_init(port, addr) ((void)(port), (void)(addr))
+#define tweak_init_args(port, addr, argc, argv) ((void)(port), (void)(addr), (void)(argc), (void)(argv))
+#define tweak_cleanup() ((void)0)
+#define tweak_output(callback) ((void)(callback))
+
+#define tweak_int(name, ptr) ((void)(name), (void)(ptr), tweak_disabled_handle())
+#define tweak_float(name, ptr) ((void)(name), (void)(ptr), tweak_disabled_handle())
+#define tweak_double(name, ptr) ((void)(name), (void)(ptr), tweak_disabled_handle())
+#define tweak_time(name, ptr, speed) ((void)(name), (void)(ptr), (void)(speed), tweak_disabled_handle())
+#define tweak_string(name, ptr) ((void)(name), (void)(ptr), tweak_disabled_handle())
+#define tweak_vector(name, ptr, components) ((void)(name), (void)(ptr), (void)(components), tweak_disabled_handle())
+#define tweak_color(name, ptr, components) ((void)(name), (void)(ptr), (void)(components), tweak_disabled_handle())
+#define tweak_enum(name, ptr, values, n) ((void)(name), (void)(ptr), (void)(values), (void)(n), tweak_disabled_handle())
+#define tweak_register_table(table, n, handles) ((void)(table), (void)(n), (void)(handles), tweak_disabled_size())
+#define tweak_register_section(begin, end) ((void)(begin), (void)(end))
+
+#define tweak_trigger(handle, callback) ((void)(handle), (void)(callback))
+#define tweak_description(handle, description) ((void)(handle), (void)(description))
+#define tweak_options(handle, json) ((void)(handle), (void)(json))
+#define tweak_set_group(handle, group) ((void)(handle), (void)(group))
+#define tweak_remove(handle) ((void)(handle))
+#define tweak_get_name(handle) ((void)(handle), tweak_disabled_name())
+#define tweak_find(name) ((void)(name), tweak_disabled_handle())
+#define tweak_find_prefix(prefix, handles, max) ((void)(prefix), (void)(handles), (void)(max), tweak_disabled_size())
+
+#define tweak_lock() ((void)0)
+#define tweak_unlock() ((void)0)
+#define tweak_defer_updates(defer) ((void)(defer))
+#define tweak_sync() ((void)0)
+#define tweak_publish() ((void)0)
+#define tweak_publish_vars(vars, size) ((void)(vars), (void)(size))
+#define tweak_refresh() ((void)0)
+#define tweak_refresh_vars(vars, size) ((void)(vars), (void)(size))
+#define tweak_refresh_rate(hz) ((void)(hz))
+#define tweak_auto_refresh(hz) ((void)(hz))
+#define tweak_get_queue_stats(stats) tweak_disabled_queue_stats(stats)
+#define tweak_get_deflate_stats(stats) tweak_disabled_deflate_stats(stats)
+#define tweak_deflate_threshold(bytes) ((void)(bytes))
+#endif /* TWEAK_DISABLE */
+
 #ifdef __cplusplus
 }
 #endif
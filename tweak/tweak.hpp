@@ -0,0 +1,156 @@
+#ifndef TWEAKLIB_HPP
+#define TWEAKLIB_HPP
+
+/**
+ * C++ wrapper for tweaklib (header-only).
+ *
+ *   static tweak::var<float> gain("gain", 1.0f, tweak::range(0.0, 2.0, 0.1));
+ *   float x = gain * 2;
+ *   gain = 0.5f;
+ *   tweak::refresh(gain, speed);
+ *
+ * The datatype is selected at compile time from the type of the variable and
+ * options are given as a tweak::range instead of JSON. Variables are
+ * registered without copying or parsing anything (see tweak_register_table())
+ * and removed when destroyed.
+ */
+
+#include "tweak/tweak.h"
+#include <cstddef>
+
+namespace tweak {
+
+/**
+ * Range and step of a numerical variable, same as the "min", "max" and "step"
+ * options. min and max are only used if they differ and step if non-zero.
+ */
+struct range {
+	double min;
+	double max;
+	double step;
+
+	constexpr range(double min = 0, double max = 0, double step = 0)
+		: min(min)
+		, max(max)
+		, step(step) {}
+};
+
+namespace detail {
+
+template <typename T>
+struct datatype {
+	static_assert(sizeof(T) == 0, "tweak::var only supports int, float and double");
+};
+
+template <> struct datatype<int> { static constexpr tweak_type value = TWEAK_INT; };
+template <> struct datatype<float> { static constexpr tweak_type value = TWEAK_FLOAT; };
+template <> struct datatype<double> { static constexpr tweak_type value = TWEAK_DOUBLE; };
+
+} /* namespace detail */
+
+/**
+ * Tweakable variable holding a value of type T. The name and description are
+ * not copied and must outlive the variable (e.g. string literals).
+ *
+ * The value is registered by address so variables can be neither copied nor
+ * moved. Destroying a variable removes it (see tweak_remove()), which waits
+ * for the server thread and thus must not happen with tweak_lock() held.
+ */
+template <typename T>
+class var {
+public:
+	explicit var(const char* name, T value = T(), range r = range(), const char* description = nullptr)
+		: value_(value)
+		, handle_(0) {
+		const tweak_descriptor desc = {name, detail::datatype<T>::value, &value_, description, r.min, r.max, r.step};
+		tweak_register_table(&desc, 1, &handle_);
+	}
+
+	~var(){
+		if ( handle_ ){
+			tweak_remove(handle_);
+		}
+	}
+
+	var(const var&) = delete;
+	var& operator=(const var&) = delete;
+
+	/**
+	 * Handle for the C API, 0 if registration failed.
+	 */
+	tweak_handle handle() const { return handle_; }
+
+	const T& get() const { return value_; }
+	operator const T&() const { return value_; }
+
+	/**
+	 * Assign a new value, clients are updated on the next tweak::refresh()
+	 * (or automatically, see tweak_auto_refresh()).
+	 */
+	var& operator=(const T& value){
+		value_ = value;
+		return *this;
+	}
+
+	void description(const char* description){ tweak_description(handle_, description); }
+	void trigger(tweak_callback callback){ tweak_trigger(handle_, callback); }
+	void group(const char* group){ tweak_set_group(handle_, group); }
+
+private:
+	T value_;
+	tweak_handle handle_;
+};
+
+namespace detail {
+
+inline tweak_handle handle_of(tweak_handle handle){ return handle; }
+
+template <typename T>
+inline tweak_handle handle_of(const var<T>& v){ return v.handle(); }
+
+} /* namespace detail */
+
+/**
+ * Send updated copies of the given variables (tweak::var or handles) to
+ * connected clients. The set of handles is built on the stack.
+ */
+template <typename... Vars>
+inline void refresh(const Vars&... vars){
+	tweak_handle set[] = {detail::handle_of(vars)...};
+	tweak_refresh_vars(set, sizeof(set));
+}
+
+/**
+ * Send updated copies of all variables to connected clients.
+ */
+inline void refresh(){
+	tweak_refresh();
+}
+
+/**
+ * Publish consistent snapshots of the given variables (tweak::var or
+ * handles), see tweak_publish().
+ */
+template <typename... Vars>
+inline void publish(const Vars&... vars){
+	tweak_handle set[] = {detail::handle_of(vars)...};
+	tweak_publish_vars(set, sizeof(set));
+}
+
+/**
+ * Publish consistent snapshots of all variables.
+ */
+inline void publish(){
+	tweak_publish();
+}
+
+/**
+ * Apply updates from clients, see tweak_defer_updates().
+ */
+inline void sync(){
+	tweak_sync();
+}
+
+} /* namespace tweak */
+
+#endif /* TWEAKLIB_HPP */